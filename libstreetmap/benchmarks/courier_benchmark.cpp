@@ -0,0 +1,602 @@
+/*
+ * Benchmarks traveling_courier on instances loaded from files. Every instance
+ * is run with each time limit, thread count and seed, the returned legs are
+ * checked, and the results are printed as a table and can be saved as CSV and
+ * JSON so runs can be compared between versions. With --replan, every instance
+ * is also solved without its last deliveries and replanned to add them back,
+ * and with --fleet it is also split between that many trucks
+ *
+ * Usage: benchmark_libstreetmap [--budgets 5,15] [--threads 1,4] [--seeds 1,2,3] [--mode anneal|memetic]
+ *                               [--replan] [--fleet trucks] [--csv file] [--json file] instance_files...
+ *
+ * Instance files have one value per line: "map <path>", "right_turn_penalty <s>",
+ * "left_turn_penalty <s>", "truck_capacity <c>", "depots <ids...>" and a
+ * "delivery <pickUp> <dropOff> <weight>" line for every delivery. Lines starting with # are skipped
+ */
+
+#include "m1.h"
+#include "m3.h"
+#include "m4.h"
+#include "m4_courier.h"
+#include "m4_replan.h"
+#include "m4_fleet.h"
+#include "m4_stats.h"
+#include "m4_row_cache.h"
+#include "map_db.h"
+#include "StreetsDatabaseAPI.h"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+#include <omp.h>
+
+//Program exit codes
+constexpr int SUCCESS_EXIT_CODE = 0;        //Every route was valid
+constexpr int ERROR_EXIT_CODE = 1;          //A route was invalid or an instance couldn't be loaded
+constexpr int BAD_ARGUMENTS_EXIT_CODE = 2;  //Invalid command-line usage
+
+struct CourierInstance {
+    std::string name;
+    std::string map_path;
+    std::vector<DeliveryInfo> deliveries;
+    std::vector<unsigned> depots;
+    float right_turn_penalty = 0;
+    float left_turn_penalty = 0;
+    float truck_capacity = 0;
+};
+
+struct BenchmarkResult {
+    std::string instance;
+    double budget = 0;
+    int threads = 0;
+    long long seed = 0;
+    bool is_valid = false;
+    std::string error; // Why the route isn't valid
+    double travel_time = 0; // Travel time of the returned legs, with turn penalties
+    double wall_time = 0;
+    double matrix_time = 0;
+    unsigned long swaps = 0; // Swaps tried by every annealing thread together
+    double swaps_per_second = 0;
+    std::string stats_json;
+};
+
+// Reads an instance file, returns false if it can't be read
+bool load_instance(const std::string &file_name, CourierInstance &instance);
+
+// Splits a comma separated list of numbers
+bool parse_list(const std::string &list, std::vector<double> &values);
+
+// Checks the legs start and end at a depot, follow the streets, and pick up and drop off
+// every delivery without going over the capacity. Fills travel_time if they do, error if not
+bool validate_legs(const CourierInstance &instance,
+                   const std::vector<CourierSubpath> &legs,
+                   double &travel_time,
+                   std::string &error);
+
+// Checks the legs of one truck like validate_legs, but only for the deliveries it picks up. state is
+// 0 before the pickup of each delivery, 1 in the truck and 2 dropped off, and is shared between the
+// trucks. Adds the time of the legs to travel_time
+bool validate_truck_legs(const CourierInstance &instance,
+                         const std::vector<CourierSubpath> &legs,
+                         float capacity,
+                         std::vector<int> &state,
+                         double &travel_time,
+                         std::string &error);
+
+// Fills error with the first delivery that wasn't dropped off, if there is one
+bool all_dropped_off(const std::vector<int> &state, std::string &error);
+
+BenchmarkResult run_instance(const CourierInstance &instance,
+                             const CourierOptions &options,
+                             int threads,
+                             long long seed);
+
+// Solves the instance without its last quarter of deliveries, then times replan_courier adding
+// them back and cancelling every eighth of the others. The legs are checked against the deliveries left
+BenchmarkResult run_replan(const CourierInstance &instance,
+                           int threads,
+                           long long seed);
+
+// Times fleet_courier with num_trucks trucks of the instance's capacity, every other one kept to
+// a depot, and checks the legs of every truck and that each delivery is done by one of them
+BenchmarkResult run_fleet(const CourierInstance &instance,
+                          unsigned num_trucks,
+                          double budget,
+                          int threads,
+                          long long seed);
+
+void print_table(const std::vector<BenchmarkResult> &results);
+bool save_csv(const std::string &file_name, const std::vector<BenchmarkResult> &results);
+bool save_json(const std::string &file_name, const std::vector<BenchmarkResult> &results);
+
+
+int main(int argc, char** argv) {
+    std::vector<double> budgets = {5, 15};
+    std::vector<double> thread_counts = {1, (double)omp_get_max_threads()};
+    std::vector<double> seeds = {1, 2, 3};
+    std::string csv_file, json_file;
+    bool is_replan_run = false;
+    unsigned num_fleet_trucks = 0;
+    CourierOptions options;
+    std::vector<std::string> instance_files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--budgets" && has_value && parse_list(argv[i + 1], budgets)) ++i;
+        else if (arg == "--threads" && has_value && parse_list(argv[i + 1], thread_counts)) ++i;
+        else if (arg == "--seeds" && has_value && parse_list(argv[i + 1], seeds)) ++i;
+        else if (arg == "--csv" && has_value) csv_file = argv[++i];
+        else if (arg == "--json" && has_value) json_file = argv[++i];
+        else if (arg == "--replan") is_replan_run = true;
+        else if (arg == "--fleet" && has_value) num_fleet_trucks = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--mode" && has_value) {
+            std::string mode = argv[++i];
+            if (mode != "anneal" && mode != "memetic") {
+                std::cerr << "Unknown mode '" << mode << "'\n";
+                return BAD_ARGUMENTS_EXIT_CODE;
+            }
+            options.mode = mode == "memetic" ? MEMETIC_MODE : ANNEAL_MODE;
+        }
+        else if (arg.compare(0, 2, "--") != 0) instance_files.push_back(arg);
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--budgets 5,15] [--threads 1,4] [--seeds 1,2,3] [--mode anneal|memetic]"
+                      << " [--replan] [--fleet trucks] [--csv file] [--json file] instance_files...\n";
+            return BAD_ARGUMENTS_EXIT_CODE;
+        }
+    }
+
+    if (instance_files.empty()) {
+        std::cerr << "No instance files given\n";
+        return BAD_ARGUMENTS_EXIT_CODE;
+    }
+
+    std::vector<BenchmarkResult> results;
+    std::string loaded_map;
+    bool all_valid = true;
+
+    for (const std::string &file_name : instance_files) {
+        CourierInstance instance;
+        if (!load_instance(file_name, instance)) {
+            std::cerr << "Failed to read instance '" << file_name << "'\n";
+            all_valid = false;
+            continue;
+        }
+
+        // Instances on the same map are usually next to each other, so the map is only loaded when it changes
+        if (instance.map_path != loaded_map) {
+            if (!loaded_map.empty()) close_map();
+            loaded_map.clear();
+
+            if (!load_map(instance.map_path)) {
+                std::cerr << "Failed to load map '" << instance.map_path << "'\n";
+                all_valid = false;
+                continue;
+            }
+            loaded_map = instance.map_path;
+        }
+
+        for (double budget : budgets) {
+            for (double threads : thread_counts) {
+                for (double seed : seeds) {
+                    options.time_limit = budget;
+                    BenchmarkResult result = run_instance(instance, options, (int)threads, (long long)seed);
+                    all_valid = all_valid && result.is_valid;
+
+                    std::cout << instance.name << " budget " << budget << " threads " << threads << " seed " << seed
+                              << ": " << (result.is_valid ? "valid" : result.error)
+                              << ", travel time " << result.travel_time << std::endl;
+                    results.push_back(result);
+                }
+            }
+        }
+
+        for (double threads : thread_counts) {
+            for (double seed : seeds) {
+                if (!is_replan_run) continue;
+
+                BenchmarkResult result = run_replan(instance, (int)threads, (long long)seed);
+                all_valid = all_valid && result.is_valid;
+
+                std::cout << result.instance << " threads " << threads << " seed " << seed
+                          << ": " << (result.is_valid ? "valid" : result.error)
+                          << ", travel time " << result.travel_time << std::endl;
+                results.push_back(result);
+            }
+        }
+
+        for (double budget : budgets) {
+            for (double threads : thread_counts) {
+                for (double seed : seeds) {
+                    if (num_fleet_trucks == 0) continue;
+
+                    BenchmarkResult result = run_fleet(instance, num_fleet_trucks, budget, (int)threads, (long long)seed);
+                    all_valid = all_valid && result.is_valid;
+
+                    std::cout << result.instance << " budget " << budget << " threads " << threads << " seed " << seed
+                              << ": " << (result.is_valid ? "valid" : result.error)
+                              << ", travel time " << result.travel_time << std::endl;
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+    if (!loaded_map.empty()) close_map();
+
+    print_table(results);
+    if (!csv_file.empty() && !save_csv(csv_file, results)) {
+        std::cerr << "Failed to write '" << csv_file << "'\n";
+        all_valid = false;
+    }
+    if (!json_file.empty() && !save_json(json_file, results)) {
+        std::cerr << "Failed to write '" << json_file << "'\n";
+        all_valid = false;
+    }
+
+    return all_valid ? SUCCESS_EXIT_CODE : ERROR_EXIT_CODE;
+}
+
+
+bool load_instance(const std::string &file_name, CourierInstance &instance) {
+    std::ifstream file(file_name);
+    if (!file) return false;
+
+    // The name is the file name without its directory and extension
+    instance.name = file_name.substr(file_name.find_last_of('/') + 1);
+    instance.name = instance.name.substr(0, instance.name.find_last_of('.'));
+
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        std::istringstream values(line);
+        std::string key;
+        values >> key;
+
+        if (key == "map") values >> instance.map_path;
+        else if (key == "right_turn_penalty") values >> instance.right_turn_penalty;
+        else if (key == "left_turn_penalty") values >> instance.left_turn_penalty;
+        else if (key == "truck_capacity") values >> instance.truck_capacity;
+        else if (key == "depots") {
+            unsigned depot;
+            while (values >> depot) instance.depots.push_back(depot);
+        } else if (key == "delivery") {
+            unsigned pick_up, drop_off;
+            float weight;
+            if (!(values >> pick_up >> drop_off >> weight)) return false;
+            instance.deliveries.push_back(DeliveryInfo(pick_up, drop_off, weight));
+        } else {
+            return false;
+        }
+    }
+
+    return !instance.map_path.empty() && !instance.depots.empty() && !instance.deliveries.empty();
+}
+
+
+bool parse_list(const std::string &list, std::vector<double> &values) {
+    std::vector<double> parsed;
+    std::istringstream items(list);
+    std::string item;
+
+    while (std::getline(items, item, ',')) {
+        char *end = nullptr;
+        double value = std::strtod(item.c_str(), &end);
+        if (item.empty() || *end != '\0') return false;
+        parsed.push_back(value);
+    }
+
+    if (parsed.empty()) return false;
+    values = parsed;
+    return true;
+}
+
+
+bool validate_legs(const CourierInstance &instance,
+                   const std::vector<CourierSubpath> &legs,
+                   double &travel_time,
+                   std::string &error) {
+    travel_time = 0;
+    if (legs.empty()) {
+        error = "no route";
+        return false;
+    }
+
+    std::vector<int> state(instance.deliveries.size(), 0);
+    if (!validate_truck_legs(instance, legs, instance.truck_capacity, state, travel_time, error)) return false;
+
+    return all_dropped_off(state, error);
+}
+
+
+bool validate_truck_legs(const CourierInstance &instance,
+                         const std::vector<CourierSubpath> &legs,
+                         float capacity,
+                         std::vector<int> &state,
+                         double &travel_time,
+                         std::string &error) {
+    const std::vector<DeliveryInfo> &deliveries = instance.deliveries;
+    if (legs.empty()) return true;
+
+    auto is_depot = [&](unsigned intersection) {
+        for (unsigned depot : instance.depots) {
+            if (depot == intersection) return true;
+        }
+        return false;
+    };
+    if (!is_depot(legs.front().start_intersection) || !is_depot(legs.back().end_intersection)) {
+        error = "route doesn't start and end at a depot";
+        return false;
+    }
+
+    double load = 0;
+    for (unsigned k = 0; k < legs.size(); ++k) {
+        const CourierSubpath &leg = legs[k];
+        if (k > 0 && leg.start_intersection != legs[k - 1].end_intersection) {
+            error = "legs aren't connected";
+            return false;
+        }
+
+        // Every segment must continue from the end of the last one, without going the wrong way on a one way street
+        unsigned current = leg.start_intersection;
+        for (unsigned segment : leg.subpath) {
+            InfoStreetSegment info = getInfoStreetSegment(segment);
+            if ((unsigned)info.from == current) current = info.to;
+            else if ((unsigned)info.to == current && !info.oneWay) current = info.from;
+            else {
+                error = "segments aren't connected";
+                return false;
+            }
+        }
+        if (current != leg.end_intersection) {
+            error = "leg doesn't end at its end intersection";
+            return false;
+        }
+        travel_time += compute_path_travel_time(leg.subpath, instance.right_turn_penalty, instance.left_turn_penalty);
+
+        // Items in the truck can be dropped off wherever a leg starts, then the listed items are picked up
+        if (k > 0) {
+            for (unsigned i = 0; i < deliveries.size(); ++i) {
+                if (state[i] == 1 && deliveries[i].dropOff == leg.start_intersection) {
+                    state[i] = 2;
+                    load -= deliveries[i].itemWeight;
+                }
+            }
+        }
+        for (unsigned pick_up : leg.pickUp_indices) {
+            if (pick_up >= deliveries.size() || state[pick_up] != 0 || deliveries[pick_up].pickUp != leg.start_intersection) {
+                error = "bad pickup";
+                return false;
+            }
+            state[pick_up] = 1;
+            load += deliveries[pick_up].itemWeight;
+        }
+        if (load > capacity + 1e-3) {
+            error = "over capacity";
+            return false;
+        }
+    }
+
+    // Whatever is still in the truck must be dropped off at the depot it ends at
+    for (unsigned i = 0; i < deliveries.size(); ++i) {
+        if (state[i] == 1 && deliveries[i].dropOff == legs.back().end_intersection) state[i] = 2;
+        if (state[i] == 1) {
+            error = "delivery " + std::to_string(i) + " not dropped off";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool all_dropped_off(const std::vector<int> &state, std::string &error) {
+    for (unsigned i = 0; i < state.size(); ++i) {
+        if (state[i] != 2) {
+            error = "delivery " + std::to_string(i) + " not dropped off";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+BenchmarkResult run_instance(const CourierInstance &instance,
+                             const CourierOptions &options,
+                             int threads,
+                             long long seed) {
+    BenchmarkResult result;
+    result.instance = instance.name;
+    result.budget = options.time_limit;
+    result.threads = threads;
+    result.seed = seed;
+
+    // Every run searches the matrix again, and starts every thread from the same seed
+    courier_row_cache.clear();
+    omp_set_num_threads(threads);
+    set_courier_seed(seed);
+    srand(seed);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<CourierSubpath> legs = traveling_courier(instance.deliveries, instance.depots,
+            instance.right_turn_penalty, instance.left_turn_penalty, instance.truck_capacity, options);
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    result.wall_time = std::chrono::duration_cast<std::chrono::duration<double>> (endTime - startTime).count();
+    result.is_valid = validate_legs(instance, legs, result.travel_time, result.error);
+
+    result.matrix_time = MAP.courier.stats.matrix_time;
+    for (const AnnealStats &thread_stats : MAP.courier.anneal_stats) result.swaps += thread_stats.swaps;
+    if (MAP.courier.stats.optimization_time > 0) result.swaps_per_second = result.swaps / MAP.courier.stats.optimization_time;
+    result.stats_json = courier_stats_json();
+
+    set_courier_seed(-1);
+    return result;
+}
+
+
+BenchmarkResult run_replan(const CourierInstance &instance,
+                           int threads,
+                           long long seed) {
+    BenchmarkResult result;
+    result.instance = instance.name + "_replan";
+    result.budget = REPLAN_TIME_LIMIT;
+    result.threads = threads;
+    result.seed = seed;
+
+    courier_row_cache.clear();
+    omp_set_num_threads(threads);
+    set_courier_seed(seed);
+    srand(seed);
+
+    unsigned num_first = instance.deliveries.size() - instance.deliveries.size() / 4;
+    std::vector<DeliveryInfo> first(instance.deliveries.begin(), instance.deliveries.begin() + num_first);
+    std::vector<DeliveryInfo> added(instance.deliveries.begin() + num_first, instance.deliveries.end());
+    std::vector<unsigned> cancelled;
+    for (unsigned i = 0; i < num_first; i += 8) cancelled.push_back(i);
+
+    CourierPlan plan;
+    traveling_courier(first, instance.depots, instance.right_turn_penalty, instance.left_turn_penalty,
+            instance.truck_capacity, plan);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<CourierSubpath> legs = replan_courier(plan, added, cancelled, 0);
+    auto endTime = std::chrono::high_resolution_clock::now();
+
+    // The replanned route delivers what is left in the plan
+    CourierInstance replanned = instance;
+    replanned.deliveries = plan.deliveries;
+
+    result.wall_time = std::chrono::duration_cast<std::chrono::duration<double>> (endTime - startTime).count();
+    result.is_valid = validate_legs(replanned, legs, result.travel_time, result.error);
+
+    result.matrix_time = MAP.courier.stats.matrix_time;
+    for (const AnnealStats &thread_stats : MAP.courier.anneal_stats) result.swaps += thread_stats.swaps;
+    if (MAP.courier.stats.optimization_time > 0) result.swaps_per_second = result.swaps / MAP.courier.stats.optimization_time;
+    result.stats_json = courier_stats_json();
+
+    set_courier_seed(-1);
+    return result;
+}
+
+
+BenchmarkResult run_fleet(const CourierInstance &instance,
+                          unsigned num_trucks,
+                          double budget,
+                          int threads,
+                          long long seed) {
+    BenchmarkResult result;
+    result.instance = instance.name + "_fleet";
+    result.budget = budget;
+    result.threads = threads;
+    result.seed = seed;
+
+    courier_row_cache.clear();
+    omp_set_num_threads(threads);
+    set_courier_seed(seed);
+    srand(seed);
+
+    std::vector<FleetVehicle> vehicles(num_trucks);
+    for (unsigned v = 0; v < num_trucks; ++v) {
+        vehicles[v].capacity = instance.truck_capacity;
+        if (v % 2 == 1) vehicles[v].depot = (v / 2) % instance.depots.size();
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<std::vector<CourierSubpath>> paths = fleet_courier(instance.deliveries, instance.depots, vehicles,
+            instance.right_turn_penalty, instance.left_turn_penalty, budget);
+    auto endTime = std::chrono::high_resolution_clock::now();
+    result.wall_time = std::chrono::duration_cast<std::chrono::duration<double>> (endTime - startTime).count();
+
+    // Every truck comes back to the depot it left from, which is its own depot if it has one
+    std::vector<int> state(instance.deliveries.size(), 0);
+    result.is_valid = paths.size() == num_trucks;
+    if (!result.is_valid) result.error = "no routes";
+    for (unsigned v = 0; v < paths.size() && result.is_valid; ++v) {
+        if (paths[v].empty()) continue;
+
+        unsigned depot = paths[v].front().start_intersection;
+        if (depot != paths[v].back().end_intersection
+                || (vehicles[v].depot != ANY_DEPOT && depot != instance.depots[vehicles[v].depot])) {
+            result.error = "truck " + std::to_string(v) + " doesn't return to its depot";
+            result.is_valid = false;
+        } else {
+            result.is_valid = validate_truck_legs(instance, paths[v], vehicles[v].capacity, state,
+                    result.travel_time, result.error);
+        }
+    }
+    result.is_valid = result.is_valid && all_dropped_off(state, result.error);
+
+    result.matrix_time = MAP.courier.stats.matrix_time;
+    for (const AnnealStats &thread_stats : MAP.courier.anneal_stats) result.swaps += thread_stats.swaps;
+    if (MAP.courier.stats.optimization_time > 0) result.swaps_per_second = result.swaps / MAP.courier.stats.optimization_time;
+    result.stats_json = courier_stats_json();
+
+    set_courier_seed(-1);
+    return result;
+}
+
+
+void print_table(const std::vector<BenchmarkResult> &results) {
+    std::cout << "\n" << std::left << std::setw(22) << "instance"
+              << std::right << std::setw(8) << "budget" << std::setw(8) << "threads" << std::setw(6) << "seed"
+              << std::setw(7) << "valid" << std::setw(14) << "travel time" << std::setw(10) << "wall"
+              << std::setw(10) << "matrix" << std::setw(14) << "swaps/s" << "\n";
+
+    std::cout << std::fixed;
+    for (const BenchmarkResult &result : results) {
+        std::cout << std::left << std::setw(22) << result.instance
+                  << std::right << std::setprecision(1) << std::setw(8) << result.budget
+                  << std::setw(8) << result.threads << std::setw(6) << result.seed
+                  << std::setw(7) << (result.is_valid ? "yes" : "no")
+                  << std::setprecision(2) << std::setw(14) << result.travel_time
+                  << std::setw(10) << result.wall_time << std::setw(10) << result.matrix_time
+                  << std::setprecision(0) << std::setw(14) << result.swaps_per_second << "\n";
+    }
+    std::cout.unsetf(std::ios_base::floatfield);
+}
+
+
+bool save_csv(const std::string &file_name, const std::vector<BenchmarkResult> &results) {
+    std::ofstream file(file_name);
+    if (!file) return false;
+
+    file << std::setprecision(10);
+    file << "instance,budget,threads,seed,valid,error,travel_time,wall_time,matrix_time,swaps,swaps_per_second\n";
+    for (const BenchmarkResult &result : results) {
+        file << result.instance << "," << result.budget << "," << result.threads << "," << result.seed << ","
+             << (result.is_valid ? 1 : 0) << "," << result.error << "," << result.travel_time << ","
+             << result.wall_time << "," << result.matrix_time << "," << result.swaps << ","
+             << result.swaps_per_second << "\n";
+    }
+
+    return (bool)file;
+}
+
+
+bool save_json(const std::string &file_name, const std::vector<BenchmarkResult> &results) {
+    std::ofstream file(file_name);
+    if (!file) return false;
+
+    file << std::setprecision(10) << "[\n";
+    for (unsigned i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &result = results[i];
+
+        file << "  {\"instance\": \"" << result.instance << "\", \"budget\": " << result.budget
+             << ", \"threads\": " << result.threads << ", \"seed\": " << result.seed
+             << ", \"valid\": " << (result.is_valid ? "true" : "false") << ", \"error\": \"" << result.error << "\""
+             << ", \"travel_time\": " << result.travel_time << ", \"wall_time\": " << result.wall_time
+             << ", \"swaps\": " << result.swaps << ", \"swaps_per_second\": " << result.swaps_per_second
+             << ", \"stats\": " << result.stats_json << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "]\n";
+
+    return (bool)file;
+}
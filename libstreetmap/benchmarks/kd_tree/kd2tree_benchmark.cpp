@@ -0,0 +1,759 @@
+/*
+ * Benchmarks the nearest neighbour queries of KDTree against a brute force
+ * search over the same points. The points are made up of clusters, like the
+ * street segments of a city, and are inserted at several zoom levels the same
+ * way load_street_segments does. The same points are put in a tree of doubles
+ * and a tree of floats, and every query of each is checked against a brute force
+ * search over the points rounded the same way. The number of nodes each query
+ * visits is printed next to the number of points it could have checked, and the
+ * memory of each tree is printed with its build time.
+ *
+ * A DynamicKD2Tree then has points inserted, moved and removed one at a time,
+ * and its queries are checked against the points left after each change. The
+ * time of each change is printed next to the time of building the points again.
+ *
+ * Last, PackedRTrees of several sizes are built from boxes, and every range
+ * query is checked against a brute force search over the boxes, both with the
+ * SIMD overlap test and the scalar one.
+ *
+ * Given a map, find_closest_intersection and find_closest_point_of_interest are
+ * checked against a linear scan over every point, for positions at intersections,
+ * inside the map, far off the map and near the poles. snap_positions is then
+ * checked against find_closest_intersection for every position, and against a
+ * linear scan over every street segment for one position in ten.
+ *
+ * Usage: benchmark_kd2tree [--points 1000000] [--queries 2000] [--boxes 200000] [--snaps 20000] [--seed 1] [--map path]
+ */
+
+#include "KDTree.h"
+#include "DynamicKDTree.h"
+#include "PackedRTree.h"
+#include "m1.h"
+#include "m1_snap.h"
+#include "map_db.h"
+#include "StreetsDatabaseAPI.h"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+//Program exit codes
+constexpr int SUCCESS_EXIT_CODE = 0;        //Every query matched the brute force search
+constexpr int ERROR_EXIT_CODE = 1;          //A query returned different points, or the map couldn't be loaded
+constexpr int BAD_ARGUMENTS_EXIT_CODE = 2;  //Invalid command-line usage
+
+// Zoom levels the points are inserted at, in order
+#define KD_BENCHMARK_NUM_ZOOM_LEVELS 4
+#define KD_BENCHMARK_FIRST_ZOOM_LEVEL -1
+
+typedef std::vector<std::pair<std::pair<double, double>, unsigned int>> PointList;
+
+// Totals of one kind of query
+struct QueryStats {
+    std::string name;
+    unsigned long queries = 0;
+    unsigned long mismatches = 0;
+    unsigned long visited = 0; // Nodes visited by every query together
+    unsigned long candidates = 0; // Points at or below the zoom level of every query together
+    double tree_time = 0;
+    double brute_time = 0;
+};
+
+// Makes clustered points, split into one list for each zoom level
+void make_points(std::size_t num_points, std::mt19937 &rng, std::vector<PointList> &zoom_points);
+
+// Builds a tree with the given coordinate type from the points, and checks queries at each
+// search point against a brute force search. Returns false if any query didn't match
+template <typename Coord>
+bool benchmark_tree(const std::string &name,
+                    const std::vector<PointList> &zoom_points,
+                    const std::vector<std::pair<std::pair<double, double>, int>> &queries);
+
+// Every point at or below the zoom level, sorted by distance to search_point and then id
+template <typename Tree>
+void brute_force(const std::vector<std::vector<typename Tree::Item>> &zoom_items,
+                 const typename Tree::Point &search_point,
+                 int zoom_level,
+                 std::vector<typename Tree::Neighbour> &results);
+
+// Changes a dynamic tree one point at a time, checking its queries every so often
+// against the points it should have. Returns false if any query didn't match
+bool benchmark_dynamic(std::size_t num_points, std::size_t num_queries, std::mt19937 &rng);
+
+// Checks range queries of PackedRTrees built from up to num_boxes boxes against a brute force
+// search, using both overlap tests. Returns false if any query didn't match
+bool benchmark_rtree(std::size_t num_boxes, std::size_t num_queries, std::mt19937 &rng);
+
+// Makes boxes like the bounding boxes of street segments and features, some of them points
+void make_boxes(std::size_t num_boxes, std::mt19937 &rng, std::vector<std::pair<RTreeBox, unsigned int>> &items);
+
+// Checks find_closest_intersection and find_closest_point_of_interest on the loaded map against
+// a linear scan, for num_queries positions of each kind. Returns false if any query didn't match
+bool benchmark_closest(std::size_t num_queries, std::mt19937 &rng);
+
+// The closest point by find_distance_between_two_points, the lowest id if several are as close
+unsigned linear_closest(LatLon position, int num_points, LatLon (*point_position)(int));
+
+// Checks snap_positions on the loaded map for num_positions positions. Returns false if any
+// intersection or street segment didn't match
+bool benchmark_snap(std::size_t num_positions, std::mt19937 &rng);
+
+// True if both have the same distances and ids in the same order
+template <typename Neighbour>
+bool same_neighbours(const std::vector<Neighbour> &a, const std::vector<Neighbour> &b);
+
+void print_stats(const std::vector<QueryStats> &stats);
+
+
+int main(int argc, char** argv) {
+    std::size_t num_points = 1000000;
+    std::size_t num_queries = 2000;
+    std::size_t num_boxes = 200000;
+    std::size_t num_snaps = 20000;
+    unsigned seed = 1;
+    std::string map_path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--points" && has_value) num_points = std::stoul(argv[++i]);
+        else if (arg == "--queries" && has_value) num_queries = std::stoul(argv[++i]);
+        else if (arg == "--boxes" && has_value) num_boxes = std::stoul(argv[++i]);
+        else if (arg == "--snaps" && has_value) num_snaps = std::stoul(argv[++i]);
+        else if (arg == "--seed" && has_value) seed = std::stoul(argv[++i]);
+        else if (arg == "--map" && has_value) map_path = argv[++i];
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--points 1000000] [--queries 2000] [--boxes 200000] [--snaps 20000] [--seed 1] [--map path]\n";
+            return BAD_ARGUMENTS_EXIT_CODE;
+        }
+    }
+
+    std::mt19937 rng(seed);
+    std::vector<PointList> zoom_points;
+    make_points(num_points, rng, zoom_points);
+
+    // Both trees answer the same queries
+    std::uniform_real_distribution<double> coordinate(0, 1);
+    std::uniform_int_distribution<int> zoom(KD_BENCHMARK_FIRST_ZOOM_LEVEL, KD_BENCHMARK_FIRST_ZOOM_LEVEL + KD_BENCHMARK_NUM_ZOOM_LEVELS);
+    std::vector<std::pair<std::pair<double, double>, int>> queries;
+    for (std::size_t q = 0; q < num_queries; ++q) {
+        std::pair<double, double> search_point(coordinate(rng), coordinate(rng));
+        queries.push_back(std::make_pair(search_point, zoom(rng)));
+    }
+
+    bool matched = benchmark_tree<double>("double", zoom_points, queries);
+    std::cout << "\n";
+    matched = benchmark_tree<float>("float", zoom_points, queries) && matched;
+    std::cout << "\n";
+    matched = benchmark_dynamic(num_points, num_queries, rng) && matched;
+    std::cout << "\n";
+    matched = benchmark_rtree(num_boxes, num_queries, rng) && matched;
+
+    if (!map_path.empty()) {
+        std::cout << "\n";
+        if (!load_map(map_path)) {
+            std::cerr << "Failed to load map '" << map_path << "'\n";
+            return ERROR_EXIT_CODE;
+        }
+        matched = benchmark_closest(num_queries, rng) && matched;
+        std::cout << "\n";
+        matched = benchmark_snap(num_snaps, rng) && matched;
+        close_map();
+    }
+
+    return matched ? SUCCESS_EXIT_CODE : ERROR_EXIT_CODE;
+}
+
+
+void make_points(std::size_t num_points, std::mt19937 &rng, std::vector<PointList> &zoom_points) {
+    zoom_points.assign(KD_BENCHMARK_NUM_ZOOM_LEVELS, PointList());
+
+    std::uniform_real_distribution<double> coordinate(0, 1);
+    std::uniform_real_distribution<double> spread(0.001, 0.05);
+    std::uniform_int_distribution<int> zoom(0, KD_BENCHMARK_NUM_ZOOM_LEVELS - 1);
+
+    // Most points are in clusters, the rest are spread over the whole area
+    std::size_t num_clusters = std::max<std::size_t>(1, num_points / 5000);
+    std::vector<std::pair<std::pair<double, double>, double>> clusters;
+    for (std::size_t i = 0; i < num_clusters; ++i) {
+        clusters.push_back(std::make_pair(std::make_pair(coordinate(rng), coordinate(rng)), spread(rng)));
+    }
+
+    std::uniform_int_distribution<std::size_t> pick_cluster(0, num_clusters - 1);
+    for (std::size_t i = 0; i < num_points; ++i) {
+        std::pair<double, double> point(coordinate(rng), coordinate(rng));
+        if (i % 5 != 0) {
+            const std::pair<std::pair<double, double>, double> &cluster = clusters[pick_cluster(rng)];
+            std::normal_distribution<double> offset(0, cluster.second);
+            point = std::make_pair(cluster.first.first + offset(rng), cluster.first.second + offset(rng));
+        }
+
+        // Pairs of points share an id like the two ends of a street segment, and a few points are repeated
+        unsigned int data_id = i / 2;
+        zoom_points[zoom(rng)].push_back(std::make_pair(point, data_id));
+        if (i % 97 == 0) zoom_points[KD_BENCHMARK_NUM_ZOOM_LEVELS - 1].push_back(std::make_pair(point, data_id));
+    }
+}
+
+
+template <typename Coord>
+bool benchmark_tree(const std::string &name,
+                    const std::vector<PointList> &zoom_points,
+                    const std::vector<std::pair<std::pair<double, double>, int>> &queries) {
+    typedef KDTree<unsigned int, 2, Coord> Tree;
+
+    // The brute force search uses the points after rounding them to Coord, so it finds the same distances as the tree
+    std::vector<std::vector<typename Tree::Item>> zoom_items(KD_BENCHMARK_NUM_ZOOM_LEVELS);
+    for (int z = 0; z < KD_BENCHMARK_NUM_ZOOM_LEVELS; ++z) {
+        for (const std::pair<std::pair<double, double>, unsigned int> &point : zoom_points[z]) {
+            typename Tree::Point tree_point = {{Coord(point.first.first), Coord(point.first.second)}};
+            zoom_items[z].push_back(std::make_pair(tree_point, point.second));
+        }
+    }
+
+    // Built from copies, since building reorders the items
+    auto build_start = std::chrono::high_resolution_clock::now();
+    Tree tree;
+    for (int z = 0; z < KD_BENCHMARK_NUM_ZOOM_LEVELS; ++z) {
+        std::vector<typename Tree::Item> items = zoom_items[z];
+        if (z == 0) tree.make_tree(items, KD_BENCHMARK_FIRST_ZOOM_LEVEL);
+        else tree.insert_bulk(items, KD_BENCHMARK_FIRST_ZOOM_LEVEL + z);
+    }
+    double build_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - build_start).count();
+    std::cout << "Built " << name << " tree of " << tree.size() << " points in " << build_time << "s, using "
+              << std::fixed << std::setprecision(1) << tree.memory() / (1024.0 * 1024.0) << " MiB" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+
+    std::vector<std::size_t> ks = {1, 8, 32};
+    std::vector<QueryStats> stats(ks.size() + 1);
+    for (std::size_t i = 0; i < ks.size(); ++i) stats[i].name = "k_nearest k=" + std::to_string(ks[i]);
+    stats[ks.size()].name = "radius_query";
+
+    std::vector<typename Tree::Neighbour> tree_results, brute_results;
+
+    for (const std::pair<std::pair<double, double>, int> &query : queries) {
+        typename Tree::Point search_point = {{Coord(query.first.first), Coord(query.first.second)}};
+        int zoom_level = query.second;
+
+        unsigned long candidates = 0;
+        for (int z = 0; z < KD_BENCHMARK_NUM_ZOOM_LEVELS && KD_BENCHMARK_FIRST_ZOOM_LEVEL + z <= zoom_level; ++z) {
+            candidates += zoom_items[z].size();
+        }
+
+        auto brute_start = std::chrono::high_resolution_clock::now();
+        brute_force<Tree>(zoom_items, search_point, zoom_level, brute_results);
+        double brute_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - brute_start).count();
+
+        for (std::size_t i = 0; i < ks.size(); ++i) {
+            std::size_t visited = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            tree.k_nearest(search_point, ks[i], zoom_level, tree_results, &visited);
+            stats[i].tree_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            std::vector<typename Tree::Neighbour> expected(brute_results.begin(), brute_results.begin() + std::min(ks[i], brute_results.size()));
+            if (!same_neighbours(tree_results, expected)) stats[i].mismatches++;
+            stats[i].queries++;
+            stats[i].visited += visited;
+            stats[i].candidates += candidates;
+            stats[i].brute_time += brute_time;
+        }
+
+        // A radius around the 32nd closest point, so the results aren't empty
+        QueryStats &radius_stats = stats[ks.size()];
+        double radius = brute_results.empty() ? 0 : std::sqrt(brute_results[std::min<std::size_t>(31, brute_results.size() - 1)].distance);
+        std::size_t visited = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        tree.radius_query(search_point, radius, zoom_level, tree_results, &visited);
+        radius_stats.tree_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        std::vector<typename Tree::Neighbour> expected;
+        for (const typename Tree::Neighbour &neighbour : brute_results) {
+            if (neighbour.distance <= radius * radius) expected.push_back(neighbour);
+        }
+        if (!same_neighbours(tree_results, expected)) radius_stats.mismatches++;
+        radius_stats.queries++;
+        radius_stats.visited += visited;
+        radius_stats.candidates += candidates;
+        radius_stats.brute_time += brute_time;
+    }
+
+    print_stats(stats);
+
+    for (const QueryStats &query_stats : stats) {
+        if (query_stats.mismatches > 0) return false;
+    }
+    return true;
+}
+
+
+template <typename Tree>
+void brute_force(const std::vector<std::vector<typename Tree::Item>> &zoom_items,
+                 const typename Tree::Point &search_point,
+                 int zoom_level,
+                 std::vector<typename Tree::Neighbour> &results) {
+    results.clear();
+    for (int z = 0; z < KD_BENCHMARK_NUM_ZOOM_LEVELS && KD_BENCHMARK_FIRST_ZOOM_LEVEL + z <= zoom_level; ++z) {
+        for (const typename Tree::Item &item : zoom_items[z]) {
+            // Summed the same way as the tree, so a fused multiply-add rounds both the same
+            double distance = 0;
+            for (std::size_t axis = 0; axis < 2; ++axis) {
+                double gap = double(item.first[axis]) - double(search_point[axis]);
+                distance += gap * gap;
+            }
+            results.push_back({distance, item.first, item.second});
+        }
+    }
+    std::sort(results.begin(), results.end(), [](const typename Tree::Neighbour &a, const typename Tree::Neighbour &b) {
+        return (a.distance < b.distance) || (a.distance == b.distance && a.data < b.data);
+    });
+}
+
+
+bool benchmark_dynamic(std::size_t num_points, std::size_t num_queries, std::mt19937 &rng) {
+    typedef DynamicKD2Tree::Point Point;
+    typedef DynamicKD2Tree::Neighbour Neighbour;
+
+    std::uniform_real_distribution<float> coordinate(0, 1);
+
+    // Every point given an id so far, and whether it is still in the tree
+    std::vector<std::pair<Point, bool>> points;
+    std::vector<unsigned int> live_ids;
+
+    // Half the points are built at once, the rest are inserted one at a time
+    std::vector<DynamicKD2Tree::Item> items;
+    for (unsigned int id = 0; id < num_points / 2; ++id) {
+        Point point = {{coordinate(rng), coordinate(rng)}};
+        items.push_back(std::make_pair(point, id));
+        points.push_back(std::make_pair(point, true));
+        live_ids.push_back(id);
+    }
+    DynamicKD2Tree tree;
+    tree.make_tree(items);
+
+    // 60% of the changes insert a new point, 20% move a point and 20% remove one
+    std::uniform_int_distribution<int> change(0, 9);
+    std::size_t num_changes = num_points / 2;
+    std::size_t check_every = std::max<std::size_t>(1, num_changes / std::max<std::size_t>(1, num_queries));
+    double insert_time = 0, move_time = 0, remove_time = 0;
+    unsigned long inserts = 0, moves = 0, removes = 0, checks = 0, mismatches = 0;
+
+    std::vector<Neighbour> tree_results, expected;
+    std::vector<unsigned int> range_ids, expected_ids;
+
+    for (std::size_t c = 0; c < num_changes; ++c) {
+        int kind = change(rng);
+        Point point = {{coordinate(rng), coordinate(rng)}};
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (kind < 6 || live_ids.empty()) {
+            unsigned int id = points.size();
+            tree.insert(point, id);
+            insert_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            inserts++;
+
+            points.push_back(std::make_pair(point, true));
+            live_ids.push_back(id);
+        } else {
+            std::size_t index = std::uniform_int_distribution<std::size_t>(0, live_ids.size() - 1)(rng);
+            unsigned int id = live_ids[index];
+
+            if (kind < 8) {
+                tree.insert(point, id);
+                move_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                moves++;
+                points[id].first = point;
+            } else {
+                tree.remove(id);
+                remove_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                removes++;
+                points[id].second = false;
+                live_ids[index] = live_ids.back();
+                live_ids.pop_back();
+            }
+        }
+
+        if (c % check_every != 0) continue;
+        checks++;
+
+        // Every live point, sorted the same way as the tree's queries
+        Point search_point = {{coordinate(rng), coordinate(rng)}};
+        expected.clear();
+        for (unsigned int id : live_ids) {
+            double distance = 0;
+            for (std::size_t axis = 0; axis < 2; ++axis) {
+                double gap = double(points[id].first[axis]) - double(search_point[axis]);
+                distance += gap * gap;
+            }
+            expected.push_back({distance, points[id].first, id});
+        }
+        std::sort(expected.begin(), expected.end(), [](const Neighbour &a, const Neighbour &b) {
+            return (a.distance < b.distance) || (a.distance == b.distance && a.data < b.data);
+        });
+
+        tree.k_nearest(search_point, 8, tree_results);
+        std::vector<Neighbour> expected_nearest(expected.begin(), expected.begin() + std::min<std::size_t>(8, expected.size()));
+        bool matches = tree.size() == live_ids.size() && same_neighbours(tree_results, expected_nearest);
+
+        // Halfway between the 32nd and 33rd closest points, since -Ofast doesn't square the root of a distance exactly
+        double radius = 0;
+        if (!expected.empty()) {
+            std::size_t last = std::min<std::size_t>(31, expected.size() - 1);
+            std::size_t next = std::min<std::size_t>(32, expected.size() - 1);
+            radius = std::sqrt((expected[last].distance + expected[next].distance) / 2);
+        }
+        tree.radius_query(search_point, radius, tree_results);
+        std::vector<Neighbour> expected_radius;
+        for (const Neighbour &neighbour : expected) {
+            if (neighbour.distance <= radius * radius) expected_radius.push_back(neighbour);
+        }
+        matches = matches && same_neighbours(tree_results, expected_radius);
+
+        Point low = {{search_point[0] - 0.02f, search_point[1] - 0.02f}};
+        Point high = {{search_point[0] + 0.02f, search_point[1] + 0.02f}};
+        range_ids.clear();
+        tree.visit_range(low, high, [&](unsigned int id, const Point &) { range_ids.push_back(id); });
+        expected_ids.clear();
+        for (unsigned int id : live_ids) {
+            const Point &live = points[id].first;
+            if (live[0] >= low[0] && live[0] <= high[0] && live[1] >= low[1] && live[1] <= high[1]) expected_ids.push_back(id);
+        }
+        std::sort(range_ids.begin(), range_ids.end());
+        std::sort(expected_ids.begin(), expected_ids.end());
+        matches = matches && range_ids == expected_ids;
+
+        if (!matches) mismatches++;
+    }
+
+    // What every change would cost if the tree was built again instead
+    items.clear();
+    for (unsigned int id : live_ids) {
+        items.push_back(std::make_pair(points[id].first, id));
+    }
+    auto rebuild_start = std::chrono::high_resolution_clock::now();
+    DynamicKD2Tree rebuilt;
+    rebuilt.make_tree(items);
+    double rebuild_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - rebuild_start).count();
+
+    std::cout << "Dynamic tree of " << tree.size() << " points after " << num_changes << " changes, using "
+              << std::fixed << std::setprecision(1) << tree.memory() / (1024.0 * 1024.0) << " MiB\n"
+              << std::setprecision(2)
+              << "  insert us: " << 1e6 * insert_time / std::max<unsigned long>(1, inserts)
+              << "  move us: " << 1e6 * move_time / std::max<unsigned long>(1, moves)
+              << "  remove us: " << 1e6 * remove_time / std::max<unsigned long>(1, removes)
+              << "  full build us: " << 1e6 * rebuild_time << "\n";
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << "  checks: " << checks << "  mismatches: " << mismatches << "\n";
+
+    return mismatches == 0;
+}
+
+
+bool benchmark_rtree(std::size_t num_boxes, std::size_t num_queries, std::mt19937 &rng) {
+    std::vector<std::pair<RTreeBox, unsigned int>> all_items;
+    make_boxes(num_boxes, rng, all_items);
+
+    // Trees with no nodes, a single item as the root, one full node, a node and a partly padded one, and every box
+    std::vector<std::size_t> sizes = {0, 1, RTREE_NODE_SIZE, RTREE_NODE_SIZE + 1, num_boxes};
+    std::uniform_real_distribution<double> coordinate(0, 1);
+    std::uniform_real_distribution<double> extent(0, 0.05);
+    bool matched = true;
+
+    for (std::size_t size : sizes) {
+        if (size > all_items.size()) continue;
+        std::vector<std::pair<RTreeBox, unsigned int>> items(all_items.begin(), all_items.begin() + size);
+
+        auto build_start = std::chrono::high_resolution_clock::now();
+        PackedRTree tree;
+        tree.make_tree(items);
+        double build_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - build_start).count();
+
+        double simd_time = 0, scalar_time = 0, brute_time = 0;
+        unsigned long found = 0, mismatches = 0;
+        std::vector<unsigned int> simd_ids, scalar_ids, expected_ids;
+
+        for (std::size_t q = 0; q < num_queries; ++q) {
+            double x = coordinate(rng), y = coordinate(rng);
+            RTreeBox range = {x, y, x + extent(rng), y + extent(rng)};
+
+            // Every fourth range only touches a box at its corner, and every eighth is a point on the corner
+            if (!items.empty() && q % 4 == 0) {
+                const RTreeBox &box = items[std::uniform_int_distribution<std::size_t>(0, items.size() - 1)(rng)].first;
+                range = {box.max_x, box.min_y - 0.01, box.max_x + 0.01, box.min_y};
+                if (q % 8 == 0) range = {box.min_x, box.min_y, box.min_x, box.min_y};
+            }
+
+            simd_ids.clear();
+            auto start = std::chrono::high_resolution_clock::now();
+            tree.visit_range(range, [&](unsigned int id) { simd_ids.push_back(id); });
+            simd_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            scalar_ids.clear();
+            start = std::chrono::high_resolution_clock::now();
+            tree.visit_range_scalar(range, [&](unsigned int id) { scalar_ids.push_back(id); });
+            scalar_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            expected_ids.clear();
+            start = std::chrono::high_resolution_clock::now();
+            for (const std::pair<RTreeBox, unsigned int> &item : items) {
+                if (boxesOverlap(item.first, range)) expected_ids.push_back(item.second);
+            }
+            brute_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            // Every overlapping box is visited once, in any order
+            std::sort(simd_ids.begin(), simd_ids.end());
+            std::sort(scalar_ids.begin(), scalar_ids.end());
+            std::sort(expected_ids.begin(), expected_ids.end());
+            if (simd_ids != expected_ids || scalar_ids != expected_ids) mismatches++;
+            found += expected_ids.size();
+        }
+
+        double queries = std::max<std::size_t>(1, num_queries);
+        std::cout << "R-tree of " << tree.size() << " boxes built in " << build_time << "s\n"
+                  << std::fixed << std::setprecision(2)
+                  << "  avg found: " << found / queries
+                  << "  simd us: " << 1e6 * simd_time / queries
+                  << "  scalar us: " << 1e6 * scalar_time / queries
+                  << "  brute us: " << 1e6 * brute_time / queries << "\n";
+        std::cout.unsetf(std::ios::fixed);
+        std::cout << "  queries: " << num_queries << "  mismatches: " << mismatches << "\n";
+
+        matched = matched && mismatches == 0;
+    }
+    return matched;
+}
+
+
+void make_boxes(std::size_t num_boxes, std::mt19937 &rng, std::vector<std::pair<RTreeBox, unsigned int>> &items) {
+    items.clear();
+
+    std::uniform_real_distribution<double> coordinate(0, 1);
+    std::uniform_real_distribution<double> spread(0.001, 0.05);
+    std::uniform_real_distribution<double> segment_size(0, 0.002);
+    std::uniform_real_distribution<double> feature_size(0, 0.1);
+
+    std::size_t num_clusters = std::max<std::size_t>(1, num_boxes / 5000);
+    std::vector<std::pair<std::pair<double, double>, double>> clusters;
+    for (std::size_t i = 0; i < num_clusters; ++i) {
+        clusters.push_back(std::make_pair(std::make_pair(coordinate(rng), coordinate(rng)), spread(rng)));
+    }
+
+    // Most boxes are small like street segments, every tenth is large like a feature,
+    // and every tenth has no area like a point of interest
+    std::uniform_int_distribution<std::size_t> pick_cluster(0, num_clusters - 1);
+    for (std::size_t i = 0; i < num_boxes; ++i) {
+        const std::pair<std::pair<double, double>, double> &cluster = clusters[pick_cluster(rng)];
+        std::normal_distribution<double> offset(0, cluster.second);
+        double x = cluster.first.first + offset(rng);
+        double y = cluster.first.second + offset(rng);
+
+        RTreeBox box = {x, y, x, y};
+        if (i % 10 == 0) {
+            box.max_x += feature_size(rng);
+            box.max_y += feature_size(rng);
+        } else if (i % 10 != 1) {
+            box.max_x += segment_size(rng);
+            box.max_y += segment_size(rng);
+        }
+        items.push_back(std::make_pair(box, unsigned(i)));
+    }
+}
+
+
+bool benchmark_closest(std::size_t num_queries, std::mt19937 &rng) {
+    const WorldValues &world = MAP.world_values;
+    double lat_span = world.max_lat - world.min_lat;
+    double lon_span = world.max_lon - world.min_lon;
+    std::uniform_real_distribution<double> share(0, 1);
+
+    std::vector<std::string> kinds = {"at intersections", "inside the map", "off the map", "near the poles"};
+    bool matched = true;
+
+    std::cout << "Closest points on a map of " << getNumIntersections() << " intersections and "
+              << getNumPointsOfInterest() << " points of interest\n";
+
+    for (std::size_t kind = 0; kind < kinds.size(); ++kind) {
+        double tree_time = 0, linear_time = 0;
+        unsigned long queries = 0, mismatches = 0;
+
+        for (std::size_t q = 0; q < num_queries; ++q) {
+            LatLon position;
+            if (kind == 0 && getNumIntersections() > 0) {
+                // Ties with any intersection at the same position go to the lowest id
+                position = getIntersectionPosition(std::uniform_int_distribution<int>(0, getNumIntersections() - 1)(rng));
+            } else if (kind == 1) {
+                position = LatLon(world.min_lat + share(rng) * lat_span, world.min_lon + share(rng) * lon_span);
+            } else if (kind == 2) {
+                // Up to ten times the size of the map away, where the radius covers the whole tree
+                position = LatLon(std::max(-90.0, std::min(90.0, world.min_lat + (share(rng) * 20 - 10) * lat_span)),
+                                  std::max(-180.0, std::min(180.0, world.min_lon + (share(rng) * 20 - 10) * lon_span)));
+            } else {
+                // Within a degree of either pole, where the cos of the latitude can't bound the radius, some exactly on it
+                double pole_gap = q % 16 == 0 ? 0 : share(rng);
+                position = LatLon(q % 2 == 0 ? 90 - pole_gap : -90 + pole_gap, share(rng) * 360 - 180);
+            }
+
+            for (int poi = 0; poi < 2; ++poi) {
+                int num_points = poi ? getNumPointsOfInterest() : getNumIntersections();
+                LatLon (*point_position)(int) = poi ? getPointOfInterestPosition : getIntersectionPosition;
+
+                auto start = std::chrono::high_resolution_clock::now();
+                unsigned found = poi ? find_closest_point_of_interest(position) : find_closest_intersection(position);
+                tree_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+                start = std::chrono::high_resolution_clock::now();
+                unsigned expected = linear_closest(position, num_points, point_position);
+                linear_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+                if (found != expected) mismatches++;
+                queries++;
+            }
+        }
+
+        double divisor = std::max<unsigned long>(1, queries);
+        std::cout << "  " << std::left << std::setw(18) << kinds[kind] << std::right
+                  << "queries: " << queries << "  mismatches: " << mismatches
+                  << std::fixed << std::setprecision(2)
+                  << "  tree us: " << 1e6 * tree_time / divisor
+                  << "  linear us: " << 1e6 * linear_time / divisor << "\n";
+        std::cout.unsetf(std::ios::fixed);
+
+        matched = matched && mismatches == 0;
+    }
+    return matched;
+}
+
+
+bool benchmark_snap(std::size_t num_positions, std::mt19937 &rng) {
+    const WorldValues &world = MAP.world_values;
+    double lat_span = world.max_lat - world.min_lat;
+    double lon_span = world.max_lon - world.min_lon;
+    std::uniform_real_distribution<double> share(0, 1);
+
+    // A quarter at intersections, where every segment of the intersection ties at no distance, a quarter
+    // inside the map, a quarter around it, and a quarter in small clusters like the pings of one trip
+    std::vector<LatLon> positions;
+    LatLon cluster_centre(world.min_lat, world.min_lon);
+    for (std::size_t i = 0; i < num_positions; ++i) {
+        std::size_t kind = i % 4;
+        if (kind == 0 && getNumIntersections() > 0) {
+            positions.push_back(getIntersectionPosition(std::uniform_int_distribution<int>(0, getNumIntersections() - 1)(rng)));
+        } else if (kind == 1) {
+            positions.push_back(LatLon(world.min_lat + share(rng) * lat_span, world.min_lon + share(rng) * lon_span));
+        } else if (kind == 2) {
+            positions.push_back(LatLon(world.min_lat + (share(rng) * 3 - 1) * lat_span, world.min_lon + (share(rng) * 3 - 1) * lon_span));
+        } else {
+            if (i % 400 == 3) cluster_centre = LatLon(world.min_lat + share(rng) * lat_span, world.min_lon + share(rng) * lon_span);
+            positions.push_back(LatLon(cluster_centre.lat() + share(rng) * 0.01, cluster_centre.lon() + share(rng) * 0.01));
+        }
+    }
+
+    std::vector<unsigned> intersection_ids, batch_ids, single_ids(positions.size());
+    std::vector<SegmentSnap> segments;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    snap_positions(positions, intersection_ids, &segments);
+    double segments_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    snap_positions(positions, batch_ids);
+    double batch_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        single_ids[i] = find_closest_intersection(positions[i]);
+    }
+    double single_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    unsigned long intersection_mismatches = 0;
+    for (std::size_t i = 0; i < positions.size(); ++i) {
+        if (intersection_ids[i] != single_ids[i] || batch_ids[i] != single_ids[i]) intersection_mismatches++;
+    }
+
+    // Every segment in order, so ties go to the lowest id like closest_street_segment
+    unsigned long segment_checks = 0, segment_mismatches = 0;
+    double linear_time = 0;
+    SegmentSnap snap;
+    for (std::size_t i = 0; i < positions.size(); i += 10) {
+        SegmentSnap best = {0, 0, positions[i], std::numeric_limits<double>::max()};
+        start = std::chrono::high_resolution_clock::now();
+        for (int id = 0; id < getNumStreetSegments(); ++id) {
+            double distance = distance_to_street_segment(positions[i], id, snap);
+            if (distance < best.distance) best = snap;
+        }
+        linear_time += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        const SegmentSnap &found = segments[i];
+        if (found.segment_id != best.segment_id || found.distance != best.distance
+                || found.along != best.along || found.along < 0 || found.along > 1) {
+            segment_mismatches++;
+        }
+        segment_checks++;
+    }
+
+    double divisor = std::max<std::size_t>(1, positions.size());
+    std::cout << "Snapped " << positions.size() << " positions to " << getNumStreetSegments() << " street segments\n"
+              << std::fixed << std::setprecision(2)
+              << "  with segments us: " << 1e6 * segments_time / divisor
+              << "  batch us: " << 1e6 * batch_time / divisor
+              << "  single us: " << 1e6 * single_time / divisor
+              << "  linear segments us: " << 1e6 * linear_time / std::max<unsigned long>(1, segment_checks) << "\n";
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << "  intersection mismatches: " << intersection_mismatches
+              << "  segment checks: " << segment_checks << "  segment mismatches: " << segment_mismatches << "\n";
+
+    return intersection_mismatches == 0 && segment_mismatches == 0;
+}
+
+
+unsigned linear_closest(LatLon position, int num_points, LatLon (*point_position)(int)) {
+    unsigned min_index = 0;
+    double min_distance = std::numeric_limits<double>::max();
+    for (int i = 0; i < num_points; i++) {
+        double distance = find_distance_between_two_points(position, point_position(i));
+        if (distance < min_distance) {
+            min_index = i;
+            min_distance = distance;
+        }
+    }
+    return min_index;
+}
+
+
+template <typename Neighbour>
+bool same_neighbours(const std::vector<Neighbour> &a, const std::vector<Neighbour> &b) {
+    if (a.size() != b.size()) return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (a[i].distance != b[i].distance || a[i].data != b[i].data) return false;
+    }
+    return true;
+}
+
+
+void print_stats(const std::vector<QueryStats> &stats) {
+    std::cout << std::left << std::setw(20) << "query" << std::right
+              << std::setw(10) << "queries" << std::setw(12) << "mismatches"
+              << std::setw(14) << "avg visited" << std::setw(16) << "avg candidates"
+              << std::setw(12) << "visited %" << std::setw(14) << "tree us" << std::setw(14) << "brute us" << "\n";
+
+    for (const QueryStats &query_stats : stats) {
+        double queries = std::max<unsigned long>(1, query_stats.queries);
+        std::cout << std::left << std::setw(20) << query_stats.name << std::right
+                  << std::setw(10) << query_stats.queries
+                  << std::setw(12) << query_stats.mismatches
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(14) << query_stats.visited / queries
+                  << std::setw(16) << query_stats.candidates / queries
+                  << std::setprecision(3)
+                  << std::setw(12) << 100.0 * query_stats.visited / std::max<unsigned long>(1, query_stats.candidates)
+                  << std::setprecision(2)
+                  << std::setw(14) << 1e6 * query_stats.tree_time / queries
+                  << std::setw(14) << 1e6 * query_stats.brute_time / queries << "\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+}
@@ -0,0 +1,291 @@
+/*
+ * File:   DynamicKDTree.h
+ *
+ * A KD tree that points can be added to and removed from at any time, for data
+ * that changes while the map is open such as overlays.
+ *
+ * It uses the logarithmic method: the points are split between static KDTrees,
+ * where level i holds at most 2^i points. A new point goes in the first empty
+ * level together with every point of the levels below it, which are rebuilt into
+ * one balanced tree, so a point is rebuilt O(log n) times over all the inserts.
+ *
+ * Removed points stay in their level as tombstones and are skipped by queries.
+ * They are dropped whenever their level is rebuilt, and once they outnumber the
+ * points left every level is rebuilt into one tree.
+ *
+ * The levels store a slot for each point instead of its payload, and each payload
+ * has at most one point, so inserting a payload again moves its point. Every
+ * insert takes a new slot, so the slots are also given out again by rebuilding
+ * every level once there are twice as many as points.
+ *
+ */
+
+#pragma once //protects against multiple inclusions of this header file
+
+#include "KDTree.h"
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Tombstones and unused slots always allowed before every level is rebuilt, so small trees
+// aren't rebuilt on every change
+#define DYNAMIC_KD_MIN_TOMBSTONES 64
+
+template <typename Payload, std::size_t Dim, typename Coord>
+class DynamicKDTree {
+    public:
+        typedef typename KDTree<Payload, Dim, Coord>::Point Point;
+        typedef typename KDTree<Payload, Dim, Coord>::Item Item;
+        typedef typename KDTree<Payload, Dim, Coord>::Neighbour Neighbour;
+
+        // Replaces everything in the tree with the items, in one level
+        void make_tree(const std::vector<Item> &items);
+
+        // Adds a point for the payload, replacing its point if it already has one
+        void insert(const Point &point, const Payload &payload);
+
+        // Removes the point of the payload, returns false if it has none
+        bool remove(const Payload &payload);
+
+        void clear();
+
+        std::size_t size() const { return payload_slots.size(); }
+
+        // Bytes used by the levels and the slots, not counting the hash table of payloads
+        std::size_t memory() const;
+
+        // Calls visit(payload, point) for every point from low to high, in no particular order
+        template <typename Visitor>
+        void visit_range(const Point &low, const Point &high, Visitor &&visit) const;
+
+        // Finds the k points closest to search_point, sorted by distance, then by payload
+        void k_nearest(const Point &search_point, std::size_t k, std::vector<Neighbour> &results) const;
+
+        // Finds every point within radius of search_point, sorted the same way as k_nearest
+        void radius_query(const Point &search_point, double radius, std::vector<Neighbour> &results) const;
+
+    private:
+        typedef KDTree<unsigned, Dim, Coord> Level;
+
+        std::vector<Level> levels; // Level i holds at most 2^i points, or is empty
+        std::vector<unsigned> level_tombstones; // Removed points still in each level
+
+        std::vector<Payload> slot_payloads; // Payload of each slot
+        std::vector<unsigned> slot_levels; // Level of each slot, KD_NO_NODE once removed or dropped
+        std::unordered_map<Payload, unsigned> payload_slots; // Slot of the point of each payload
+        std::size_t num_tombstones = 0;
+
+        unsigned add_slot(const Payload &payload);
+
+        // Builds the items into the level, which has to be empty, dropping the removed ones
+        void build_level(std::size_t level, std::vector<typename Level::Item> &items);
+
+        // Rebuilds every point left into one level, giving them new slots
+        void rebuild();
+
+        // Adds the live points found in a level to results
+        void add_live(const std::vector<typename Level::Neighbour> &found, std::vector<Neighbour> &results) const;
+
+        static bool closer(const Neighbour &a, const Neighbour &b);
+};
+
+// Points in screen coordinates with an id, like KD2Tree
+typedef DynamicKDTree<unsigned int, 2, float> DynamicKD2Tree;
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::make_tree(const std::vector<Item> &items) {
+    clear();
+
+    std::vector<typename Level::Item> level_items;
+    level_items.reserve(items.size());
+    for (const Item &item : items) {
+        // A payload given twice keeps its last point, the other one is dropped when building
+        typename std::unordered_map<Payload, unsigned>::iterator old = payload_slots.find(item.second);
+        if (old != payload_slots.end()) slot_levels[old->second] = KD_NO_NODE;
+        level_items.push_back(std::make_pair(item.first, add_slot(item.second)));
+    }
+
+    // Placed in the level it would have reached by inserting the items one at a time
+    std::size_t level = 0;
+    while ((std::size_t(1) << level) < level_items.size()) ++level;
+    build_level(level, level_items);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::insert(const Point &point, const Payload &payload) {
+    remove(payload);
+
+    std::vector<typename Level::Item> items;
+    items.push_back(std::make_pair(point, add_slot(payload)));
+
+    // Every full level below the first empty one is merged into it, which holds at most
+    // 1 + 2^0 + ... + 2^(level - 1) = 2^level points
+    std::size_t level = 0;
+    while (level < levels.size() && levels[level].size() > 0) {
+        levels[level].get_items(items);
+        levels[level].clear();
+        num_tombstones -= level_tombstones[level];
+        level_tombstones[level] = 0;
+        ++level;
+    }
+
+    build_level(level, items);
+
+    if (slot_payloads.size() > 2 * payload_slots.size() + DYNAMIC_KD_MIN_TOMBSTONES) rebuild();
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+bool DynamicKDTree<Payload, Dim, Coord>::remove(const Payload &payload) {
+    typename std::unordered_map<Payload, unsigned>::iterator found = payload_slots.find(payload);
+    if (found == payload_slots.end()) return false;
+
+    unsigned slot = found->second;
+    payload_slots.erase(found);
+
+    level_tombstones[slot_levels[slot]]++;
+    slot_levels[slot] = KD_NO_NODE;
+    num_tombstones++;
+
+    if (num_tombstones > DYNAMIC_KD_MIN_TOMBSTONES && num_tombstones > payload_slots.size()) rebuild();
+    return true;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::clear() {
+    levels.clear();
+    level_tombstones.clear();
+    slot_payloads.clear();
+    slot_levels.clear();
+    payload_slots.clear();
+    num_tombstones = 0;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+std::size_t DynamicKDTree<Payload, Dim, Coord>::memory() const {
+    std::size_t total = slot_payloads.capacity() * sizeof(Payload) + slot_levels.capacity() * sizeof(unsigned);
+    for (const Level &level : levels) {
+        total += level.memory();
+    }
+    return total;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+unsigned DynamicKDTree<Payload, Dim, Coord>::add_slot(const Payload &payload) {
+    unsigned slot = slot_payloads.size();
+    slot_payloads.push_back(payload);
+    slot_levels.push_back(0); // Set when its level is built
+    payload_slots[payload] = slot;
+    return slot;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::build_level(std::size_t level, std::vector<typename Level::Item> &items) {
+    items.erase(std::remove_if(items.begin(), items.end(), [&](const typename Level::Item &item) {
+        return slot_levels[item.second] == KD_NO_NODE;
+    }), items.end());
+
+    if (level >= levels.size()) {
+        levels.resize(level + 1);
+        level_tombstones.resize(level + 1, 0);
+    }
+
+    for (const typename Level::Item &item : items) {
+        slot_levels[item.second] = level;
+    }
+
+    // Every point is at the same zoom level, the queries include all of them
+    levels[level].make_tree(items, 0);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::rebuild() {
+    std::vector<Item> items;
+    items.reserve(payload_slots.size());
+
+    std::vector<typename Level::Item> level_items;
+    for (const Level &level : levels) {
+        level_items.clear();
+        level.get_items(level_items);
+        for (const typename Level::Item &item : level_items) {
+            if (slot_levels[item.second] != KD_NO_NODE) {
+                items.push_back(std::make_pair(item.first, slot_payloads[item.second]));
+            }
+        }
+    }
+
+    make_tree(items);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+template <typename Visitor>
+void DynamicKDTree<Payload, Dim, Coord>::visit_range(const Point &low, const Point &high, Visitor &&visit) const {
+    for (const Level &level : levels) {
+        level.visit_points(low, high, KD_ALL_ZOOM_LEVELS, [&](unsigned slot, const Point &point) {
+            if (slot_levels[slot] != KD_NO_NODE) visit(slot_payloads[slot], point);
+        });
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::k_nearest(const Point &search_point,
+                                                   std::size_t k,
+                                                   std::vector<Neighbour> &results) const {
+    results.clear();
+    std::vector<typename Level::Neighbour> found;
+
+    // Asking each level for as many more points as it has tombstones still finds its k closest live points
+    for (std::size_t level = 0; level < levels.size(); ++level) {
+        if (levels[level].size() == 0) continue;
+
+        levels[level].k_nearest(search_point, k + level_tombstones[level], KD_ALL_ZOOM_LEVELS, found);
+        add_live(found, results);
+    }
+
+    std::sort(results.begin(), results.end(), closer);
+    if (results.size() > k) results.resize(k);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::radius_query(const Point &search_point,
+                                                      double radius,
+                                                      std::vector<Neighbour> &results) const {
+    results.clear();
+    std::vector<typename Level::Neighbour> found;
+
+    for (const Level &level : levels) {
+        if (level.size() == 0) continue;
+
+        level.radius_query(search_point, radius, KD_ALL_ZOOM_LEVELS, found);
+        add_live(found, results);
+    }
+
+    std::sort(results.begin(), results.end(), closer);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void DynamicKDTree<Payload, Dim, Coord>::add_live(const std::vector<typename Level::Neighbour> &found,
+                                                  std::vector<Neighbour> &results) const {
+    for (const typename Level::Neighbour &neighbour : found) {
+        if (slot_levels[neighbour.data] != KD_NO_NODE) {
+            results.push_back({neighbour.distance, neighbour.point, slot_payloads[neighbour.data]});
+        }
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+bool DynamicKDTree<Payload, Dim, Coord>::closer(const Neighbour &a, const Neighbour &b) {
+    return (a.distance < b.distance) || (a.distance == b.distance && a.data < b.data);
+}
@@ -0,0 +1,780 @@
+/*
+ * File:   KDTree.h
+ *
+ * Author: ECE297 Team013 2019
+ *
+ * KD Tree is a custom (by our ECE297 team) implementation of a classic KD Tree
+ * with the added feature of a zoom flag. The zoom flag allows queries to only
+ * check points at certain zoom levels. It is inspired by crvs/KDTree on Github.
+ *
+ * The tree is a template on the payload stored with each point, the number of
+ * dimensions and the coordinate type, so a float tree takes half the memory for
+ * its points. The axis a node splits on is a template parameter of the functions
+ * walking the tree, so it is chosen at compile time instead of from the depth.
+ *
+ * The nodes are kept in arrays in preorder, so the left child of a node is the
+ * next node and its right child starts where the left subtree ends. Nodes are
+ * referred to by their index in the arrays instead of by pointers. The left
+ * subtree of a node is less than it on its axis, and the right subtree is
+ * greater than or equal to it.
+ *
+ */
+
+#pragma once //protects against multiple inclusions of this header file
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <iostream>
+#include <type_traits>
+#include <omp.h>
+
+// Index of a node that doesn't exist, such as the root of an empty tree
+#define KD_NO_NODE std::numeric_limits<unsigned>::max()
+
+// Zoom level that includes the points at every zoom level in a query
+#define KD_ALL_ZOOM_LEVELS std::numeric_limits<int>::max()
+
+// Points below which a subtree is built by the same thread instead of as a new task
+#define KD_TASK_CUTOFF 16384
+
+template <typename Payload, std::size_t Dim, typename Coord>
+class KDTree {
+    public:
+        typedef Coord coordinate_type;
+        typedef std::array<Coord, Dim> Point;
+        typedef std::pair<Point, Payload> Item;
+
+        // A point found by a nearest neighbour or radius query
+        struct Neighbour {
+            double distance; // squared distance to the search point
+            Point point;
+            Payload data;
+        };
+
+        unsigned root = KD_NO_NODE;
+
+        // Builds a balanced tree from the items, replacing anything in the tree.
+        // Zoom levels are stored from -128 to 127
+        void make_tree(std::vector<Item> &items, int zoom_level);
+
+        // Inserts the items under the nodes already in the tree, building balanced
+        // subtrees wherever a group of items reaches an empty child
+        void insert_bulk(std::vector<Item> &items, int zoom_level);
+
+        void clear();
+
+        std::size_t size() const { return points.size(); }
+
+        // Appends every item of the tree to items, without their zoom levels
+        void get_items(std::vector<Item> &items) const;
+
+        // Bytes used by the arrays of the tree
+        std::size_t memory() const;
+
+        // Smallest and greatest coordinates of every point, both are all 0 if the tree is empty
+        const Point &min_point() const { return min_bounds; }
+        const Point &max_point() const { return max_bounds; }
+
+        void visualize_tree(int zoom_level) const;
+
+        // Calls visit(data, point) once for every payload with a point from low to high, with
+        // the first point of it that is reached. Skips subtrees above zoom_level, and if
+        // search_depth isn't 0 stops at that depth, which gives fewer clusters of points.
+        // The payloads are marked in an array kept by the tree, which is only allocated by the
+        // first query, so they have to be small integers and only one query can run at a time
+        template <typename Visitor>
+        void visit_range(const Point &low,
+                         const Point &high,
+                         int zoom_level,
+                         std::size_t search_depth,
+                         Visitor &&visit);
+
+        // Calls visit(data, point) for every point from low to high at or below zoom_level. Nothing
+        // is marked, so a payload with several points is visited for each of them, and several
+        // queries can run at once
+        template <typename Visitor>
+        void visit_points(const Point &low, const Point &high, int zoom_level, Visitor &&visit) const;
+
+        // Finds the k points closest to search_point, skipping subtrees above zoom_level.
+        // The results are sorted by distance, then by payload. A payload can be found more than
+        // once if it has more than one point. If visited isn't null it is set to the nodes checked
+        void k_nearest(const Point &search_point,
+                       std::size_t k,
+                       int zoom_level,
+                       std::vector<Neighbour> &results,
+                       std::size_t *visited = nullptr) const;
+
+        // Finds every point within radius of search_point, sorted the same way as k_nearest
+        void radius_query(const Point &search_point,
+                          double radius,
+                          int zoom_level,
+                          std::vector<Neighbour> &results,
+                          std::size_t *visited = nullptr) const;
+
+    private:
+        // One entry for every node, in preorder
+        std::vector<Point> points;
+        std::vector<Payload> data;
+        std::vector<signed char> zoom_levels;
+        std::vector<unsigned> right_begin; // Index of the right child, the left subtree is everything before it
+        std::vector<unsigned> subtree_end; // Index one past the last node of the subtree
+
+        Point min_bounds = Point();
+        Point max_bounds = Point();
+
+        // The query each payload was last visited by, and the current query
+        std::vector<unsigned> visit_epoch;
+        unsigned epoch = 0;
+
+        // Children of every node while the tree is being built, new nodes are added at the end
+        std::vector<unsigned> build_left; // less than
+        std::vector<unsigned> build_right; // greater than or equal
+
+        unsigned left_child(unsigned node) const {
+            return right_begin[node] > node + 1 ? node + 1 : KD_NO_NODE;
+        }
+        unsigned right_child(unsigned node) const {
+            return subtree_end[node] > right_begin[node] ? right_begin[node] : KD_NO_NODE;
+        }
+
+        static constexpr std::size_t next_axis(std::size_t axis) { return (axis + 1) % Dim; }
+
+        // Squared distance between the points
+        static double distance(const Point &a, const Point &b);
+
+        // Orders neighbours by distance, then by payload
+        static bool closer(const Neighbour &a, const Neighbour &b);
+
+        // Fills the node in the given slot of the arrays, without children
+        void set_node(unsigned slot, const Item &item, int zoom_level);
+
+        // Builds a balanced subtree from the items into the slots starting at first_slot, one for each item.
+        // Returns the slot of its root
+        template <std::size_t Axis>
+        unsigned build_subtree(typename std::vector<Item>::iterator begin,
+                               typename std::vector<Item>::iterator end,
+                               int zoom_level,
+                               unsigned first_slot);
+
+        void insert_item(unsigned node, const Item &item, std::size_t axis, int zoom_level, unsigned slot);
+
+        // Inserts the items under node, the new nodes go in the slots starting at first_slot
+        template <std::size_t Axis>
+        void insert_subtree(typename std::vector<Item>::iterator begin,
+                            typename std::vector<Item>::iterator end,
+                            unsigned &node,
+                            int zoom_level,
+                            unsigned first_slot);
+
+        // Moves between the preorder arrays and the children used while building
+        void begin_build();
+        void end_build();
+
+        // Gives every payload a mark for visit_range, only integer payloads can be marked.
+        // Done by the first visit_range after building, so trees never queried by it don't need the marks
+        void size_visit_marks(std::true_type is_integral);
+        void size_visit_marks(std::false_type is_integral) { (void)is_integral; }
+
+        template <std::size_t Axis>
+        void visualize_node(unsigned node, std::size_t depth, int zoom_level) const;
+
+        template <std::size_t Axis, typename Visitor>
+        void visit_node(unsigned node,
+                        std::size_t depth,
+                        const Point &low,
+                        const Point &high,
+                        int zoom_level,
+                        std::size_t search_depth,
+                        Visitor &visit);
+
+        template <std::size_t Axis, typename Visitor>
+        void visit_points_node(unsigned node,
+                               const Point &low,
+                               const Point &high,
+                               int zoom_level,
+                               Visitor &visit) const;
+
+        // Keeps the k closest points in results as a max heap, the farthest at the front
+        template <std::size_t Axis>
+        void k_nearest_node(unsigned node,
+                            const Point &search_point,
+                            std::size_t k,
+                            int zoom_level,
+                            std::vector<Neighbour> &results,
+                            std::size_t &visited) const;
+
+        template <std::size_t Axis>
+        void radius_query_node(unsigned node,
+                               const Point &search_point,
+                               double radius_squared,
+                               int zoom_level,
+                               std::vector<Neighbour> &results,
+                               std::size_t &visited) const;
+};
+
+// The trees of the map, by the x and y of x_from_lon and y_from_lat with the id of each point.
+// Screen coordinates only need float precision
+typedef KDTree<unsigned int, 2, float> KD2Tree;
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::make_tree(std::vector<Item> &items, int zoom_level) {
+    clear();
+
+    begin_build();
+    points.resize(items.size());
+    data.resize(items.size());
+    zoom_levels.resize(items.size());
+    build_left.resize(items.size());
+    build_right.resize(items.size());
+
+    // Small trees are built faster without starting the threads
+    #pragma omp parallel if(items.size() > KD_TASK_CUTOFF)
+    #pragma omp single
+    root = build_subtree<0>(items.begin(), items.end(), zoom_level, 0);
+
+    end_build();
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::insert_bulk(std::vector<Item> &items, int zoom_level) {
+    begin_build();
+
+    // Every item becomes one new node, so the slots can be handed out before inserting
+    unsigned first_slot = points.size();
+    points.resize(first_slot + items.size());
+    data.resize(first_slot + items.size());
+    zoom_levels.resize(first_slot + items.size());
+    build_left.resize(first_slot + items.size());
+    build_right.resize(first_slot + items.size());
+
+    #pragma omp parallel if(items.size() > KD_TASK_CUTOFF)
+    #pragma omp single
+    insert_subtree<0>(items.begin(), items.end(), root, zoom_level, first_slot);
+
+    end_build();
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::clear() {
+    root = KD_NO_NODE;
+    points.clear();
+    data.clear();
+    zoom_levels.clear();
+    right_begin.clear();
+    subtree_end.clear();
+    build_left.clear();
+    build_right.clear();
+    visit_epoch.clear();
+    epoch = 0;
+    min_bounds = Point();
+    max_bounds = Point();
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::get_items(std::vector<Item> &items) const {
+    items.reserve(items.size() + points.size());
+    for (std::size_t node = 0; node < points.size(); ++node) {
+        items.push_back(std::make_pair(points[node], data[node]));
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+std::size_t KDTree<Payload, Dim, Coord>::memory() const {
+    return points.capacity() * sizeof(Point) + data.capacity() * sizeof(Payload)
+            + zoom_levels.capacity() * sizeof(signed char)
+            + (right_begin.capacity() + subtree_end.capacity() + visit_epoch.capacity()) * sizeof(unsigned);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+double KDTree<Payload, Dim, Coord>::distance(const Point &a, const Point &b) {
+    double total = 0;
+    for (std::size_t axis = 0; axis < Dim; ++axis) {
+        double gap = double(a[axis]) - double(b[axis]);
+        total += gap * gap;
+    }
+    return total;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+bool KDTree<Payload, Dim, Coord>::closer(const Neighbour &a, const Neighbour &b) {
+    return (a.distance < b.distance) || (a.distance == b.distance && a.data < b.data);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::set_node(unsigned slot, const Item &item, int zoom_level) {
+    points[slot] = item.first;
+    data[slot] = item.second;
+    zoom_levels[slot] = (signed char)zoom_level;
+    build_left[slot] = KD_NO_NODE;
+    build_right[slot] = KD_NO_NODE;
+}
+
+
+// Creates balanced KD tree where right is greater than or equal to the node,
+// and left is less than the node. Does this by selecting the median on the
+// axis, moving the items equal to it to its right, and recursively building
+// the left and right parts on the next axis. Large subtrees are built as tasks
+// by other threads, the slots of the left subtree come right after the node
+// and the right subtree after them
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis>
+unsigned KDTree<Payload, Dim, Coord>::build_subtree(typename std::vector<Item>::iterator begin,
+                                                    typename std::vector<Item>::iterator end,
+                                                    int zoom_level,
+                                                    unsigned first_slot) {
+
+    // Vector passed is empty
+    if (begin == end) return KD_NO_NODE;
+
+    std::size_t vec_size = end - begin;
+    if (vec_size == 1) {
+        set_node(first_slot, *begin, zoom_level);
+        return first_slot;
+    }
+
+    // Find the median on the axis
+    auto middle = begin + vec_size / 2;
+    std::nth_element(begin, middle, end, [](const Item &a, const Item &b) {
+        return a.first[Axis] < b.first[Axis];
+    });
+
+    // Move middle to the first item with that value, such that left is always '<' and right is always '>='
+    const Coord median = (*middle).first[Axis];
+    auto first_equal = std::partition(begin, middle, [&](const Item &item) {
+        return item.first[Axis] < median;
+    });
+    std::iter_swap(first_equal, middle);
+    middle = first_equal;
+
+    std::size_t l_size = middle - begin;
+    unsigned node = first_slot;
+    set_node(node, *middle, zoom_level);
+
+    unsigned left = KD_NO_NODE;
+    unsigned right = KD_NO_NODE;
+
+    #pragma omp task shared(left) if(l_size > KD_TASK_CUTOFF)
+    left = build_subtree<next_axis(Axis)>(begin, middle, zoom_level, first_slot + 1);
+
+    right = build_subtree<next_axis(Axis)>(middle + 1, end, zoom_level, first_slot + 1 + l_size);
+
+    #pragma omp taskwait
+    build_left[node] = left;
+    build_right[node] = right;
+
+    return node;
+}
+
+
+// Inserts an item into the tree, going left if less than the node, or right if
+// greater than or equal to, until an empty child is found for it
+// NOTE: Does not work on empty tree
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::insert_item(unsigned node, const Item &item, std::size_t axis, int zoom_level, unsigned slot) {
+
+    while (node != KD_NO_NODE) {
+        std::vector<unsigned> &children = item.first[axis] < points[node][axis] ? build_left : build_right;
+
+        if (children[node] == KD_NO_NODE) {
+            set_node(slot, item, zoom_level);
+            children[node] = slot;
+            return;
+        }
+
+        node = children[node];
+        axis = next_axis(axis);
+    }
+}
+
+
+// Inserts a vector of items into the tree by recursively splitting the array
+// to match the nodes in the tree until places to insert the items are found.
+// Makes use of insert_item and build_subtree. Will store the zoom_level flag passed
+// for every node that is inserted. The items going left take the first slots
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis>
+void KDTree<Payload, Dim, Coord>::insert_subtree(typename std::vector<Item>::iterator begin,
+                                                 typename std::vector<Item>::iterator end,
+                                                 unsigned &node,
+                                                 int zoom_level,
+                                                 unsigned first_slot) {
+
+    // Vector passed is empty
+    if (begin == end) return;
+
+    // Only happens when trying to insert on an empty tree, every item is in the new tree
+    if (node == KD_NO_NODE) {
+        node = build_subtree<Axis>(begin, end, zoom_level, first_slot);
+        return;
+    }
+
+    // if only one item, can use insert item function
+    if (end - begin == 1) {
+        insert_item(node, *begin, Axis, zoom_level, first_slot);
+        return;
+    }
+
+    // Items less than the node on the axis go left, the rest go right
+    const Coord split = points[node][Axis];
+    auto middle = std::partition(begin, end, [&](const Item &item) {
+        return item.first[Axis] < split;
+    });
+    std::size_t l_size = middle - begin;
+
+    // If there is another node, call insert_subtree with that node as root,
+    // otherwise make a new tree with the remainder of the items
+    unsigned left = build_left[node];
+    unsigned right = build_right[node];
+
+    #pragma omp task shared(left) if(l_size > KD_TASK_CUTOFF)
+    insert_subtree<next_axis(Axis)>(begin, middle, left, zoom_level, first_slot);
+
+    insert_subtree<next_axis(Axis)>(middle, end, right, zoom_level, first_slot + l_size);
+
+    #pragma omp taskwait
+    build_left[node] = left;
+    build_right[node] = right;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::begin_build() {
+    build_left.resize(points.size());
+    build_right.resize(points.size());
+
+    for (unsigned node = 0; node < points.size(); ++node) {
+        build_left[node] = left_child(node);
+        build_right[node] = right_child(node);
+    }
+
+    right_begin.clear();
+    subtree_end.clear();
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::end_build() {
+    std::vector<Point> pre_points;
+    std::vector<Payload> pre_data;
+    std::vector<signed char> pre_zoom_levels;
+    pre_points.reserve(points.size());
+    pre_data.reserve(points.size());
+    pre_zoom_levels.reserve(points.size());
+    right_begin.assign(points.size(), 0);
+    subtree_end.assign(points.size(), 0);
+
+    // Walk the tree in preorder, a node's right child starts once every node of its
+    // left subtree has been placed, and its subtree ends once its right subtree has
+    std::vector<std::pair<unsigned, unsigned>> stack; // Node being built, and its index in preorder
+    std::vector<int> stage; // 0: place left subtree, 1: place right subtree, 2: done
+    if (root != KD_NO_NODE) {
+        stack.push_back(std::make_pair(root, 0));
+        stage.push_back(0);
+        pre_points.push_back(points[root]);
+        pre_data.push_back(data[root]);
+        pre_zoom_levels.push_back(zoom_levels[root]);
+    }
+
+    while (!stack.empty()) {
+        unsigned node = stack.back().first;
+        unsigned index = stack.back().second;
+
+        unsigned child = KD_NO_NODE;
+        if (stage.back() == 0) {
+            child = build_left[node];
+        } else if (stage.back() == 1) {
+            right_begin[index] = pre_points.size();
+            child = build_right[node];
+        } else {
+            subtree_end[index] = pre_points.size();
+            stack.pop_back();
+            stage.pop_back();
+            continue;
+        }
+        stage.back()++;
+
+        if (child != KD_NO_NODE) {
+            stack.push_back(std::make_pair(child, pre_points.size()));
+            stage.push_back(0);
+            pre_points.push_back(points[child]);
+            pre_data.push_back(data[child]);
+            pre_zoom_levels.push_back(zoom_levels[child]);
+        }
+    }
+
+    points.swap(pre_points);
+    data.swap(pre_data);
+    zoom_levels.swap(pre_zoom_levels);
+    if (root != KD_NO_NODE) root = 0;
+
+    // Only needed while building
+    std::vector<unsigned>().swap(build_left);
+    std::vector<unsigned>().swap(build_right);
+
+    // The payloads may have changed, so the marks are sized again by the next visit_range
+    std::vector<unsigned>().swap(visit_epoch);
+    epoch = 0;
+
+    min_bounds = Point();
+    max_bounds = Point();
+    if (!points.empty()) {
+        min_bounds = max_bounds = points[0];
+    }
+    for (const Point &point : points) {
+        for (std::size_t axis = 0; axis < Dim; ++axis) {
+            min_bounds[axis] = std::min(min_bounds[axis], point[axis]);
+            max_bounds[axis] = std::max(max_bounds[axis], point[axis]);
+        }
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::size_visit_marks(std::true_type is_integral) {
+    (void)is_integral;
+    if (data.empty()) return;
+
+    std::size_t max_payload = std::size_t(*std::max_element(data.begin(), data.end()));
+    if (visit_epoch.size() <= max_payload) visit_epoch.resize(max_payload + 1, 0);
+}
+
+
+// Recursively visualizes KD Tree horizontally
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::visualize_tree(int zoom_level) const {
+    visualize_node<0>(root, 0, zoom_level);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis>
+void KDTree<Payload, Dim, Coord>::visualize_node(unsigned node, std::size_t depth, int zoom_level) const {
+    if(node == KD_NO_NODE) return;
+
+    if(zoom_levels[node] > zoom_level) return;
+
+    for(std::size_t i = 0; i < depth; i++) {
+        std::cout << " ";
+    }
+
+    std::cout << Axis << "(";
+    for (std::size_t axis = 0; axis < Dim; ++axis) {
+        std::cout << (axis > 0 ? "," : "") << points[node][axis];
+    }
+    std::cout << "):" << data[node] << std::endl;
+
+    visualize_node<next_axis(Axis)>(left_child(node), depth + 1, zoom_level);
+    visualize_node<next_axis(Axis)>(right_child(node), depth + 1, zoom_level);
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+template <typename Visitor>
+void KDTree<Payload, Dim, Coord>::visit_range(const Point &low,
+                                              const Point &high,
+                                              int zoom_level,
+                                              std::size_t search_depth,
+                                              Visitor &&visit) {
+    static_assert(std::is_integral<Payload>::value, "visit_range marks the payloads by their value");
+
+    if (visit_epoch.empty()) size_visit_marks(std::is_integral<Payload>());
+
+    // Once the epoch wraps around every payload has to be unmarked
+    if (++epoch == 0) {
+        std::fill(visit_epoch.begin(), visit_epoch.end(), 0);
+        epoch = 1;
+    }
+
+    visit_node<0>(root, 0, low, high, zoom_level, search_depth, visit);
+}
+
+
+// Recursively calls itself depending on if the point is in the range, to less than, or
+// greater than the range on the axis. It only visits nodes that are in the range, but
+// traverses nodes that could contain children in the range
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis, typename Visitor>
+void KDTree<Payload, Dim, Coord>::visit_node(unsigned node,
+                                             std::size_t depth,
+                                             const Point &low,
+                                             const Point &high,
+                                             int zoom_level,
+                                             std::size_t search_depth,
+                                             Visitor &visit) {
+    if(node == KD_NO_NODE) return;
+
+    if (zoom_levels[node] > zoom_level) return;
+
+    if (search_depth != 0 && depth > search_depth) return;
+
+    const Point &point = points[node];
+
+    if(point[Axis] < low[Axis]) {
+        visit_node<next_axis(Axis)>(right_child(node), depth + 1, low, high, zoom_level, search_depth, visit);
+    } else if(point[Axis] > high[Axis]) {
+        visit_node<next_axis(Axis)>(left_child(node), depth + 1, low, high, zoom_level, search_depth, visit);
+    } else {
+        visit_node<next_axis(Axis)>(left_child(node), depth + 1, low, high, zoom_level, search_depth, visit);
+        visit_node<next_axis(Axis)>(right_child(node), depth + 1, low, high, zoom_level, search_depth, visit);
+
+        // visit the point if it is also in range on the other axes
+        for (std::size_t axis = 0; axis < Dim; ++axis) {
+            if (point[axis] < low[axis] || point[axis] > high[axis]) return;
+        }
+        if (visit_epoch[data[node]] != epoch) {
+            visit_epoch[data[node]] = epoch;
+            visit(data[node], point);
+        }
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+template <typename Visitor>
+void KDTree<Payload, Dim, Coord>::visit_points(const Point &low, const Point &high, int zoom_level, Visitor &&visit) const {
+    visit_points_node<0>(root, low, high, zoom_level, visit);
+}
+
+
+// Same walk as visit_node, without the search depth or the marks
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis, typename Visitor>
+void KDTree<Payload, Dim, Coord>::visit_points_node(unsigned node,
+                                                    const Point &low,
+                                                    const Point &high,
+                                                    int zoom_level,
+                                                    Visitor &visit) const {
+    if(node == KD_NO_NODE) return;
+
+    if (zoom_levels[node] > zoom_level) return;
+
+    const Point &point = points[node];
+
+    if(point[Axis] < low[Axis]) {
+        visit_points_node<next_axis(Axis)>(right_child(node), low, high, zoom_level, visit);
+    } else if(point[Axis] > high[Axis]) {
+        visit_points_node<next_axis(Axis)>(left_child(node), low, high, zoom_level, visit);
+    } else {
+        visit_points_node<next_axis(Axis)>(left_child(node), low, high, zoom_level, visit);
+        visit_points_node<next_axis(Axis)>(right_child(node), low, high, zoom_level, visit);
+
+        for (std::size_t axis = 0; axis < Dim; ++axis) {
+            if (point[axis] < low[axis] || point[axis] > high[axis]) return;
+        }
+        visit(data[node], point);
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::k_nearest(const Point &search_point,
+                                            std::size_t k,
+                                            int zoom_level,
+                                            std::vector<Neighbour> &results,
+                                            std::size_t *visited) const {
+    results.clear();
+    std::size_t visited_nodes = 0;
+
+    if (k > 0) k_nearest_node<0>(root, search_point, k, zoom_level, results, visited_nodes);
+
+    std::sort_heap(results.begin(), results.end(), closer);
+    if (visited != nullptr) *visited = visited_nodes;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis>
+void KDTree<Payload, Dim, Coord>::k_nearest_node(unsigned node,
+                                                 const Point &search_point,
+                                                 std::size_t k,
+                                                 int zoom_level,
+                                                 std::vector<Neighbour> &results,
+                                                 std::size_t &visited) const {
+    if(node == KD_NO_NODE) return;
+
+    if(zoom_levels[node] > zoom_level) return;
+
+    ++visited;
+    const Point &point = points[node];
+
+    Neighbour neighbour = {distance(point, search_point), point, data[node]};
+    if (results.size() < k) {
+        results.push_back(neighbour);
+        std::push_heap(results.begin(), results.end(), closer);
+    } else if (closer(neighbour, results.front())) {
+        std::pop_heap(results.begin(), results.end(), closer);
+        results.back() = neighbour;
+        std::push_heap(results.begin(), results.end(), closer);
+    }
+
+    bool search_left = search_point[Axis] < point[Axis];
+    unsigned near = search_left ? left_child(node) : right_child(node);
+    unsigned far = search_left ? right_child(node) : left_child(node);
+
+    k_nearest_node<next_axis(Axis)>(near, search_point, k, zoom_level, results, visited);
+
+    // Until k points are found every point is closer than the farthest one, after that only
+    // the other side of the split can have closer points if the split is close enough.
+    // Points as far as the farthest are checked too, since one with a smaller payload replaces it
+    double gap = double(point[Axis]) - double(search_point[Axis]);
+    if (results.size() < k || gap * gap <= results.front().distance) {
+        k_nearest_node<next_axis(Axis)>(far, search_point, k, zoom_level, results, visited);
+    }
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+void KDTree<Payload, Dim, Coord>::radius_query(const Point &search_point,
+                                               double radius,
+                                               int zoom_level,
+                                               std::vector<Neighbour> &results,
+                                               std::size_t *visited) const {
+    results.clear();
+    std::size_t visited_nodes = 0;
+
+    if (radius >= 0) radius_query_node<0>(root, search_point, radius * radius, zoom_level, results, visited_nodes);
+
+    std::sort(results.begin(), results.end(), closer);
+    if (visited != nullptr) *visited = visited_nodes;
+}
+
+
+template <typename Payload, std::size_t Dim, typename Coord>
+template <std::size_t Axis>
+void KDTree<Payload, Dim, Coord>::radius_query_node(unsigned node,
+                                                    const Point &search_point,
+                                                    double radius_squared,
+                                                    int zoom_level,
+                                                    std::vector<Neighbour> &results,
+                                                    std::size_t &visited) const {
+    if(node == KD_NO_NODE) return;
+
+    if(zoom_levels[node] > zoom_level) return;
+
+    ++visited;
+    const Point &point = points[node];
+
+    double point_distance = distance(point, search_point);
+    if (point_distance <= radius_squared) results.push_back({point_distance, point, data[node]});
+
+    bool search_left = search_point[Axis] < point[Axis];
+    unsigned near = search_left ? left_child(node) : right_child(node);
+    unsigned far = search_left ? right_child(node) : left_child(node);
+
+    radius_query_node<next_axis(Axis)>(near, search_point, radius_squared, zoom_level, results, visited);
+
+    double gap = double(point[Axis]) - double(search_point[Axis]);
+    if (gap * gap <= radius_squared) {
+        radius_query_node<next_axis(Axis)>(far, search_point, radius_squared, zoom_level, results, visited);
+    }
+}
@@ -41,6 +41,14 @@ void go_through_OSM_nodes() {
             }
         }
     }
+    
+    std::vector<DynamicKD2Tree::Item> parking_points;
+    parking_points.reserve(MAP.OSM_data.bike_parking.size());
+    for(unsigned i = 0; i < MAP.OSM_data.bike_parking.size(); i++) {
+        DynamicKD2Tree::Point point = {{float(MAP.OSM_data.bike_parking[i].x), float(MAP.OSM_data.bike_parking[i].y)}};
+        parking_points.push_back(std::make_pair(point, i));
+    }
+    MAP.OSM_data.bike_parking_tree.make_tree(parking_points);
 }
 
 
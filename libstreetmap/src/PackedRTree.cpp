@@ -0,0 +1,220 @@
+/*
+ * Builds the packed R-tree, see PackedRTree.h
+ */
+
+#include "PackedRTree.h"
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// The children of a node fill whole SIMD registers, and their mask fits in an unsigned
+static_assert(RTREE_NODE_SIZE % 4 == 0 && RTREE_NODE_SIZE <= 32, "RTREE_NODE_SIZE must be a multiple of 4, up to 32");
+
+PackedRTree::PackedRTree() = default;
+
+
+void PackedRTree::make_tree(const std::vector<std::pair<RTreeBox, unsigned int>> &items) {
+    clear();
+    if (items.empty()) return;
+    
+    num_items = items.size();
+    
+    // Box around every item, so the centres can be placed on the Hilbert grid
+    RTreeBox extent = items[0].first;
+    for (const std::pair<RTreeBox, unsigned int> &item : items) {
+        extent.min_x = std::min(extent.min_x, item.first.min_x);
+        extent.min_y = std::min(extent.min_y, item.first.min_y);
+        extent.max_x = std::max(extent.max_x, item.first.max_x);
+        extent.max_y = std::max(extent.max_y, item.first.max_y);
+    }
+    double width = extent.max_x - extent.min_x;
+    double height = extent.max_y - extent.min_y;
+    
+    std::vector<uint64_t> hilbert_values(num_items);
+    for (std::size_t i = 0; i < num_items; ++i) {
+        const RTreeBox &box = items[i].first;
+        double centre_x = (box.min_x + box.max_x) / 2.0;
+        double centre_y = (box.min_y + box.max_y) / 2.0;
+        unsigned x = width > 0 ? unsigned((RTREE_HILBERT_SIZE - 1) * (centre_x - extent.min_x) / width) : 0;
+        unsigned y = height > 0 ? unsigned((RTREE_HILBERT_SIZE - 1) * (centre_y - extent.min_y) / height) : 0;
+        hilbert_values[i] = hilbert_value(x, y);
+    }
+    
+    // Ties are kept in the order given, so the same items always give the same tree
+    std::vector<unsigned> order(num_items);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return hilbert_values[a] < hilbert_values[b];
+    });
+    
+    // Every level has one node for each RTREE_NODE_SIZE boxes of the level below,
+    // and every level but the root is padded to a whole number of nodes
+    std::size_t total = 0;
+    for (std::size_t count = num_items; count > 1; ) {
+        count = (count + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE;
+        total += count * RTREE_NODE_SIZE;
+    }
+    total += 1;
+    min_xs.reserve(total);
+    min_ys.reserve(total);
+    max_xs.reserve(total);
+    max_ys.reserve(total);
+    indices.reserve(total);
+    
+    for (unsigned item : order) {
+        push_box(items[item].first, items[item].second);
+    }
+    if (num_items > 1) pad_level();
+    level_ends.push_back(min_xs.size());
+    
+    std::size_t level_begin = 0;
+    std::size_t level_count = num_items;
+    while (level_count > 1) {
+        std::size_t level_end = level_ends.back();
+        
+        // The padding is empty, so the children can always be taken RTREE_NODE_SIZE at a time
+        for (std::size_t first_child = level_begin; first_child < level_end; first_child += RTREE_NODE_SIZE) {
+            RTreeBox node_box = {min_xs[first_child], min_ys[first_child], max_xs[first_child], max_ys[first_child]};
+            for (std::size_t child = first_child + 1; child < first_child + RTREE_NODE_SIZE; ++child) {
+                node_box.min_x = std::min(node_box.min_x, min_xs[child]);
+                node_box.min_y = std::min(node_box.min_y, min_ys[child]);
+                node_box.max_x = std::max(node_box.max_x, max_xs[child]);
+                node_box.max_y = std::max(node_box.max_y, max_ys[child]);
+            }
+            push_box(node_box, first_child);
+        }
+        
+        level_count = (level_end - level_begin) / RTREE_NODE_SIZE;
+        if (level_count > 1) pad_level();
+        
+        level_begin = level_end;
+        level_ends.push_back(min_xs.size());
+    }
+}
+
+
+void PackedRTree::clear() {
+    num_items = 0;
+    min_xs.clear();
+    min_ys.clear();
+    max_xs.clear();
+    max_ys.clear();
+    indices.clear();
+    level_ends.clear();
+}
+
+
+void PackedRTree::push_box(const RTreeBox &box, unsigned int index) {
+    min_xs.push_back(box.min_x);
+    min_ys.push_back(box.min_y);
+    max_xs.push_back(box.max_x);
+    max_ys.push_back(box.max_y);
+    indices.push_back(index);
+}
+
+
+// Fills the level to a whole number of nodes with boxes that are inside out, so they never
+// overlap anything and don't change the box of their node. The largest doubles are used
+// instead of infinity, since -Ofast assumes there are no infinities
+void PackedRTree::pad_level() {
+    RTreeBox empty = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(),
+                      std::numeric_limits<double>::lowest(), std::numeric_limits<double>::lowest()};
+    
+    std::size_t level_begin = level_ends.empty() ? 0 : level_ends.back();
+    while ((min_xs.size() - level_begin) % RTREE_NODE_SIZE != 0) {
+        push_box(empty, 0);
+    }
+}
+
+
+#if defined(__AVX__)
+
+unsigned PackedRTree::overlap_mask(std::size_t first_child, const RTreeBox &range) const {
+    __m256d range_min_x = _mm256_set1_pd(range.min_x);
+    __m256d range_min_y = _mm256_set1_pd(range.min_y);
+    __m256d range_max_x = _mm256_set1_pd(range.max_x);
+    __m256d range_max_y = _mm256_set1_pd(range.max_y);
+    
+    unsigned mask = 0;
+    for (std::size_t i = 0; i < RTREE_NODE_SIZE; i += 4) {
+        std::size_t child = first_child + i;
+        __m256d overlap_x = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(&min_xs[child]), range_max_x, _CMP_LE_OQ),
+                                          _mm256_cmp_pd(_mm256_loadu_pd(&max_xs[child]), range_min_x, _CMP_GE_OQ));
+        __m256d overlap_y = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(&min_ys[child]), range_max_y, _CMP_LE_OQ),
+                                          _mm256_cmp_pd(_mm256_loadu_pd(&max_ys[child]), range_min_y, _CMP_GE_OQ));
+        mask |= unsigned(_mm256_movemask_pd(_mm256_and_pd(overlap_x, overlap_y))) << i;
+    }
+    return mask;
+}
+
+#elif defined(__SSE2__)
+
+unsigned PackedRTree::overlap_mask(std::size_t first_child, const RTreeBox &range) const {
+    __m128d range_min_x = _mm_set1_pd(range.min_x);
+    __m128d range_min_y = _mm_set1_pd(range.min_y);
+    __m128d range_max_x = _mm_set1_pd(range.max_x);
+    __m128d range_max_y = _mm_set1_pd(range.max_y);
+    
+    unsigned mask = 0;
+    for (std::size_t i = 0; i < RTREE_NODE_SIZE; i += 2) {
+        std::size_t child = first_child + i;
+        __m128d overlap_x = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(&min_xs[child]), range_max_x),
+                                       _mm_cmpge_pd(_mm_loadu_pd(&max_xs[child]), range_min_x));
+        __m128d overlap_y = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(&min_ys[child]), range_max_y),
+                                       _mm_cmpge_pd(_mm_loadu_pd(&max_ys[child]), range_min_y));
+        mask |= unsigned(_mm_movemask_pd(_mm_and_pd(overlap_x, overlap_y))) << i;
+    }
+    return mask;
+}
+
+#else
+
+unsigned PackedRTree::overlap_mask(std::size_t first_child, const RTreeBox &range) const {
+    return overlap_mask_scalar(first_child, range);
+}
+
+#endif
+
+
+unsigned PackedRTree::overlap_mask_scalar(std::size_t first_child, const RTreeBox &range) const {
+    unsigned mask = 0;
+    for (std::size_t i = 0; i < RTREE_NODE_SIZE; ++i) {
+        std::size_t child = first_child + i;
+        bool overlaps = min_xs[child] <= range.max_x && max_xs[child] >= range.min_x
+                && min_ys[child] <= range.max_y && max_ys[child] >= range.min_y;
+        mask |= unsigned(overlaps) << i;
+    }
+    return mask;
+}
+
+
+bool boxesOverlap(const RTreeBox &a, const RTreeBox &b) {
+    return (a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y);
+}
+
+
+// Walks down the quadrants from the largest, adding the cells in the quadrants passed
+// and rotating the point into the orientation of the curve inside the quadrant
+uint64_t hilbert_value(unsigned x, unsigned y) {
+    uint64_t value = 0;
+    
+    for (unsigned half = RTREE_HILBERT_SIZE / 2; half > 0; half /= 2) {
+        unsigned right = (x & half) > 0;
+        unsigned top = (y & half) > 0;
+        value += (uint64_t)half * half * ((3 * right) ^ top);
+        
+        if (top == 0) {
+            if (right == 1) {
+                x = RTREE_HILBERT_SIZE - 1 - x;
+                y = RTREE_HILBERT_SIZE - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return value;
+}
@@ -0,0 +1,140 @@
+/*
+ * File:   PackedRTree.h
+ *
+ * A static R-tree over bounding boxes, packed the same way as the Flatbush
+ * library. The boxes are sorted along a Hilbert curve through their centres and
+ * grouped RTREE_NODE_SIZE at a time into nodes, which are grouped again until one
+ * root is left. Every box and node is kept in flat arrays, the items first and
+ * then each level of nodes up to the root, so a query only follows indices.
+ *
+ * Each side of the boxes has its own array, and every level is padded with empty
+ * boxes to a whole number of nodes. The children of a node are then always
+ * RTREE_NODE_SIZE boxes in a row, which are compared with the range together in
+ * SIMD registers, giving a mask of the children to visit. The nodes above the
+ * items emit the ids in their mask directly instead of recursing into each item.
+ *
+ * Unlike KDTree, which only indexes points, a query finds every box that
+ * overlaps the range, even if none of its corners are in it.
+ *
+ */
+
+#pragma once //protects against multiple inclusions of this header file
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// Children of every node, except the last node of each level
+#define RTREE_NODE_SIZE 16
+
+// Cells of the grid the box centres are placed on along each axis
+#define RTREE_HILBERT_SIZE (1u << 16)
+
+// Box from (min_x, min_y) to (max_x, max_y)
+struct RTreeBox {
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+};
+
+class PackedRTree {
+    public:
+        PackedRTree();
+
+        // Builds the tree from boxes and their ids, replacing anything in the tree
+        void make_tree(const std::vector<std::pair<RTreeBox, unsigned int>> &items);
+
+        void clear();
+
+        std::size_t size() const { return num_items; }
+
+        // Calls visit(data_id) once for every box overlapping the range, including boxes only touching it.
+        // Nothing is allocated, and queries can run on several threads at once
+        template <typename Visitor>
+        void visit_range(const RTreeBox &range, Visitor &&visit) const;
+
+        // The same as visit_range, comparing the children with the range one at a time instead of
+        // in SIMD registers. Lets benchmark_kd2tree check both against a brute force search
+        template <typename Visitor>
+        void visit_range_scalar(const RTreeBox &range, Visitor &&visit) const;
+
+    private:
+        std::size_t num_items = 0;
+
+        // The items in Hilbert order, then each level of nodes, padded with empty boxes
+        std::vector<double> min_xs;
+        std::vector<double> min_ys;
+        std::vector<double> max_xs;
+        std::vector<double> max_ys;
+
+        std::vector<unsigned int> indices; // The id of each item, and the first child of each node
+        std::vector<std::size_t> level_ends; // Index one past the last box of each level, the items are level 0
+
+        // Adds a box with the index, and pads the level once it is done
+        void push_box(const RTreeBox &box, unsigned int index);
+        void pad_level();
+
+        // Bit i is set if child first_child + i overlaps the range
+        unsigned overlap_mask(std::size_t first_child, const RTreeBox &range) const;
+        unsigned overlap_mask_scalar(std::size_t first_child, const RTreeBox &range) const;
+
+        template <bool scalar, typename Visitor>
+        void visit_tree(const RTreeBox &range, Visitor &visit) const;
+
+        template <bool scalar, typename Visitor>
+        void visit_node(std::size_t node, std::size_t level, const RTreeBox &range, Visitor &visit) const;
+};
+
+bool boxesOverlap(const RTreeBox &a, const RTreeBox &b);
+
+// Position of (x, y) along a Hilbert curve through a 2^16 by 2^16 grid
+uint64_t hilbert_value(unsigned x, unsigned y);
+
+
+template <typename Visitor>
+void PackedRTree::visit_range(const RTreeBox &range, Visitor &&visit) const {
+    visit_tree<false>(range, visit);
+}
+
+
+template <typename Visitor>
+void PackedRTree::visit_range_scalar(const RTreeBox &range, Visitor &&visit) const {
+    visit_tree<true>(range, visit);
+}
+
+
+template <bool scalar, typename Visitor>
+void PackedRTree::visit_tree(const RTreeBox &range, Visitor &visit) const {
+    if (num_items == 0) return;
+
+    // The root is the last box, and has no parent to test it
+    std::size_t root = min_xs.size() - 1;
+    RTreeBox root_box = {min_xs[root], min_ys[root], max_xs[root], max_ys[root]};
+    if (!boxesOverlap(root_box, range)) return;
+
+    // A single item is its own root
+    if (level_ends.size() == 1) {
+        visit(indices[root]);
+        return;
+    }
+
+    visit_node<scalar>(root, level_ends.size() - 1, range, visit);
+}
+
+
+// Visits the children of a node, which is already known to overlap the range
+template <bool scalar, typename Visitor>
+void PackedRTree::visit_node(std::size_t node, std::size_t level, const RTreeBox &range, Visitor &visit) const {
+    // The children of a node are next to each other in the level below
+    std::size_t first_child = indices[node];
+    unsigned mask = scalar ? overlap_mask_scalar(first_child, range) : overlap_mask(first_child, range);
+
+    while (mask != 0) {
+        std::size_t child = first_child + __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if (level == 1) visit(indices[child]);
+        else visit_node<scalar>(child, level - 1, range, visit);
+    }
+}
@@ -20,6 +20,7 @@
  */
 #include "map_db.h"
 #include "m1.h"
+#include "m1_snap.h"
 #include "StreetsDatabaseAPI.h"
 #include "OSMDatabaseAPI.h"
 #include "OSMFetchers.h"
@@ -29,6 +30,7 @@
 #include <boost/algorithm/string.hpp>
 #include "helper_functions.h"
 #include <thread>
+#include <limits>
 
 //helper functions for multi threading loading of all the data
 //some are needed because of loading dependencies
@@ -192,24 +194,19 @@ std::vector<unsigned> find_all_street_intersections(unsigned street_id) {
 }
 
 
-//Returns all intersection ids between two streets
+//Returns all intersection ids between two streets, in order of id
+//pre-computed for every pair of streets in load_map for performance
 std::vector<unsigned> find_intersection_ids_from_street_ids(unsigned street_id1, 
                                                               unsigned street_id2) {
-    std::vector<unsigned> intersections;
+    //a street shares all of its intersections with itself
+    if (street_id1 == street_id2) return MAP.street_db[street_id1].intersections;
     
-    //goes through all intersections in a street
-    for (std::vector<unsigned>::iterator itx = MAP.street_db[street_id1].intersections.begin(); 
-            itx != MAP.street_db[street_id1].intersections.end(); itx++) {
-        
-        //goes through all intersections in the other street
-        for (std::vector<unsigned>::iterator ity = MAP.street_db[street_id2].intersections.begin(); 
-                ity != MAP.street_db[street_id2].intersections.end(); ity++) {
-            
-            if(*itx == *ity) intersections.push_back(*itx);
-        }
-    }
+    std::unordered_map<uint64_t, std::pair<unsigned, unsigned>>::const_iterator range =
+            MAP.street_pair_ranges.find(street_pair_key(street_id1, street_id2));
+    if (range == MAP.street_pair_ranges.end()) return {};
     
-    return intersections;
+    return std::vector<unsigned>(MAP.street_pair_intersections.begin() + range->second.first,
+                                 MAP.street_pair_intersections.begin() + range->second.second);
 }
 
 
@@ -256,33 +253,82 @@ double find_street_segment_travel_time(unsigned street_segment_id) {
 
 // Returns the id to the POI that is closest to the position that is passed
 unsigned find_closest_point_of_interest(LatLon my_position) {
-    double min_distance = -1;
-    POIIndex min_index = 0;
-    double distance_temp = 0;
-    // loop over every point of interest, calculating distance between each point of interest and my_position
-    for(int i = 0; i < getNumPointsOfInterest(); i++) {
-        distance_temp =  find_distance_between_two_points(my_position, getPointOfInterestPosition(i));
-        // keep track of minimum distance between points
-        if(distance_temp < min_distance || min_distance == -1) {
-            min_index = i;
-            min_distance = distance_temp;
-        }
-    }
-    return min_index;
+    std::vector<KD2Tree::Neighbour> candidates;
+    return find_closest_point_in_tree(MAP.poi_k2tree, getNumPointsOfInterest(), my_position, getPointOfInterestPosition, candidates);
 }
 
 
 // Returns the id to the intersection that is closest to the position that is passed
 unsigned find_closest_intersection(LatLon my_position) {
-    double min_distance = -1;
-    IntersectionIndex min_index = 0;
-    double distance_temp = 0;
-    // loop over every intersection, calculating distance between each intersection and my_position
-    for(int i = 0; i < getNumIntersections(); i++) {
-        distance_temp =  find_distance_between_two_points(my_position, getIntersectionPosition(i));
-        // keep track of minimum distance between points
-        if(distance_temp < min_distance || min_distance == -1) {
-            min_index = i;
+    std::vector<KD2Tree::Neighbour> candidates;
+    return find_closest_point_in_tree(MAP.intersection_k2tree, getNumIntersections(), my_position, getIntersectionPosition, candidates);
+}
+
+
+// Finds the closest point in the tree using find_distance_between_two_points, returning the
+// lowest id if several are as close, the same as checking every point in order would.
+// The tree uses the cos of the middle of the map for x instead of the cos of the average
+// latitude of the two points, so the nearest point in the tree is only a candidate. Every
+// point as close as it by find_distance_between_two_points is within a radius of it in
+// the tree, found from the smallest cos any point that close could use. The y of the tree is
+// the latitude in radians, so the points are also limited to the latitudes in the tree
+unsigned find_closest_point_in_tree(const KD2Tree &tree,
+                                    int num_points,
+                                    LatLon my_position,
+                                    LatLon (*point_position)(int),
+                                    std::vector<KD2Tree::Neighbour> &candidates) {
+    double search_x = x_from_lon(my_position.lon());
+    double search_y = y_from_lat(my_position.lat());
+    KD2Tree::Point search_point = {{float(search_x), float(search_y)}};
+    
+    tree.k_nearest(search_point, 1, KD_ALL_ZOOM_LEVELS, candidates);
+    if (candidates.empty()) return 0;
+    
+    unsigned min_index = candidates[0].data;
+    double min_distance = find_distance_between_two_points(my_position, point_position(min_index));
+    
+    // The tree rounds every coordinate to its coordinate type, so they can be off by this much
+    double largest_coordinate = std::max<double>({fabs(search_x), fabs(search_y),
+                                                  fabs(tree.min_point()[0]), fabs(tree.min_point()[1]),
+                                                  fabs(tree.max_point()[0]), fabs(tree.max_point()[1])});
+    double coordinate_error = 2 * std::numeric_limits<KD2Tree::coordinate_type>::epsilon() * largest_coordinate;
+    
+    // A point as close as the candidate is at most this far away in latitude, which bounds the
+    // average latitude of it and my_position
+    double max_lat_gap = min_distance / EARTH_RADIUS_IN_METERS;
+    double lowest_lat = std::max(search_y - max_lat_gap, double(tree.min_point()[1]) - coordinate_error);
+    double highest_lat = std::min(search_y + max_lat_gap, double(tree.max_point()[1]) + coordinate_error);
+    double farthest_avg_lat = std::max(fabs(search_y + lowest_lat), fabs(search_y + highest_lat)) / 2.0;
+    double min_cos = farthest_avg_lat < M_PI / 2.0 ? cos(farthest_avg_lat) : 0;
+    double map_cos = cos((MAP.world_values.max_lat + MAP.world_values.min_lat) / 2.0 * DEG_TO_RAD);
+    
+    // Larger by the rounding of the search point and the points in the tree, so none at the same
+    // distance are left out. Too close to a pole the radius can't be bounded
+    bool is_radius_bounded = min_cos > 0;
+    double radius = 0;
+    if (is_radius_bounded) radius = max_lat_gap * std::max(1.0, map_cos / min_cos) * (1 + 1e-9) + 4 * coordinate_error + 1e-12;
+    
+    // Far from the map (or without a bound) the radius covers every point, so they are checked in
+    // order without the tree
+    double farthest_x = std::max(fabs(search_point[0] - tree.min_point()[0]), fabs(search_point[0] - tree.max_point()[0]));
+    double farthest_y = std::max(fabs(search_point[1] - tree.min_point()[1]), fabs(search_point[1] - tree.max_point()[1]));
+    if (!is_radius_bounded || farthest_x * farthest_x + farthest_y * farthest_y <= radius * radius) {
+        for (int i = 0; i < num_points; i++) {
+            double distance_temp = find_distance_between_two_points(my_position, point_position(i));
+            if (distance_temp < min_distance || (distance_temp == min_distance && unsigned(i) < min_index)) {
+                min_index = i;
+                min_distance = distance_temp;
+            }
+        }
+        return min_index;
+    }
+    
+    tree.radius_query(search_point, radius, KD_ALL_ZOOM_LEVELS, candidates);
+    for (const KD2Tree::Neighbour &candidate : candidates) {
+        double distance_temp = find_distance_between_two_points(my_position, point_position(candidate.data));
+        // keep track of minimum distance between points, ties go to the lowest id
+        if (distance_temp < min_distance || (distance_temp == min_distance && candidate.data < min_index)) {
+            min_index = candidate.data;
             min_distance = distance_temp;
         }
     }
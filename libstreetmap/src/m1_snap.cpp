@@ -0,0 +1,182 @@
+/*
+ * Snaps positions to the closest intersections and street segments in batches.
+ * Nearby positions are taken one after another, so they find the same nodes of
+ * the trees in the cache, and every thread keeps its own buffers for the points
+ * found so nothing is allocated for each position
+ */
+
+#include "m1_snap.h"
+#include "m1.h"
+#include "map_db.h"
+#include "helper_functions.h"
+#include "PackedRTree.h"
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+// Positions handed to a thread at a time, in Hilbert order
+#define SNAP_CHUNK_SIZE 64
+
+// Closest street segment to the position, only checking the segments near its closest intersection.
+// segment_ids holds the segments found, and can be reused between calls
+SegmentSnap closest_street_segment(LatLon position,
+                                   unsigned closest_intersection,
+                                   double map_cos,
+                                   std::vector<unsigned> &segment_ids);
+
+
+void snap_positions(const std::vector<LatLon> &positions,
+                    std::vector<unsigned> &intersection_ids,
+                    std::vector<SegmentSnap> *segments) {
+    intersection_ids.assign(positions.size(), 0);
+    if (segments != nullptr) segments->assign(positions.size(), SegmentSnap());
+
+    std::vector<unsigned> order;
+    hilbert_order(positions, order);
+
+    double map_cos = cos((MAP.world_values.max_lat + MAP.world_values.min_lat) / 2.0 * DEG_TO_RAD);
+
+    #pragma omp parallel
+    {
+        // Reused by every position this thread snaps
+        std::vector<KD2Tree::Neighbour> candidates;
+        std::vector<unsigned> segment_ids;
+
+        #pragma omp for schedule(dynamic, SNAP_CHUNK_SIZE)
+        for (std::size_t k = 0; k < order.size(); ++k) {
+            unsigned i = order[k];
+            intersection_ids[i] = find_closest_point_in_tree(MAP.intersection_k2tree, getNumIntersections(),
+                                                             positions[i], getIntersectionPosition, candidates);
+
+            if (segments != nullptr) {
+                (*segments)[i] = closest_street_segment(positions[i], intersection_ids[i], map_cos, segment_ids);
+            }
+        }
+    }
+}
+
+
+// An intersection is on every segment it has, so the closest segment is no farther than the
+// first segment of the closest intersection. Every segment that close has a bounding box
+// overlapping a box of that distance around the position in the R-trees, whose x uses the
+// cos of the middle of the map instead of the cos of the position
+SegmentSnap closest_street_segment(LatLon position,
+                                   unsigned closest_intersection,
+                                   double map_cos,
+                                   std::vector<unsigned> &segment_ids) {
+    SegmentSnap best = {0, 0, position, std::numeric_limits<double>::max()};
+    SegmentSnap snap;
+
+    double cos_lat = cos(position.lat() * DEG_TO_RAD);
+    bool bounded = cos_lat > 0 && getNumIntersections() > 0 && getIntersectionStreetSegmentCount(closest_intersection) > 0;
+
+    // Without a segment at the closest intersection, or too close to a pole, every segment is checked
+    if (!bounded) {
+        for (int i = 0; i < getNumStreetSegments(); i++) {
+            double distance = distance_to_street_segment(position, i, snap);
+            if (distance < best.distance) best = snap;
+        }
+        return best;
+    }
+
+    double max_distance = distance_to_street_segment(position, getIntersectionStreetSegment(0, closest_intersection), snap);
+    double half_height = max_distance / EARTH_RADIUS_IN_METERS * (1 + 1e-9) + 1e-12;
+    double half_width = half_height * map_cos / cos_lat;
+
+    double x = x_from_lon(position.lon());
+    double y = y_from_lat(position.lat());
+    RTreeBox range = {x - half_width, y - half_height, x + half_width, y + half_height};
+
+    segment_ids.clear();
+    for (const PackedRTree &tree : MAP.street_seg_rtrees) {
+        tree.visit_range(range, [&](unsigned int id) { segment_ids.push_back(id); });
+    }
+
+    // Ties go to the lowest id
+    for (unsigned id : segment_ids) {
+        double distance = distance_to_street_segment(position, id, snap);
+        if (distance < best.distance || (distance == best.distance && id < best.segment_id)) best = snap;
+    }
+    return best;
+}
+
+
+// Measures every part of the segment between its curve points in meters east and north of the
+// position, where the closest point of a part is where the position projects onto it
+double distance_to_street_segment(LatLon position, unsigned segment_id, SegmentSnap &snap) {
+    InfoStreetSegment segment = getInfoStreetSegment(segment_id);
+    double meters_per_lat = DEG_TO_RAD * EARTH_RADIUS_IN_METERS;
+    double meters_per_lon = meters_per_lat * cos(position.lat() * DEG_TO_RAD);
+
+    snap.segment_id = segment_id;
+    snap.distance = std::numeric_limits<double>::max();
+
+    LatLon start = getIntersectionPosition(segment.from);
+    double start_x = (start.lon() - position.lon()) * meters_per_lon;
+    double start_y = (start.lat() - position.lat()) * meters_per_lat;
+    double length = 0;
+    double along = 0;
+
+    for (int j = 0; j <= segment.curvePointCount; j++) {
+        LatLon end = j < segment.curvePointCount ? getStreetSegmentCurvePoint(j, segment_id) : getIntersectionPosition(segment.to);
+        double end_x = (end.lon() - position.lon()) * meters_per_lon;
+        double end_y = (end.lat() - position.lat()) * meters_per_lat;
+
+        double part_x = end_x - start_x;
+        double part_y = end_y - start_y;
+        double part_squared = part_x * part_x + part_y * part_y;
+
+        // Share of the part before the closest point, the position is the origin
+        double share = 0;
+        if (part_squared > 0) share = std::min(1.0, std::max(0.0, -(start_x * part_x + start_y * part_y) / part_squared));
+
+        double closest_x = start_x + share * part_x;
+        double closest_y = start_y + share * part_y;
+        double distance = sqrt(closest_x * closest_x + closest_y * closest_y);
+        double part_length = sqrt(part_squared);
+
+        if (distance < snap.distance) {
+            snap.distance = distance;
+            along = length + share * part_length;
+            snap.position = LatLon(start.lat() + share * (end.lat() - start.lat()),
+                                   start.lon() + share * (end.lon() - start.lon()));
+        }
+
+        length += part_length;
+        start = end;
+        start_x = end_x;
+        start_y = end_y;
+    }
+
+    snap.along = length > 0 ? along / length : 0;
+    return snap.distance;
+}
+
+
+void hilbert_order(const std::vector<LatLon> &positions, std::vector<unsigned> &order) {
+    order.resize(positions.size());
+    if (positions.empty()) return;
+
+    double min_lat = positions[0].lat(), max_lat = positions[0].lat();
+    double min_lon = positions[0].lon(), max_lon = positions[0].lon();
+    for (const LatLon &position : positions) {
+        min_lat = std::min<double>(min_lat, position.lat());
+        max_lat = std::max<double>(max_lat, position.lat());
+        min_lon = std::min<double>(min_lon, position.lon());
+        max_lon = std::max<double>(max_lon, position.lon());
+    }
+
+    // Sorted by Hilbert value then index, so the order is the same every time
+    std::vector<std::pair<uint64_t, unsigned>> keys(positions.size());
+    for (unsigned i = 0; i < positions.size(); ++i) {
+        unsigned x = max_lon > min_lon ? unsigned((RTREE_HILBERT_SIZE - 1) * (positions[i].lon() - min_lon) / (max_lon - min_lon)) : 0;
+        unsigned y = max_lat > min_lat ? unsigned((RTREE_HILBERT_SIZE - 1) * (positions[i].lat() - min_lat) / (max_lat - min_lat)) : 0;
+        keys[i] = std::make_pair(hilbert_value(x, y), i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (unsigned i = 0; i < keys.size(); ++i) {
+        order[i] = keys[i].second;
+    }
+}
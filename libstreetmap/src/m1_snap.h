@@ -0,0 +1,40 @@
+/*
+ * Snaps many positions at once, such as GPS pings, to the closest intersections
+ * and street segments
+ */
+
+#pragma once //protects against multiple inclusions of this header file
+
+#include "StreetsDatabaseAPI.h"
+#include "KDTree.h"
+#include <vector>
+
+// The closest point of a street segment to a position
+struct SegmentSnap {
+    unsigned segment_id;
+    double along; // Share of the length of the segment from its from intersection to the closest point, from 0 to 1
+    LatLon position; // The closest point on the segment
+    double distance; // From the snapped position to the closest point, in meters
+};
+
+// Finds the closest intersection to each position, the same as find_closest_intersection would.
+// If segments isn't null it also gets the closest street segment to each position.
+// The positions are taken in order along a Hilbert curve through them, split between the threads
+void snap_positions(const std::vector<LatLon> &positions,
+                    std::vector<unsigned> &intersection_ids,
+                    std::vector<SegmentSnap> *segments = nullptr);
+
+// Finds the closest point of the street segment to the position, measured in meters on a flat map
+// centred on the position. Returns the distance, and sets snap to the closest point
+double distance_to_street_segment(LatLon position, unsigned segment_id, SegmentSnap &snap);
+
+// Finds the closest point in the tree using find_distance_between_two_points, see m1.cpp.
+// The points found in the tree are put in candidates, which can be reused between calls
+unsigned find_closest_point_in_tree(const KD2Tree &tree,
+                                    int num_points,
+                                    LatLon my_position,
+                                    LatLon (*point_position)(int),
+                                    std::vector<KD2Tree::Neighbour> &candidates);
+
+// Indices of the positions in order along a Hilbert curve through their bounding box
+void hilbert_order(const std::vector<LatLon> &positions, std::vector<unsigned> &order);
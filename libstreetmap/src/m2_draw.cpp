@@ -8,6 +8,9 @@
 #include "m2_draw.h"
 #include "ezgl/application.hpp"
 #include "ezgl/graphics.hpp"
+#include <vector>
+#include <string>
+#include <algorithm>
 
 
 // Draws the last highlighted intersection stored in MAP
@@ -26,24 +29,22 @@ void draw_selected_intersection (ezgl::renderer &g) {
 }
 
 
-// Queries street_seg_k2tree for the given zoom level to get the ids of all the
+// Queries street_seg_rtrees for the given zoom level to get the ids of all the
 // segments that are current view. Then loops over the ids, drawing each curves
 void draw_street_segments (ezgl::renderer &g) {    
     
-    std::map<unsigned int, std::pair<double, double>> result_ids;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> result_points;
+    // Kept between frames so the ids don't need a new allocation every time
+    static std::vector<unsigned int> result_ids;
+    result_ids.clear();
+    
+    find_ids_in_view(MAP.street_seg_rtrees, result_ids);
     
-    MAP.street_seg_k2tree.range_query(MAP.street_seg_k2tree.root, // root
-                         0, // depth of query
-                         std::make_pair(MAP.state.current_view_x_buffered.first, MAP.state.current_view_x_buffered.second), // x-range (smaller, greater)
-                         std::make_pair(MAP.state.current_view_y_buffered.first, MAP.state.current_view_y_buffered.second), // y-range (smaller, greater)
-                         result_points, // results
-                         result_ids,
-                         MAP.state.zoom_level, 0); // zoom_level
+    // Drawn in order of id
+    std::sort(result_ids.begin(), result_ids.end());
     
-    for(std::map<unsigned int, std::pair<double, double>>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
+    for(std::vector<unsigned int>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
         
-        int id = it->first;
+        int id = *it;
         g.set_color(ezgl::WHITE);
         
         //load all LatLon of points into a vector for the draw_curve helper function
@@ -100,9 +101,6 @@ void draw_street_segments (ezgl::renderer &g) {
             }
         }
     }
-    
-    result_ids.clear();
-    result_points.clear();
 }
 
 // Draw the street segments of global route twice to draw a border around the route
@@ -188,20 +186,18 @@ void draw_route_start_end (ezgl::renderer &g) {
 // street segments for this view and draw them
 void draw_street_name(ezgl::renderer &g) {
     
-    std::map<unsigned int, std::pair<double, double>> result_ids;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> result_points;
+    // Kept between frames so the ids don't need a new allocation every time
+    static std::vector<unsigned int> result_ids;
+    result_ids.clear();
+    
+    find_ids_in_view(MAP.street_seg_rtrees, result_ids);
     
-    MAP.street_seg_k2tree.range_query(MAP.street_seg_k2tree.root, // root
-                         0, // depth of query
-                         std::make_pair(MAP.state.current_view_x_buffered.first, MAP.state.current_view_x_buffered.second), // x-range (smaller, greater)
-                         std::make_pair(MAP.state.current_view_y_buffered.first, MAP.state.current_view_y_buffered.second), // y-range (smaller, greater)
-                         result_points, // results
-                         result_ids,
-                         MAP.state.zoom_level, 0); // zoom_level
+    // Drawn in order of id
+    std::sort(result_ids.begin(), result_ids.end());
     
-    for(std::map<unsigned int, std::pair<double, double>>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
+    for(std::vector<unsigned int>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
 
-        int i = it->first;
+        int i = *it;
         
         // Set middle of text, accounting for potential curve points
         //load all LatLon of points into a vector for the draw_curve helper function
@@ -237,44 +233,39 @@ void draw_street_name(ezgl::renderer &g) {
         }
         points.clear();
     }
-    
-    result_ids.clear();
-    result_points.clear();
 }
 
 
-// Uses a range query based on the current view and zoom level to find
-// the POIs only up to a calculated search_depth, which declusters the POIs
-// by only going a certain depth into the k2tree
+// Uses a range query based on the current view to find the POI clusters of the
+// zoom level in view, which were made when loading the map, and draws the POI
+// representing each one with the number of POIs in it. Once zoomed in close
+// enough every POI in view is drawn.
 // Also draws street names
 void draw_points_of_interest (ezgl::renderer &g) {
-    std::map<unsigned int, std::pair<double, double>> result_ids;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> result_points;
+    // Kept between frames so the results don't need a new allocation every time.
+    // The id of the POI drawn and the number of POIs it stands for
+    static std::vector<std::pair<unsigned int, unsigned int>> results;
+    results.clear();
     
     ezgl::surface *poi_png = g.load_png("./libstreetmap/resources/IntersectionIcon.png");
-    // Decide what level of POI detail to show based on zoom level
-    std::size_t search_depth = 0;
-    if(MAP.state.zoom_level > 3) {
-        if(MAP.state.current_width >= 500) search_depth = 10;
-        else search_depth = 0;
-    } else if(MAP.state.zoom_level > 2) {
-        search_depth = 8;
-    }  else if(MAP.state.zoom_level > 1) {
-        search_depth = 6;
-    } else  if(MAP.state.zoom_level > 0) {
-        search_depth = 4;
+    
+    KD2Tree::Point low = {{float(MAP.state.current_view_x_buffered.first), float(MAP.state.current_view_y_buffered.first)}};
+    KD2Tree::Point high = {{float(MAP.state.current_view_x_buffered.second), float(MAP.state.current_view_y_buffered.second)}};
+    if(MAP.state.zoom_level > 3 && MAP.state.current_width < 500) {
+        MAP.poi_k2tree.visit_range(low, high, KD_ALL_ZOOM_LEVELS, 0,
+                                   [](unsigned int id, const KD2Tree::Point &) { results.push_back(std::make_pair(id, 1)); });
     } else {
-        search_depth = 1;
+        int level = std::max(0, std::min(NUM_POI_CLUSTER_LEVELS - 1, MAP.state.zoom_level - MIN_DRAW_ZOOM_LEVEL));
+        const std::vector<PoiCluster> &clusters = MAP.poi_clusters[level];
+        MAP.poi_cluster_k2trees[level].visit_points(low, high, KD_ALL_ZOOM_LEVELS, [&](unsigned int c, const KD2Tree::Point &) {
+            results.push_back(std::make_pair(clusters[c].representative, clusters[c].count));
+        });
     }
-    MAP.poi_k2tree.range_query(MAP.poi_k2tree.root, // root
-                         0, // depth of query
-                         std::make_pair(MAP.state.current_view_x_buffered.first, MAP.state.current_view_x_buffered.second), // x-range (smaller, greater)
-                         std::make_pair(MAP.state.current_view_y_buffered.first, MAP.state.current_view_y_buffered.second), // y-range (smaller, greater)
-                         result_points, // results
-                         result_ids,
-                         MAP.state.zoom_level, search_depth); // zoom_level
+    
+    // Drawn in order of id
+    std::sort(results.begin(), results.end());
             
-    for(std::map<unsigned int, std::pair<double, double>>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
+    for(std::vector<std::pair<unsigned int, unsigned int>>::iterator it = results.begin(); it != results.end(); it++) { 
         
         int i = it->first;
 
@@ -283,6 +274,13 @@ void draw_points_of_interest (ezgl::renderer &g) {
         std::string poi_name = getPointOfInterestName(i);
 
         g.draw_surface(poi_png, png_draw_center_point(g, ezgl::point2d(x,y), 24));
+        
+        // Clusters show how many POIs they stand for
+        if (it->second > 1) {
+            g.set_color(ezgl::SADDLE_BROWN);
+            g.set_text_rotation(0);
+            g.draw_text(ezgl::point2d(x,y), std::to_string(it->second), 100, 100);
+        }
 
         // Display text differently at different scale level
         if (MAP.state.scale > 130 && (i % 3  == 0)) {
@@ -297,52 +295,27 @@ void draw_points_of_interest (ezgl::renderer &g) {
             else g.draw_text(ezgl::point2d(x,y+0.0000005),poi_name, 100, 100);
         }
     }
-    result_ids.clear();
-    result_points.clear();
     
     g.free_surface(poi_png);
 }
 
 
-// Uses a range query to find the features that have points in the current view,
-// if no features are found, sets range to max bounds (for inside very large features),
-// and also adds all permanent features, ie features that intersect the outerbounds.
-// The permanent features account for large features such as an ocean surrounding an island.
+// Uses a range query to find the features whose bounding box overlaps the current view,
+// which includes large features the view is inside of, such as an ocean surrounding an island.
+// Features that intersect the outerbounds of the map are drawn at every zoom level
 void draw_features (ezgl::renderer &g) {
-    std::map<unsigned int, std::pair<double, double>> result_ids;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> result_points;
+    // Kept between frames so the ids don't need a new allocation every time
+    static std::vector<unsigned int> result_ids;
+    result_ids.clear();
     
-    MAP.feature_k2tree.range_query(MAP.feature_k2tree.root, // root
-                         0, // depth of query
-                         std::make_pair(MAP.state.current_view_x_buffered.first, MAP.state.current_view_x_buffered.second), // x-range (smaller, greater)
-                         std::make_pair(MAP.state.current_view_y_buffered.first, MAP.state.current_view_y_buffered.second), // y-range (smaller, greater)
-                         result_points, // results
-                         result_ids,
-                         MAP.state.zoom_level, 0);
+    find_ids_in_view(MAP.feature_rtrees, result_ids);
     
-    // fix for very viewing inside very large features
-    if (result_ids.size() < 1) {
-        
-        result_ids.clear();
-        result_points.clear();
-
-        MAP.feature_k2tree.range_query(MAP.feature_k2tree.root, // root
-                         0, // depth of query
-                         std::make_pair(x_from_lon(MAP.world_values.min_lon), x_from_lon(MAP.world_values.max_lon)), // x-range (smaller, greater)
-                         std::make_pair( y_from_lat(MAP.world_values.min_lat), y_from_lat(MAP.world_values.max_lat)), // y-range (smaller, greater)
-                         result_points, // results
-                         result_ids,
-                         MAP.state.zoom_level, 0); // zoom_level
-        
-    }
-    
-    for(std::vector<unsigned int>::iterator it = MAP.permanent_features.begin(); it != MAP.permanent_features.end(); it++) {
-        result_ids.insert(std::make_pair((*it), std::make_pair(0.0, 0.0)));
-    }
+    // Filled in order of id, so features later in the map data are drawn on top
+    std::sort(result_ids.begin(), result_ids.end());
     
-    for(std::map<unsigned int, std::pair<double, double>>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
+    for(std::vector<unsigned int>::iterator it = result_ids.begin(); it != result_ids.end(); it++) { 
 
-        int i = it->first;
+        int i = *it;
         
         std::vector<ezgl::point2d> feature_points;
         
@@ -383,9 +356,6 @@ void draw_features (ezgl::renderer &g) {
             draw_curve(g, points);
         }
     }
-    
-    result_ids.clear();
-    result_points.clear();
 }
 
 
@@ -416,9 +386,12 @@ void draw_subway_data(ezgl::renderer &g){
 }
 
 // Draws bike data including all bike paths and some of the bike parking, depending
-// on the zoom_level. Does not use KD2Tree since this is generally a smaller
-// dataset.
+// on the zoom_level. Only the bike parking in view is drawn, found with its tree
 void draw_bike_data(ezgl::renderer &g) {
+    // Kept between frames so the ids don't need a new allocation every time
+    static std::vector<unsigned int> result_ids;
+    result_ids.clear();
+    
     g.set_color(ezgl::BIKE_GREEN);
     g.set_line_width(1);
     
@@ -439,9 +412,19 @@ void draw_bike_data(ezgl::renderer &g) {
         default: skip_factor = 1;
     }
     if(skip_factor < 1) skip_factor = 1;
-    //draw bike parking
-    for(unsigned i = 0; i < MAP.OSM_data.bike_parking.size(); i+= skip_factor) {       
-        g.draw_surface(parking_png, png_draw_center_point(g, MAP.OSM_data.bike_parking[i], 16));
+    
+    //draw the same bike parking as skipping through all of it, but only where it is in view
+    DynamicKD2Tree::Point low = {{float(MAP.state.current_view_x_buffered.first), float(MAP.state.current_view_y_buffered.first)}};
+    DynamicKD2Tree::Point high = {{float(MAP.state.current_view_x_buffered.second), float(MAP.state.current_view_y_buffered.second)}};
+    MAP.OSM_data.bike_parking_tree.visit_range(low, high, [&](unsigned int id, const DynamicKD2Tree::Point &) {
+        if(id % unsigned(skip_factor) == 0) result_ids.push_back(id);
+    });
+    
+    // Drawn in order of id
+    std::sort(result_ids.begin(), result_ids.end());
+    
+    for(unsigned int id : result_ids) {
+        g.draw_surface(parking_png, png_draw_center_point(g, MAP.OSM_data.bike_parking[id], 16));
     }
     
     g.free_surface(parking_png);
@@ -544,3 +527,15 @@ void draw_curve(ezgl::renderer &g, std::vector<ezgl::point2d> &points) {
         g.draw_line(points[i], points[i+1]);
     }
 }
+
+
+// Adds the ids of every box in the current view from the trees drawn at the current zoom level.
+// Each id is only in one tree, so none are repeated
+void find_ids_in_view(const std::vector<PackedRTree> &trees, std::vector<unsigned int> &result_ids) {
+    RTreeBox view = {MAP.state.current_view_x.first, MAP.state.current_view_y.first,
+                     MAP.state.current_view_x.second, MAP.state.current_view_y.second};
+    
+    for (int z = 0; z < int(trees.size()) && z + MIN_DRAW_ZOOM_LEVEL <= MAP.state.zoom_level; z++) {
+        trees[z].visit_range(view, [&](unsigned int id) { result_ids.push_back(id); });
+    }
+}
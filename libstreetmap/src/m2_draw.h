@@ -3,13 +3,15 @@
  */
 
 #include "ezgl/graphics.hpp"
+#include "PackedRTree.h"
+#include <vector>
 
 #pragma once 
 
 // Draws the last highlighted intersection stored in MAP
 void draw_selected_intersection (ezgl::renderer &g);
 
-// Queries street_seg_k2tree for the given zoom level to get the ids of all the
+// Queries street_seg_rtrees for the given zoom level to get the ids of all the
 // segments that are current view. Then loops over the ids, drawing each curves
 void draw_street_segments (ezgl::renderer &g);
 
@@ -29,10 +31,9 @@ void draw_street_name(ezgl::renderer &g);
 // Also draws street names
 void draw_points_of_interest (ezgl::renderer &g);
 
-// Uses a range query to find the features that have points in the current view,
-// if no features are found, sets range to max bounds (for inside very large features),
-// and also adds all permanent features, ie features that intersect the outerbounds.
-// The permanent features account for large features such as an ocean surrounding an island.
+// Uses a range query to find the features whose bounding box overlaps the current view,
+// which includes large features the view is inside of, such as an ocean surrounding an island.
+// Features that intersect the outerbounds of the map are drawn at every zoom level
 void draw_features (ezgl::renderer &g);
 
 // Draws subway data for all of the routes and  subway stops. Subways stops
@@ -57,3 +58,5 @@ void draw_instruction_points(ezgl::renderer &g);
 // Draws the instruction popup
 void draw_instruction_popup(ezgl::renderer &g);
 
+// Adds the ids of every box in the current view from the trees drawn at the current zoom level
+void find_ids_in_view(const std::vector<PackedRTree> &trees, std::vector<unsigned int> &result_ids);
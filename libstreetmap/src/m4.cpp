@@ -4,6 +4,15 @@
 
 #include "m4.h"
 #include "m3.h"
+#include "m4_courier.h"
+#include "m4_construction.h"
+#include "m4_exact.h"
+#include "m4_sparse.h"
+#include "m4_anneal.h"
+#include "m4_memetic.h"
+#include "m4_windows.h"
+#include "m4_row_cache.h"
+#include "m4_stats.h"
 #include "constants.hpp"
 #include "map_db.h"
 #include <vector>
@@ -16,116 +25,27 @@
 #include <omp.h>
 
 
-#define NO_ROUTE std::numeric_limits<unsigned>::max()
-
-enum stop_type {PICK_UP, DROP_OFF};
-
 //for fast random number generator
 static uint64_t mcg_state;
 static uint64_t const multiplier = 6364136223846793005u;
 
 #define TIME_LIMIT 40
-#define NO_ROUTE std::numeric_limits<unsigned>::max()
 
-struct RouteStop {
-    //used for the route to accelerate mutations
-    
-    RouteStop()
-        : intersection_id(0), 
-          delivery_index(0), 
-          type(PICK_UP) {};
-    
-    RouteStop(unsigned _intersection_id, int _delivery_index, stop_type _type)
-        : intersection_id(_intersection_id), 
-          delivery_index(_delivery_index), 
-          type(_type){};
-    
-    //the intersection id
-    unsigned intersection_id;
-    
-    //the index of the stop in the deliveries vector
-    int delivery_index;
-    
-    //whether this stop is a pickUp
-    stop_type type;
-};
+// Base seed of the threads, negative to seed from rand()
+static long long courier_seed = -1;
 
 //fast random number generator and values needed for it, use unused attribute to suppress warnings
 extern uint64_t mcg_state;
-uint32_t pcg32_fast() __attribute__ ((hot));
-
-//initialize fast random number generator
-void pcg32_fast_init(uint64_t seed);
-
-void multi_dest_dijkistra(
-		  const unsigned intersect_id_start, 
-                  const unsigned row_index,
-                  std::vector<Node*> &intersection_nodes,
-                  std::vector<unsigned> dests,
-                  const float right_turn_penalty, 
-                  const float left_turn_penalty
-); 
 
 void clear_intersection_nodes(std::vector<Node*> &intersection_nodes);
 
-bool check_legal_simple(
-        std::vector<RouteStop> &route, 
-        std::vector<bool> &is_in_truck, 
-        const std::vector<DeliveryInfo>& deliveries, 
-        float capacity
+void store_predecessors(
+        Node* dest_node,
+        const unsigned intersect_id_start,
+        std::vector<Node*> &intersection_nodes,
+        std::unordered_map<unsigned, int> &predecessors
 );
 
-void build_route(
-        std::vector<RouteStop> &simple_route,
-        std::vector<CourierSubpath> &complete_route,
-        const float right_turn_penalty, 
-        const float left_turn_penalty 
-);
-
-
-double add_closest_depots_to_route(
-        std::vector<RouteStop> &simple_route,
-        const std::vector<unsigned>& depots
-);
-
-bool validate_route(std::vector<RouteStop> &route, 
-        double &time,
-        std::vector<bool> &is_in_truck, 
-        const std::vector<DeliveryInfo>& deliveries, 
-        const float &capacity
-) __attribute__ ((hot));
-
-//returns time of route
-double get_route_time(std::vector<RouteStop> &route);
-
-std::pair<unsigned, unsigned> random_swap(std::vector<RouteStop> &route);
-
-void two_opt_swap_annealing(std::vector<RouteStop> &route,
-                         double run_time,
-                         std::vector<bool> &is_in_truck, 
-                         const std::vector<DeliveryInfo>& deliveries, 
-                         float capacity,
-                         int annealing);
-
-void two_opt_swap_annealing_temp(std::vector<RouteStop> &route,
-                         double &min_time,
-                         std::vector<bool> &is_in_truck, 
-                         const std::vector<DeliveryInfo>& deliveries, 
-                         const float &capacity,
-                         float &temp
-)  __attribute__ ((hot, flatten));
-
-std::pair<int, int> random_edge_swap(std::vector<RouteStop> &route) __attribute__ ((hot));
-
-void reverse_vector(std::vector<RouteStop> &route, int &edge1, int &edge2) __attribute__ ((hot));
-
-void find_greedy_path(const std::vector<unsigned> &destinations,
-                      const std::vector<DeliveryInfo>& deliveries,
-                      std::vector<RouteStop> &route,
-                      const float truck_capacity,
-                      float priority_weight,
-                      int starting_index);
-
 //////////////////////////////////////////////////////////////////////////
 //Start of functions
 std::vector<CourierSubpath> traveling_courier(
@@ -134,15 +54,52 @@ std::vector<CourierSubpath> traveling_courier(
 		const float right_turn_penalty, 
 		const float left_turn_penalty, 
 		const float truck_capacity) 
+{
+    return traveling_courier(deliveries, depots, right_turn_penalty, left_turn_penalty, truck_capacity, CourierOptions());
+}
+
+
+std::vector<CourierSubpath> traveling_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const float truck_capacity,
+        const CourierOptions &options)
 {
     auto startTime = std::chrono::high_resolution_clock::now();
-    bool timeOut = false;
+    auto phaseStart = startTime;
+    reset_courier_stats(options.mode);
+    const double time_limit = options.time_limit > 0 ? options.time_limit : TIME_LIMIT;
+
+    // Windows are looked up by matrix index, so a list that doesn't match the deliveries can't be used
+    if (!options.windows.empty() && options.windows.size() != deliveries.size()) {
+        MAP.courier.stats.total_time = lap_seconds(phaseStart);
+        return std::vector<CourierSubpath>();
+    }
+
+    // The full matrix doesn't fit for large instances, so only the closest stops are searched for.
+    // Time windows need the time between every pair of stops, so they always use the full matrix
+    if (deliveries.size() >= SPARSE_MIN_DELIVERIES && options.windows.empty()) {
+        std::vector<CourierSubpath> sparse_route = sparse_traveling_courier(deliveries, depots,
+                right_turn_penalty, left_turn_penalty, truck_capacity, time_limit);
+        
+        MAP.courier.stats.mode = "sparse";
+        MAP.courier.stats.total_time = lap_seconds(phaseStart);
+        return sparse_route;
+    }
 
     //Clean and resize the 2D matrix to appropriate size
     MAP.courier.time_between_deliveries.clear();
     MAP.courier.time_between_deliveries.assign(deliveries.size() * 2  + depots.size(), 
     std::vector<unsigned>(deliveries.size() * 2, NO_ROUTE));
     
+    //Keep the search trees of every row so the final legs don't need to be searched again
+    MAP.courier.predecessor_edges.clear();
+    MAP.courier.predecessor_edges.resize(deliveries.size() * 2  + depots.size());
+    MAP.courier.successor_edges.clear();
+    MAP.courier.successor_rows.clear();
+    
     // The destinations alternate between pickup and dropoff;
     // To access certain pickup: index * 2
     // To access certain dropoff: index * 2 + 1
@@ -155,6 +112,19 @@ std::vector<CourierSubpath> traveling_courier(
     std::vector<RouteStop> best_route;
     double best_time = std::numeric_limits<double>::max();
     
+    // The best routes built by each thread, sorted by time once all are done, and
+    // the routes found when none could be built
+    std::vector<std::pair<double, std::vector<RouteStop>>> seed_routes;
+    std::vector<std::pair<double, std::vector<RouteStop>>> fallback_routes;
+    
+    // The insertion strategies give up past this, so every thread is left time to optimize
+    std::chrono::high_resolution_clock::time_point constructionDeadline;
+    
+    // Small instances are solved exactly, then no thread needs to optimize
+    std::vector<RouteStop> exact_route;
+    double exact_time = 0;
+    bool exact_solved = false;
+    
     //each thread needs its own mcg_state for random number generation
     #pragma omp threadprivate(mcg_state)
     #pragma omp parallel
@@ -162,7 +132,7 @@ std::vector<CourierSubpath> traveling_courier(
         mcg_state = 0xcafef00dd15ea5e5u; // Must be odd, used for fast random 
         
         //initialize fast random number generator
-        pcg32_fast_init(rand());
+        pcg32_fast_init(thread_seed());
         
         //initiallize a node vector for each thread
         std::vector<Node*> intersection_nodes;
@@ -175,7 +145,8 @@ std::vector<CourierSubpath> traveling_courier(
         #pragma omp for
         for (unsigned i = 0; i < destinations.size(); ++i) {
             multi_dest_dijkistra(destinations[i], i, intersection_nodes, 
-                    destinations, right_turn_penalty, left_turn_penalty);
+                    destinations, right_turn_penalty, left_turn_penalty, 
+                    &MAP.courier.predecessor_edges[i]);
         }
         
         
@@ -183,7 +154,8 @@ std::vector<CourierSubpath> traveling_courier(
         // Add depots to all pickup/dropoff location time to the vector
         for (unsigned i = 0; i < depots.size(); ++i) {
             multi_dest_dijkistra(depots[i], i + destinations.size(), intersection_nodes, 
-                    destinations, right_turn_penalty, left_turn_penalty);
+                    destinations, right_turn_penalty, left_turn_penalty,
+                    &MAP.courier.predecessor_edges[i + destinations.size()]);
         }
         
         
@@ -194,102 +166,89 @@ std::vector<CourierSubpath> traveling_courier(
         
         //wait for multi_dest_dijkstras to be done
         #pragma omp barrier
-
         
-        //Start optimizations with simulated annealing
+        #pragma omp single
+        {
+            MAP.courier.stats.matrix_time = lap_seconds(phaseStart);
+            MAP.courier.stats.num_threads = omp_get_num_threads();
+            
+            build_flat_matrix();
+            set_time_windows(options.windows, depots.size());
+            constructionDeadline = construction_deadline(startTime, time_limit);
+            MAP.courier.anneal_stats.assign(omp_get_num_threads(), AnnealStats());
+            
+            // The exact solver doesn't know about windows
+            exact_solved = !has_time_windows() && solve_exact_route(deliveries, depots, truck_capacity, exact_route, exact_time);
+        }
+        
+        //Each thread constructs a route with its own strategy so the starts are varied,
+        //threads past the first of each strategy randomize it
+        int thread_num = omp_get_thread_num();
+        construction_strategy strategy = (construction_strategy)(thread_num % NUM_CONSTRUCTION_STRATEGIES);
+        bool randomize = thread_num >= NUM_CONSTRUCTION_STRATEGIES;
+        
         std::vector<RouteStop> route;
-        float priority_weight = 1;//((rand() % 10) - 5) / 10;
-        std::pair<int, double> best_greedy;
-        best_greedy.first = -1;
-        best_greedy.second = std::numeric_limits<unsigned>::max();
-        for (int i = 0; i < deliveries.size(); ++i) {
-            find_greedy_path(destinations, deliveries, route, truck_capacity, priority_weight, i);
-            double time = get_route_time(route);
-            if (time < best_greedy.second) {
-                best_greedy.first = i;
-                best_greedy.second = time;
-            } 
-            route.clear();
+        std::vector<bool> is_in_truck(deliveries.size(), false);
+        double min_time = 0;
+        
+        if (construct_route(strategy, deliveries, depots, truck_capacity, randomize, constructionDeadline, route)
+                && validate_route(route, min_time, is_in_truck, deliveries, truck_capacity)) {
+            #pragma omp critical
+            seed_routes.push_back(std::make_pair(min_time, route));
         }
         
-        find_greedy_path(destinations, deliveries, route, truck_capacity, priority_weight, best_greedy.first);
+        //wait for every thread to add its route before sorting them
+        #pragma omp barrier
         
-        //initialize for legality checking
-        std::vector<bool> is_in_truck(deliveries.size(), false);        
+        #pragma omp single
+        {
+            std::sort(seed_routes.begin(), seed_routes.end(), 
+                    [](const std::pair<double, std::vector<RouteStop>> &a, 
+                       const std::pair<double, std::vector<RouteStop>> &b) {
+                        return a.first < b.first;
+                    });
+            MAP.courier.stats.construction_time = lap_seconds(phaseStart);
+        }
         
-        //set min time
-        double min_time = 0;
-        bool initial_check = validate_route(route, min_time, is_in_truck, deliveries, truck_capacity);
-        //if bad route, re-run greedy (greedy is currently bugged)
-        while(!initial_check) {
-            route.clear();
-            min_time = 0;
-            find_greedy_path(destinations, deliveries, route, truck_capacity, priority_weight, 0);
-            initial_check = validate_route(route, min_time, is_in_truck, deliveries, truck_capacity);
+        if (!seed_routes.empty()) {
+            //start from one of the best constructed routes
+            unsigned num_seeds = std::min((unsigned)seed_routes.size(), (unsigned)CONSTRUCTION_SEED_ROUTES);
+            route = seed_routes[thread_num % num_seeds].second;
+            min_time = seed_routes[thread_num % num_seeds].first;
+        } else {
+            //if no strategy found a legal route, re-run every strategy randomized in turn,
+            //time windows may not allow any route so the tries are limited for them
+            bool initial_check = false;
+            for(unsigned tries = 0; !initial_check && (!has_time_windows() || tries < deliveries.size()); ++tries) {
+                min_time = 0;
+                initial_check = construct_route((construction_strategy)(tries % NUM_CONSTRUCTION_STRATEGIES), deliveries,
+                        depots, truck_capacity, true, constructionDeadline, route)
+                        && validate_route(route, min_time, is_in_truck, deliveries, truck_capacity);
+            }
+            
+            if(initial_check) {
+                #pragma omp critical
+                fallback_routes.push_back(std::make_pair(min_time, route));
+            } else {
+                route.clear();
+            }
         }
         
         //store absolute best time/route for thread
         std::vector<RouteStop> best_route_to_now = route;
         double best_time_to_now = min_time;
         
-        float temp = 10;
-
-        double new_time;
-        bool is_legal;
-        
-        int runs = 0, better = 0, best = 0, total = 0, legal = 0;
-        if(destinations.size() > 10) {
-            // Loop over calling random swap until the time runs out
-            while(!timeOut) {
-                runs++;
-                //two_opt_swap_annealing_temp(route, min_time, is_in_truck, deliveries, truck_capacity, temp);
-
-                // Check if the algorithm has timed out
-                auto currentTime = std::chrono::high_resolution_clock::now();
-                auto wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime);
-
-                timeOut = wallClock.count() > TIME_LIMIT;
-
-                float x = (( TIME_LIMIT - wallClock.count()) - 1.0)/16.0;       
-                //adjust annealing temp
-                temp = exp(x) - 1;
-                if(x<0) temp = 0;
-
-
-                // Break and swap two edges randomly
-                std::pair<int, int> indexes = random_edge_swap(route);
-
-                // Try to get new time (in if statement)
-                is_legal = validate_route(route, new_time, is_in_truck, deliveries, truck_capacity);
-                if(is_legal) legal ++;
-
-                // If a route can be found, OR is annealing, it improves travel time and it passes the legal check,
-                // then keep the the new route, otherwise reverse the changes
-                if(is_legal && (new_time < min_time || ((1.0/(float)pcg32_fast() < exp(-1*(new_time - min_time)/temp))) )// for simulated annealing
-                ) {
-                    if(new_time < min_time) better++;
-                    total++;
-                    min_time = new_time;
-
-                    if(min_time < best_time_to_now) {
-                       best ++;
-                       best_route_to_now = route;
-                       best_time_to_now = min_time; 
-                    }
-                } else {
-                    reverse_vector(route, indexes.first, indexes.second);
-                }
-
-            }
+        if(!exact_solved && options.mode == ANNEAL_MODE && !route.empty()) {
+            anneal_route(best_route_to_now, best_time_to_now, deliveries, truck_capacity, time_limit, startTime,
+                    &MAP.courier.anneal_stats[thread_num]);
         }
         
         //each thread takes a turn comparing its result to best overall
         #pragma omp critical
-        {
-            /*std::cout << "runs: " << runs << " best time: "<< best_time_to_now << "  thread#: " 
-                    << omp_get_thread_num() << "  best swaps: " << best << "  better swaps: " << better 
-                    << "  total swaps : " << total << "  legal options: " << legal << "\n";*/
+        if(!best_route_to_now.empty()) {
+            auto depotStart = std::chrono::high_resolution_clock::now();
             best_time_to_now += add_closest_depots_to_route(best_route_to_now, depots);
+            MAP.courier.stats.depot_time += lap_seconds(depotStart);
             if(best_time_to_now < best_time) {
                 best_route = best_route_to_now;
                 best_time = best_time_to_now;
@@ -298,9 +257,52 @@ std::vector<CourierSubpath> traveling_courier(
         
     }   
     
+    // No route meets the time windows
+    if (best_route.empty() && !exact_solved) {
+        MAP.courier.stats.total_time = lap_seconds(startTime);
+        return std::vector<CourierSubpath>();
+    }
+    if (seed_routes.empty()) seed_routes = fallback_routes;
+    
+    // The population is evolved by every thread together, starting from the constructed routes
+    if (!exact_solved && options.mode == MEMETIC_MODE) {
+        std::vector<RouteStop> memetic_best;
+        double memetic_time = 0;
+        memetic_route(seed_routes, deliveries, depots, truck_capacity, time_limit, startTime, memetic_best, memetic_time);
+        
+        auto depotStart = std::chrono::high_resolution_clock::now();
+        if (!memetic_best.empty()) memetic_time += add_closest_depots_to_route(memetic_best, depots);
+        MAP.courier.stats.depot_time += lap_seconds(depotStart);
+        if (!memetic_best.empty() && memetic_time < best_time) {
+            best_route = memetic_best;
+            best_time = memetic_time;
+        }
+    }
+    
+    // The exact route is optimal, so it replaces whatever the threads found
+    if (exact_solved) {
+        MAP.courier.stats.mode = "exact";
+        best_route = exact_route;
+        
+        auto depotStart = std::chrono::high_resolution_clock::now();
+        add_closest_depots_to_route(best_route, depots);
+        MAP.courier.stats.depot_time += lap_seconds(depotStart);
+    }
+    MAP.courier.stats.optimization_time = lap_seconds(phaseStart);
+    
+    // Keep the route so it can be planned again when the deliveries change
+    MAP.courier.route_stops.clear();
+    for (unsigned i = 1; i + 1 < best_route.size(); ++i) {
+        MAP.courier.route_stops.push_back(stop_matrix_index(best_route[i]));
+    }
+    
     //Convert simple path to one we can return:
     std::vector<CourierSubpath> route_complete;
-    build_route(best_route, route_complete, right_turn_penalty, left_turn_penalty);    
+    build_route(best_route, route_complete, depots, right_turn_penalty, left_turn_penalty);    
+    
+    MAP.courier.stats.build_route_time = lap_seconds(phaseStart);
+    MAP.courier.stats.total_time = lap_seconds(startTime);
+    merge_best_traces();
     
     return route_complete;
 }
@@ -324,49 +326,38 @@ void pcg32_fast_init(uint64_t seed) {
 }
 
 
-//quickly checks legality operates in O(n), currently deprecated 
-bool check_legal_simple(
-        std::vector<RouteStop> &route, 
-        std::vector<bool> &is_in_truck, 
-        const std::vector<DeliveryInfo>& deliveries, 
-        float capacity
-) {
-    //set all to false (should be able to delete once fully integrated)
-    is_in_truck.assign(is_in_truck.size(), false);
-    
-    double current_weight = 0;
-    
-    for(auto &stop : route) {
-        switch(stop.type) {
-            case PICK_UP:
-                is_in_truck[stop.delivery_index] = true; 
-                current_weight += deliveries[stop.delivery_index].itemWeight;
-                break;
-            case DROP_OFF:
-                current_weight -= deliveries[stop.delivery_index].itemWeight;
-                if(not is_in_truck[stop.delivery_index])
-                    return false;
-                break;
-            default: 
-                std::cout << "Error, invalid stop type in legality check\n";
-                return false;    
-        }
-        
-        if(current_weight > capacity) return false;
-    }
-    
-    return true;
+void set_courier_seed(long long seed) {
+    courier_seed = seed;
+}
+
+
+uint64_t thread_seed() {
+    uint64_t base = courier_seed < 0 ? (uint64_t)rand() : (uint64_t)courier_seed;
+    return base + omp_get_thread_num();
 }
 
 
 // It might be necessary to resize the MAP.courier.time_between_deliveries before calling this function
+// If predecessors is not null, the edges leading to every destination found are kept in it
 void multi_dest_dijkistra(
 		  const unsigned intersect_id_start, 
                   const unsigned row_index,
                   std::vector<Node*> &intersection_nodes,
-                  std::vector<unsigned> dests,
+                  const std::vector<unsigned> &dests,
                   const float right_turn_penalty, 
-                  const float left_turn_penalty) {
+                  const float left_turn_penalty,
+                  std::unordered_map<unsigned, int> *predecessors) {
+    // An earlier search from the same intersection may have reached every destination already
+    std::shared_ptr<const CachedRow> cached = courier_row_cache.get(intersect_id_start, right_turn_penalty, left_turn_penalty);
+    if (cached != nullptr && fill_row_from_cache(*cached, intersect_id_start, row_index, dests, predecessors)) {
+        #pragma omp atomic
+        MAP.courier.stats.cached_rows++;
+        return;
+    }
+    
+    // Every intersection taken off the queue, so this search can be cached
+    std::vector<SettledIntersection> settled;
+    
     unsigned num_found = 0;
     //Node& sourceNode = MAP.intersection_node[intersect_id_start];
     // Initialize queue for BFS
@@ -385,6 +376,7 @@ void multi_dest_dijkistra(
         
         wavefront.pop(); // Remove the first element
         Node* currentNode = currentElem.node;
+        settled.push_back(SettledIntersection{(unsigned)currentNode->intersection_id, currentNode->best_time, currentNode->edge_in});
         
         // Check every node that is connected to the current node
         for (unsigned i = 0; i < currentNode->edge_out.size(); i++) {
@@ -426,14 +418,19 @@ void multi_dest_dijkistra(
         // Return if all the destinations are covered in the search
         if (num_found == dests.size()) { 
             clear_intersection_nodes(intersection_nodes);
+            cache_search(intersect_id_start, right_turn_penalty, left_turn_penalty, dests, settled);
             return;
         }
         
         // Remove a destination from the dests vector once the shortest route to it is found
         int i = 0;
+        bool is_new_dest = false;
         for (auto it = dests.begin(); it != dests.end(); ++it, ++i) {            
             if ((unsigned)currentNode->intersection_id == *it) {
-                if(MAP.courier.time_between_deliveries [row_index][i] == NO_ROUTE) num_found ++;
+                if(MAP.courier.time_between_deliveries [row_index][i] == NO_ROUTE) {
+                    num_found ++;
+                    is_new_dest = true;
+                }
                 
                 if(intersect_id_start == (unsigned)currentNode->intersection_id) {
                     MAP.courier.time_between_deliveries [row_index][i] = 0;
@@ -443,9 +440,15 @@ void multi_dest_dijkistra(
             }
         }
         
+        // Keep the route to the destination while the edges are still set
+        if (is_new_dest && predecessors != nullptr) {
+            store_predecessors(currentNode, intersect_id_start, intersection_nodes, *predecessors);
+        }
+        
     } 
     
     clear_intersection_nodes(intersection_nodes);
+    cache_search(intersect_id_start, right_turn_penalty, left_turn_penalty, dests, settled);
     //std::cout << "No valid routes are found" << std::endl;
 
 }
@@ -459,6 +462,81 @@ void clear_intersection_nodes(std::vector<Node*> &intersection_nodes) {
     }        
 }
 
+// Walks back from a destination to the start of the search, storing the edge used
+// to reach every intersection. Stops early once it joins a route already stored,
+// so routes sharing a prefix share their entries
+void store_predecessors(
+        Node* dest_node,
+        const unsigned intersect_id_start,
+        std::vector<Node*> &intersection_nodes,
+        std::unordered_map<unsigned, int> &predecessors
+) {
+    Node* currentNode = dest_node;
+    unsigned steps = 0;
+    
+    while ((unsigned)currentNode->intersection_id != intersect_id_start 
+            && currentNode->edge_in != NO_EDGE
+            && steps < intersection_nodes.size()) {
+        // Already reached through a stored route, the rest is in the map
+        if (!predecessors.insert(std::make_pair(currentNode->intersection_id, currentNode->edge_in)).second) return;
+        
+        InfoStreetSegment edgeInfo = getInfoStreetSegment(currentNode->edge_in);
+        currentNode = (edgeInfo.from == currentNode->intersection_id)
+            ? intersection_nodes[edgeInfo.to]
+            : intersection_nodes[edgeInfo.from];
+        steps++;
+    }
+}
+
+// Rebuilds the street segments between two intersections from the predecessors stored for
+// the row starting at intersect_id_start, returns false if the route can't be rebuilt
+bool backtrace_courier_leg(
+        const std::unordered_map<unsigned, int> &predecessors,
+        const unsigned intersect_id_start,
+        const unsigned intersect_id_end,
+        std::vector<unsigned> &path
+) {
+    path.clear();
+    unsigned current = intersect_id_end;
+    
+    // Follow the stored edges from the end back to the start
+    while (current != intersect_id_start) {
+        auto it = predecessors.find(current);
+        if (it == predecessors.end() || path.size() > predecessors.size()) return false;
+        
+        path.push_back(it->second);
+        InfoStreetSegment edgeInfo = getInfoStreetSegment(it->second);
+        current = ((unsigned)edgeInfo.from == current) ? edgeInfo.to : edgeInfo.from;
+    }
+    
+    std::reverse(path.begin(), path.end());
+    return true;
+}
+
+// Rebuilds the street segments between two intersections from the successors stored for
+// a column searched backwards to intersect_id_end, returns false if the route can't be rebuilt
+bool forward_trace_courier_leg(
+        const std::unordered_map<unsigned, int> &successors,
+        const unsigned intersect_id_start,
+        const unsigned intersect_id_end,
+        std::vector<unsigned> &path
+) {
+    path.clear();
+    unsigned current = intersect_id_start;
+    
+    // Follow the stored edges from the start to the end, they are already in order
+    while (current != intersect_id_end) {
+        auto it = successors.find(current);
+        if (it == successors.end() || path.size() > successors.size()) return false;
+        
+        path.push_back(it->second);
+        InfoStreetSegment edgeInfo = getInfoStreetSegment(it->second);
+        current = ((unsigned)edgeInfo.from == current) ? edgeInfo.to : edgeInfo.from;
+    }
+    
+    return true;
+}
+
 double add_closest_depots_to_route(
         std::vector<RouteStop> &simple_route,
         const std::vector<unsigned>& depots
@@ -470,7 +548,7 @@ double add_closest_depots_to_route(
     
     // Loop over the depots, calling the m3 functions to calculate the time to each depot
     for(unsigned i = 0; i < depots.size(); ++i) {
-        double start_time = MAP.courier.time_between_deliveries[i + MAP.courier.time_between_deliveries[0].size()][simple_route[0].delivery_index * 2];
+        double start_time = MAP.courier.time_between_deliveries[i + MAP.courier.time_between_deliveries[0].size()][stop_matrix_index(simple_route[0])];
         //auto start_route = find_path_between_intersections(simple_route[0].intersection_id, *it, right_turn_penalty, left_turn_penalty);
         if (start_time < std::numeric_limits<unsigned>::max()) {
             //double start_time = compute_path_travel_time(start_route, right_turn_penalty, left_turn_penalty);
@@ -480,7 +558,7 @@ double add_closest_depots_to_route(
             }
         }
         
-        double end_time = MAP.courier.time_between_deliveries[i + MAP.courier.time_between_deliveries[0].size()][simple_route[simple_route.size() - 1].delivery_index * 2];
+        double end_time = MAP.courier.time_between_deliveries[i + MAP.courier.time_between_deliveries[0].size()][stop_matrix_index(simple_route[simple_route.size() - 1])];
         //auto end_route = find_path_between_intersections(simple_route[simple_route.size() - 1].intersection_id, *it, right_turn_penalty, left_turn_penalty);
         if(end_time < std::numeric_limits<unsigned>::max()) {
             //double end_time = compute_path_travel_time(end_route, right_turn_penalty, left_turn_penalty);
@@ -498,6 +576,22 @@ double add_closest_depots_to_route(
     return start_min + end_min;
 }
 
+// Copies time_between_deliveries into one contiguous block so routes can be costed without indirection.
+// Rows are padded to a multiple of 8 floats with at least one zero column, and a zero row is added
+// after the depots, so the annealing can use them as the free ends of a route
+void build_flat_matrix() {
+    unsigned num_rows = MAP.courier.time_between_deliveries.size();
+    MAP.courier.num_columns = MAP.courier.time_between_deliveries[0].size();
+    MAP.courier.row_stride = (MAP.courier.num_columns + 8) / 8 * 8;
+    MAP.courier.flat_time_between_deliveries.assign((num_rows + 1) * MAP.courier.row_stride, 0);
+    
+    for (unsigned i = 0; i < num_rows; ++i) {
+        for (unsigned j = 0; j < MAP.courier.num_columns; ++j) {
+            MAP.courier.flat_time_between_deliveries[i * MAP.courier.row_stride + j] = MAP.courier.time_between_deliveries[i][j];
+        }
+    }
+}
+
 //returns time of route and has legal flag, can set to false if non-reachable route, currently deprecated
 double get_route_time(std::vector<RouteStop> &route){
     double time = 0;
@@ -512,29 +606,67 @@ double get_route_time(std::vector<RouteStop> &route){
     return time;
 }
     
+// Converts the simple route into the legs that are returned. Every leg that is in the 
+// matrix is rebuilt from the predecessors kept by multi_dest_dijkistra (or the successors kept
+// by replan_courier), in parallel.
+// Only the legs that aren't (ie ending at a depot) are searched for again
 void build_route(
         std::vector<RouteStop> &simple_route,
         std::vector<CourierSubpath> &complete_route,
+        const std::vector<unsigned>& depots,
         const float right_turn_penalty, 
         const float left_turn_penalty
         
 ) {
-    for(auto stop = simple_route.begin(); stop != simple_route.end()-1; ++ stop) {
-        CourierSubpath path;
-        path.start_intersection = (*stop).intersection_id;
-        path.end_intersection = (*(stop+1)).intersection_id;
-        std::vector<unsigned> subpath = find_path_between_intersections(
-            path.start_intersection,
-            path.end_intersection,
+    if (simple_route.size() < 2) return;
+    
+    complete_route.resize(simple_route.size() - 1);
+    std::vector<char> is_rebuilt(complete_route.size(), false); // Not vector<bool>, its elements share bytes between threads
+    unsigned num_destinations = MAP.courier.time_between_deliveries[0].size();
+    
+    #pragma omp parallel for schedule(dynamic)
+    for(unsigned i = 0; i < complete_route.size(); ++i) {
+        const RouteStop &stop = simple_route[i];
+        const RouteStop &next_stop = simple_route[i + 1];
+        CourierSubpath &path = complete_route[i];
+        
+        path.start_intersection = stop.intersection_id;
+        path.end_intersection = next_stop.intersection_id;
+        if(stop.type == PICK_UP) path.pickUp_indices.push_back(stop.delivery_index);
+        
+        // Depots are stored after the destinations in the matrix
+        unsigned row;
+        if (stop.delivery_index < 0) {
+            row = std::find(depots.begin(), depots.end(), stop.intersection_id) - depots.begin() + num_destinations;
+        } else {
+            row = stop.type == PICK_UP ? stop.delivery_index*2 : stop.delivery_index*2+1;
+        }
+        
+        // Depots have no column, so the leg to the last depot wasn't searched for.
+        // Columns added by replan_courier were searched backwards from the old rows
+        if (next_stop.delivery_index < 0) continue;
+        
+        unsigned column = stop_matrix_index(next_stop);
+        if (column < MAP.courier.successor_rows.size() && row < MAP.courier.successor_rows[column].size()
+                && MAP.courier.successor_rows[column][row]) {
+            is_rebuilt[i] = forward_trace_courier_leg(MAP.courier.successor_edges[column],
+                    path.start_intersection, path.end_intersection, path.subpath);
+        } else if (row < MAP.courier.predecessor_edges.size()) {
+            is_rebuilt[i] = backtrace_courier_leg(MAP.courier.predecessor_edges[row], 
+                    path.start_intersection, path.end_intersection, path.subpath);
+        }
+    }
+    
+    // find_path_between_intersections uses the global nodes, so these are done one at a time
+    for(unsigned i = 0; i < complete_route.size(); ++i) {
+        if (is_rebuilt[i]) continue;
+        
+        complete_route[i].subpath = find_path_between_intersections(
+            complete_route[i].start_intersection,
+            complete_route[i].end_intersection,
             right_turn_penalty,
             left_turn_penalty
         );
-        path.subpath = subpath;
-        std::vector<unsigned> pickUps;
-        if((*stop).type == PICK_UP) pickUps.push_back( (*stop).delivery_index );
-        path.pickUp_indices = pickUps;
-        
-        complete_route.push_back(path);
     }
 }
 
@@ -582,192 +714,5 @@ bool validate_route(std::vector<RouteStop> &route,
         i = j;
     }
     
-    return true;
-}
-
-// Reverses the part of a vector between two positions
-void reverse_vector(std::vector<RouteStop> &route, int &edge1, int &edge2) {
-    std::reverse(route.begin() + edge1, route.begin() + edge1 + edge2);
-    return;
-}
-
-// Randomly selects two edges in the array, ie two positions
-// and reverses the part of the vector between those positions
-std::pair<int, int> random_edge_swap(std::vector<RouteStop> &route) {
-    int edge1 = pcg32_fast() % (int)route.size();
-    int edge2 = pcg32_fast() % (route.size() - edge1);
-    
-    reverse_vector(route, edge1, edge2);
-    
-    return std::make_pair(edge1, edge2);
-}
-
-
-// Continously swaps two edges, keeping the shortest time
-// until it runs out of run_counts
-void two_opt_swap_annealing_temp(std::vector<RouteStop> &route,
-                         double &min_time,
-                         std::vector<bool> &is_in_truck, 
-                         const std::vector<DeliveryInfo>& deliveries, 
-                         const float &capacity,
-                         float &temp
-) {
-    
-    // Break and swap two edges randomly
-    std::pair<int, int> indexes = random_edge_swap(route);
-
-    // Try to get new time (in if statement)
-    double new_time;
-    bool is_legal = validate_route(route, new_time, is_in_truck, deliveries, capacity);
-
-    // If a route can be found, OR is annealing, it improves travel time and it passes the legal check,
-    // then keep the the new route, otherwise reverse the changes
-    if(is_legal && (new_time < min_time || ((1.0/(float)pcg32_fast() < exp(-1*(new_time - min_time)/temp))) )// for simulated annealing
-    ) {
-        min_time = new_time;
-    } else {
-        reverse_vector(route, indexes.first, indexes.second);
-    }
-}
-
-// Continously swaps two edges, keeping the shortest time
-// until it runs out of run_counts
-void two_opt_swap_annealing(std::vector<RouteStop> &route,
-                         double run_time,
-                         std::vector<bool> &is_in_truck, 
-                         const std::vector<DeliveryInfo>& deliveries, 
-                         float capacity,
-                         int annealing
-) {
-    
-    bool is_legal = true;
-    double min_time = get_route_time(route);
-        
-    // For run_time of algorithm
-    auto startTime = std::chrono::high_resolution_clock::now();
-    bool timeOut = false;
-    
-    int temp = annealing;
-    
-    // Loop over calling random swap until the time runs out
-    while(!timeOut) {
-        
-        // Break and swap two edges randomly
-        std::pair<int, int> indexes = random_edge_swap(route);
- 
-        // Try to get new time
-        double new_time = get_route_time(route);
-        
-        // If a route can be found, OR is annealing, it improves travel time and it passes the legal check,
-        // then keep the the new route, otherwise reverse the changes
-        if(is_legal &&
-          (new_time < min_time || (temp > 0 && pcg32_fast() % temp == 0)) && // for simulated annealing
-          check_legal_simple(route, is_in_truck, deliveries, capacity)) {
-            min_time = new_time;
-        } else {
-            reverse_vector(route, indexes.first, indexes.second);
-            is_legal = true;
-        }
-        
-        // Check if the algorithm has timed out
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        auto wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime);
-
-        
-        timeOut = wallClock.count() >= run_time;
-        temp = (run_time) / (run_time - wallClock.count()) + 1;
-    }
+    return !has_time_windows() || route_meets_windows(route);
 }
-
-
-
-
-// There are three kinds of index: delivery index, destination index, and intersection id
-void find_greedy_path(const std::vector<unsigned> &destinations,
-                      const std::vector<DeliveryInfo>& deliveries,
-                      std::vector<RouteStop> &route,
-                      const float truck_capacity,
-                      float priority_weight,
-                      int starting_index) {
-    
-    // Randomly assign a pick up point as a starting point
-    int current = (pcg32_fast() % (deliveries.size()-1)) * 2;
-    if(deliveries.size() < 5) current = 0;
-    
-    int next = -1;
-    double current_capacity_used = 0;
-    std::vector<unsigned> current_item_carried;
-    int item_to_deliver = deliveries.size();
-    std::vector<bool> visited;
-    visited.resize(destinations.size(), false);
-    
-    // Add the first pickup to current truck
-    current_item_carried.push_back(current + 1);
-    current_capacity_used += deliveries[current / 2].itemWeight;
-    route.push_back(RouteStop(destinations[current], current / 2, PICK_UP));
-    
-    // Continue finding path until all items are delivered
-    while (item_to_deliver != 0) {
-        // <destination_index, time> for closest_pickup and closet_dropoff
-        std::pair<int, int> closest_pickup, closest_dropoff; 
-        
-        // Initialize the pairs
-        closest_pickup.first = -1;
-        closest_dropoff.first = -1;
-        closest_pickup.second = std::numeric_limits<int>::max();
-        closest_dropoff.second = std::numeric_limits<int>::max();
-        
-        // Flag the visited node so it won't be visited again
-        visited[current] = true;
-        
-        // Go through the time table to find nearest pickup and dropoff
-        for (unsigned i = 0; i < MAP.courier.time_between_deliveries[0].size(); ++i) {
-            int time = MAP.courier.time_between_deliveries[current][i];
-            //if (current == i) std::cout << time << std::endl;
-            //std::cout << i << " " << time << std::endl;
-            // Different cases for pickup and dropoff
-            if ((i % 2 == 0) && (time >= 0) && (time < closest_pickup.second) && !visited[i]) {
-                closest_pickup.first = i;
-                closest_pickup.second = time;
-            } else if ((i % 2 == 1) && (time >= 0) && (time < closest_dropoff.second) && !visited[i]) {
-                // Check if the item i is currently carried on the truck
-                auto it = std::find(current_item_carried.begin(), current_item_carried.end(), i);
-                if (current_item_carried.empty()) {
-                    closest_dropoff.first = -1;
-                    closest_dropoff.second = std::numeric_limits<int>::max();
-                }
-                else if (it != current_item_carried.end()) {
-                    closest_dropoff.first = i;
-                    closest_dropoff.second = time;
-                } else if ((it == current_item_carried.end()) && (*it == i)) {
-                    closest_dropoff.first = i;
-                    closest_dropoff.second = time;
-                }
-            }
-        }
-        // Now determine the next destination
-        // If truck cannot fit next nearest pickup or if dropoff is closer than pickup then go the nearest dropoff
-        // Otherwise go the nearest pickup
-        if (closest_pickup.first == -1 || current_capacity_used + deliveries[closest_pickup.first / 2].itemWeight > truck_capacity || 
-             closest_dropoff.second < priority_weight * closest_pickup.second) {
-            next = closest_dropoff.first;
-            //std::remove(current_item_carried.begin(), current_item_carried.end(), closest_dropoff.first); // may be broken
-            for (auto it = current_item_carried.begin(); it != current_item_carried.end(); ++it) {
-                if ((int)*it == closest_dropoff.first) {
-                    current_item_carried.erase(it);
-                    break;
-                }
-            }
-            current_capacity_used -= deliveries[closest_dropoff.first / 2].itemWeight;
-            item_to_deliver -= 1;
-            route.push_back(RouteStop(deliveries[closest_dropoff.first / 2].dropOff, closest_dropoff.first / 2, DROP_OFF));
-        } else { 
-            next = closest_pickup.first;
-            current_item_carried.push_back(closest_pickup.first + 1); // Push the corresponding dropoff position to the vector
-            current_capacity_used += deliveries[closest_pickup.first / 2].itemWeight;
-            route.push_back(RouteStop(deliveries[closest_pickup.first / 2].pickUp, closest_pickup.first / 2, PICK_UP));
-        }
-        current = next;
-    }
-}
-
@@ -0,0 +1,382 @@
+/*
+ * Contains the annealing of courier routes. Reversing stops[a] to stops[b]
+ * replaces the legs into and out of the part, and takes every leg inside it
+ * the other way, which is the difference of the two running sums
+ */
+
+#include "m4_anneal.h"
+#include "m4_courier.h"
+#include "m4_windows.h"
+#include "m4_stats.h"
+#include "map_db.h"
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Random reversals sampled to pick the starting annealing temperature
+#define ANNEAL_CALIBRATION_SWAPS 200
+
+// Share of uphill swaps taken at the start and end of annealing, the target falls exponentially in between
+#define ANNEAL_START_ACCEPTANCE 0.5
+#define ANNEAL_END_ACCEPTANCE 0.005
+
+// Number of uphill swaps between temperature adjustments, and how much each adjustment changes it
+#define ANNEAL_WINDOW 200
+#define ANNEAL_TEMP_STEP 1.1
+
+// Windows without a better route before reheating, and the share of the starting temperature reheated to
+#define ANNEAL_STALL_WINDOWS 50
+#define ANNEAL_REHEAT 0.5
+
+// Share of the time after which only improving swaps are taken
+#define ANNEAL_QUENCH 0.95
+
+// The temperature starts where about ANNEAL_START_ACCEPTANCE of uphill swaps are taken, then
+// follows an acceptance rate that falls over time, and is raised again when the route stops improving
+void anneal_route(std::vector<RouteStop> &route,
+                  double &route_time,
+                  const std::vector<DeliveryInfo>& deliveries,
+                  const float truck_capacity,
+                  const double time_limit,
+                  std::chrono::high_resolution_clock::time_point startTime,
+                  AnnealStats *stats
+) {
+    auto annealStart = std::chrono::high_resolution_clock::now();
+    double start_clock = std::chrono::duration_cast<std::chrono::duration<double>> (annealStart - startTime).count();
+    double anneal_time = std::max(0.0, time_limit - start_clock);
+
+    AnnealStats thread_stats;
+    thread_stats.initial_time = route_time;
+    thread_stats.trace.push_back(std::make_pair(start_clock, route_time));
+
+    // Reversals need at least two stops
+    if (route.size() < 2 || anneal_time <= 0) {
+        thread_stats.best_time = route_time;
+        if (stats != nullptr) *stats = thread_stats;
+        return;
+    }
+
+    AnnealRoute anneal;
+    set_anneal_route(anneal, route, deliveries);
+    std::vector<int> best_stops = anneal.stops;
+    double best_time = route_time;
+
+    int first[ANNEAL_BATCH], last[ANNEAL_BATCH];
+    float change[ANNEAL_BATCH];
+
+    // Sample uphill reversals so the first temperature fits the size of the changes in this route
+    double uphill_sum = 0;
+    int uphill_count = 0;
+    for (int i = 0; i < ANNEAL_CALIBRATION_SWAPS / ANNEAL_BATCH; ++i) {
+        random_reversals(anneal, first, last);
+        score_reversals(anneal, first, last, change);
+
+        for (int k = 0; k < ANNEAL_BATCH; ++k) {
+            if (change[k] > 0 && reversal_is_legal(anneal, first[k], last[k], deliveries, truck_capacity)) {
+                uphill_sum += change[k];
+                uphill_count++;
+            }
+        }
+    }
+
+    // Temperature where an average uphill swap is taken with the starting acceptance
+    double start_temp = uphill_count > 0 ? -(uphill_sum / uphill_count) / log(ANNEAL_START_ACCEPTANCE) : 0;
+    double temp = start_temp;
+    thread_stats.start_temp = start_temp;
+
+    // Uphill swaps tried and taken in the current window, and windows since the best route improved
+    int window_uphill = 0, window_accepted = 0, stalled_windows = 0;
+    bool timeOut = false;
+    double next_sample = STATS_TRACE_INTERVAL;
+
+    // Score a batch of random reversals and try the best one until the time runs out
+    while (!timeOut) {
+        thread_stats.swaps += ANNEAL_BATCH;
+
+        // Check if the algorithm has timed out
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        double wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - annealStart).count();
+
+        timeOut = wallClock > anneal_time;
+        double progress = wallClock / anneal_time;
+
+        if (wallClock >= next_sample) {
+            thread_stats.trace.push_back(std::make_pair(start_clock + wallClock, best_time));
+            next_sample += STATS_TRACE_INTERVAL;
+        }
+
+        random_reversals(anneal, first, last);
+        score_reversals(anneal, first, last, change);
+
+        // The cheapest legal reversal of the batch is the one proposed, most are illegal once they are long
+        int best = -1;
+        for (int tries = 0; tries < ANNEAL_BATCH && best == -1; ++tries) {
+            int cheapest = 0;
+            for (int k = 1; k < ANNEAL_BATCH; ++k) {
+                if (change[k] < change[cheapest]) cheapest = k;
+            }
+
+            if (reversal_is_legal(anneal, first[cheapest], last[cheapest], deliveries, truck_capacity)) best = cheapest;
+            else change[cheapest] = std::numeric_limits<float>::max();
+        }
+        if (best == -1) continue;
+        thread_stats.legal_swaps++;
+
+        // Keep reversals that improve the time, and uphill ones with the Boltzmann probability,
+        // the last part of the time only keeps improvements
+        bool is_uphill = change[best] > 0;
+        if (is_uphill) window_uphill++;
+
+        bool is_accepted = !is_uphill || (progress < ANNEAL_QUENCH && temp > 0
+                && pcg32_fast() / 4294967296.0 < exp(-1 * change[best] / temp));
+
+        if (is_accepted) {
+            thread_stats.accepted_swaps++;
+            if (is_uphill) {
+                window_accepted++;
+                thread_stats.uphill_swaps++;
+            }
+
+            apply_reversal(anneal, first[best], last[best], deliveries);
+            route_time += change[best];
+
+            if (route_time < best_time) {
+                thread_stats.improvements++;
+                stalled_windows = 0;
+                best_stops = anneal.stops;
+                best_time = route_time;
+            }
+        }
+
+        // Adjust the temperature towards the target acceptance of uphill swaps at this point in time
+        if (window_uphill == ANNEAL_WINDOW) {
+            double target = ANNEAL_START_ACCEPTANCE * pow(ANNEAL_END_ACCEPTANCE / ANNEAL_START_ACCEPTANCE, progress);
+            double acceptance = (double)window_accepted / window_uphill;
+
+            temp *= acceptance < target ? ANNEAL_TEMP_STEP : 1.0 / ANNEAL_TEMP_STEP;
+
+            // Stuck in a valley, go back to the best route with a higher temperature
+            if (++stalled_windows >= ANNEAL_STALL_WINDOWS) {
+                thread_stats.reheats++;
+                stalled_windows = 0;
+                temp = std::max(temp, start_temp * ANNEAL_REHEAT * (1 - progress));
+                anneal.stops = best_stops;
+                update_anneal_route(anneal, 1, deliveries);
+                route_time = best_time;
+            }
+
+            window_uphill = 0;
+            window_accepted = 0;
+        }
+    }
+
+    // The sums are floats, so the time of the best route is summed again from the matrix
+    anneal.stops = best_stops;
+    get_anneal_route(anneal, route, deliveries);
+    std::vector<bool> is_in_truck(deliveries.size(), false);
+    validate_route(route, route_time, is_in_truck, deliveries, truck_capacity);
+
+    thread_stats.final_temp = temp;
+    thread_stats.run_time = anneal_time;
+    thread_stats.best_time = route_time;
+    thread_stats.trace.push_back(std::make_pair(start_clock + anneal_time, route_time));
+    if (thread_stats.legal_swaps > 0) thread_stats.accept_ratio = (double)thread_stats.accepted_swaps / thread_stats.legal_swaps;
+    thread_stats.improvement_rate = (thread_stats.initial_time - route_time) / anneal_time;
+    if (stats != nullptr) *stats = thread_stats;
+}
+
+
+void set_anneal_route(AnnealRoute &anneal,
+                      const std::vector<RouteStop> &route,
+                      const std::vector<DeliveryInfo>& deliveries) {
+    // The zero row is after the depot rows, the zero column right after the destinations
+    anneal.stops.resize(route.size() + 2);
+    anneal.stops[0] = MAP.courier.time_between_deliveries.size();
+    for (unsigned i = 0; i < route.size(); ++i) anneal.stops[i + 1] = stop_matrix_index(route[i]);
+    anneal.stops[route.size() + 1] = MAP.courier.num_columns;
+
+    anneal.position.resize(MAP.courier.num_columns);
+    anneal.leg.resize(anneal.stops.size());
+    anneal.forward.resize(anneal.stops.size());
+    anneal.backward.resize(anneal.stops.size());
+    anneal.load.resize(anneal.stops.size());
+    anneal.departure.resize(anneal.stops.size());
+    anneal.latest_arrival.resize(anneal.stops.size());
+
+    update_anneal_route(anneal, 1, deliveries);
+}
+
+
+void update_anneal_route(AnnealRoute &anneal,
+                         unsigned first_position,
+                         const std::vector<DeliveryInfo>& deliveries) {
+    const float *matrix = MAP.courier.flat_time_between_deliveries.data();
+    unsigned stride = MAP.courier.row_stride;
+    unsigned last_stop = anneal.stops.size() - 2;
+
+    // Everything before the first position is unchanged
+    unsigned i = std::max(1u, first_position);
+    anneal.leg[i - 1] = matrix[anneal.stops[i - 1] * stride + anneal.stops[i]];
+    anneal.forward[1] = anneal.backward[1] = 0;
+    anneal.load[0] = 0;
+
+    for (; i <= last_stop; ++i) {
+        int stop = anneal.stops[i];
+        anneal.position[stop] = i;
+        anneal.leg[i] = matrix[stop * stride + anneal.stops[i + 1]];
+        anneal.load[i] = anneal.load[i - 1] + (stop % 2 == 0 ? deliveries[stop / 2].itemWeight : -deliveries[stop / 2].itemWeight);
+
+        if (i > 1) {
+            int previous = anneal.stops[i - 1];
+            anneal.forward[i] = anneal.forward[i - 1] + matrix[previous * stride + stop];
+            anneal.backward[i] = anneal.backward[i - 1] + matrix[stop * stride + previous];
+        }
+    }
+
+    if (!has_time_windows()) return;
+
+    // Departures only change after the first position, but any latest arrival before it may
+    for (i = std::max(1u, first_position); i <= last_stop; ++i) {
+        int stop = anneal.stops[i];
+        float arrival = i > 1 ? anneal.departure[i - 1] + matrix[anneal.stops[i - 1] * stride + stop] : MAP.courier.depot_arrival[stop];
+        anneal.departure[i] = window_departure(stop, arrival);
+    }
+
+    anneal.latest_arrival[last_stop] = MAP.courier.window_latest[anneal.stops[last_stop]];
+    for (i = last_stop - 1; i >= 1; --i) {
+        anneal.latest_arrival[i] = window_latest_arrival(anneal.stops[i], anneal.stops[i + 1], anneal.latest_arrival[i + 1]);
+    }
+}
+
+
+void random_reversals(const AnnealRoute &anneal, int *first, int *last) {
+    unsigned num_stops = anneal.stops.size() - 2;
+
+    for (int k = 0; k < ANNEAL_BATCH; ++k) {
+        first[k] = 1 + pcg32_fast() % (num_stops - 1);
+        last[k] = first[k] + 1 + pcg32_fast() % (num_stops - first[k]);
+    }
+}
+
+
+#ifdef __AVX2__
+
+void score_reversals(const AnnealRoute &anneal, const int *first, const int *last, float *change) {
+    const int *stops = anneal.stops.data();
+    const float *matrix = MAP.courier.flat_time_between_deliveries.data();
+    __m256i stride = _mm256_set1_epi32(MAP.courier.row_stride);
+    __m256i one = _mm256_set1_epi32(1);
+
+    __m256i a = _mm256_loadu_si256((const __m256i*)first);
+    __m256i b = _mm256_loadu_si256((const __m256i*)last);
+    __m256i before_a = _mm256_sub_epi32(a, one);
+    __m256i after_b = _mm256_add_epi32(b, one);
+
+    // The stops at both ends of the part and next to it
+    __m256i stop_before = _mm256_i32gather_epi32(stops, before_a, 4);
+    __m256i stop_a = _mm256_i32gather_epi32(stops, a, 4);
+    __m256i stop_b = _mm256_i32gather_epi32(stops, b, 4);
+    __m256i stop_after = _mm256_i32gather_epi32(stops, after_b, 4);
+
+    // New legs into and out of the part, once it is reversed
+    __m256 into = _mm256_i32gather_ps(matrix, _mm256_add_epi32(_mm256_mullo_epi32(stop_before, stride), stop_b), 4);
+    __m256 out_of = _mm256_i32gather_ps(matrix, _mm256_add_epi32(_mm256_mullo_epi32(stop_a, stride), stop_after), 4);
+
+    // Old legs into and out of the part
+    __m256 old_into = _mm256_i32gather_ps(anneal.leg.data(), before_a, 4);
+    __m256 old_out_of = _mm256_i32gather_ps(anneal.leg.data(), b, 4);
+
+    // Inside of the part, taken the other way
+    __m256 inside = _mm256_sub_ps(_mm256_i32gather_ps(anneal.forward.data(), b, 4), _mm256_i32gather_ps(anneal.forward.data(), a, 4));
+    __m256 inside_reversed = _mm256_sub_ps(_mm256_i32gather_ps(anneal.backward.data(), b, 4), _mm256_i32gather_ps(anneal.backward.data(), a, 4));
+
+    __m256 result = _mm256_add_ps(_mm256_add_ps(into, out_of), _mm256_sub_ps(inside_reversed, inside));
+    result = _mm256_sub_ps(result, _mm256_add_ps(old_into, old_out_of));
+    _mm256_storeu_ps(change, result);
+}
+
+#else
+
+void score_reversals(const AnnealRoute &anneal, const int *first, const int *last, float *change) {
+    const float *matrix = MAP.courier.flat_time_between_deliveries.data();
+    unsigned stride = MAP.courier.row_stride;
+
+    for (int k = 0; k < ANNEAL_BATCH; ++k) {
+        int a = first[k], b = last[k];
+
+        float into = matrix[anneal.stops[a - 1] * stride + anneal.stops[b]];
+        float out_of = matrix[anneal.stops[a] * stride + anneal.stops[b + 1]];
+        float inside = anneal.forward[b] - anneal.forward[a];
+        float inside_reversed = anneal.backward[b] - anneal.backward[a];
+
+        change[k] = into + out_of + (inside_reversed - inside) - (anneal.leg[a - 1] + anneal.leg[b]);
+    }
+}
+
+#endif
+
+
+bool reversal_is_legal(const AnnealRoute &anneal,
+                       int first,
+                       int last,
+                       const std::vector<DeliveryInfo>& deliveries,
+                       const float truck_capacity) {
+    float current_weight = anneal.load[first - 1];
+
+    // With windows the part is also timed in its new order, starting from the stop before it
+    bool use_windows = has_time_windows();
+    int previous = anneal.stops[first - 1];
+    float departure = first > 1 ? anneal.departure[first - 1] : 0;
+
+    // Walk the part in its new order
+    for (int i = last; i >= first; --i) {
+        int stop = anneal.stops[i];
+
+        // Both stops of a delivery in the part would swap places
+        int other = anneal.position[stop ^ 1];
+        if (other >= first && other <= last) return false;
+
+        current_weight += stop % 2 == 0 ? deliveries[stop / 2].itemWeight : -deliveries[stop / 2].itemWeight;
+        if (current_weight > truck_capacity) return false;
+
+        if (use_windows) {
+            float arrival = first == 1 && i == last ? MAP.courier.depot_arrival[stop] : departure + flat_travel_time(previous, stop);
+            if (arrival > MAP.courier.window_latest[stop]) return false;
+
+            departure = window_departure(stop, arrival);
+            previous = stop;
+        }
+    }
+
+    // The rest of the route is unchanged, so it only needs to be reached in time
+    if (use_windows && last + 2 < (int)anneal.stops.size()) {
+        return departure + flat_travel_time(previous, anneal.stops[last + 1]) <= anneal.latest_arrival[last + 1];
+    }
+
+    return true;
+}
+
+
+void apply_reversal(AnnealRoute &anneal, int first, int last, const std::vector<DeliveryInfo>& deliveries) {
+    std::reverse(anneal.stops.begin() + first, anneal.stops.begin() + last + 1);
+    update_anneal_route(anneal, first, deliveries);
+}
+
+
+void get_anneal_route(const AnnealRoute &anneal,
+                      std::vector<RouteStop> &route,
+                      const std::vector<DeliveryInfo>& deliveries) {
+    route.clear();
+
+    for (unsigned i = 1; i + 1 < anneal.stops.size(); ++i) {
+        int stop = anneal.stops[i];
+        if (stop % 2 == 0) route.push_back(RouteStop(deliveries[stop / 2].pickUp, stop / 2, PICK_UP));
+        else route.push_back(RouteStop(deliveries[stop / 2].dropOff, stop / 2, DROP_OFF));
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Contains the annealing of courier routes. Moves reverse part of the route,
+ * and keeping running sums of the legs in both directions lets a reversal be
+ * costed in constant time, so a batch of them is scored at once (with AVX2
+ * gathers when available) and only the cheapest legal one is proposed
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+#include <chrono>
+
+// Number of reversals scored together, one AVX2 register of floats
+#define ANNEAL_BATCH 8
+
+// The route being annealed. stops holds the matrix index of every stop between two
+// sentinels: the first is the zero row after the depots, the last the zero column after
+// the destinations, so the ends of the route cost nothing like before the depots are added
+struct AnnealRoute {
+    std::vector<int> stops;
+    std::vector<int> position; // Position of each matrix index in stops
+    std::vector<float> leg; // leg[i] is the time from stops[i] to stops[i + 1]
+    std::vector<float> forward; // forward[i] is the time from stops[1] to stops[i]
+    std::vector<float> backward; // The same, but taking every leg the other way
+    std::vector<float> load; // Weight in the truck after each stop
+    std::vector<float> departure; // With time windows, the time each stop is left
+    std::vector<float> latest_arrival; // With time windows, the latest each stop can be arrived at
+};
+
+// Anneals the route until time_limit seconds after startTime, leaving the best route found
+// in route and its time in route_time. The statistics of the run are stored in stats if it is not null
+void anneal_route(std::vector<RouteStop> &route,
+                  double &route_time,
+                  const std::vector<DeliveryInfo>& deliveries,
+                  const float truck_capacity,
+                  const double time_limit,
+                  std::chrono::high_resolution_clock::time_point startTime,
+                  AnnealStats *stats
+);
+
+// Fills the anneal route from a route of stops (without depots)
+void set_anneal_route(AnnealRoute &anneal,
+                      const std::vector<RouteStop> &route,
+                      const std::vector<DeliveryInfo>& deliveries);
+
+// Recomputes the legs, sums and loads from a position to the end of the route
+void update_anneal_route(AnnealRoute &anneal,
+                         unsigned first_position,
+                         const std::vector<DeliveryInfo>& deliveries);
+
+// Converts the stops (without sentinels) back to a route
+void get_anneal_route(const AnnealRoute &anneal,
+                      std::vector<RouteStop> &route,
+                      const std::vector<DeliveryInfo>& deliveries);
+
+// Picks ANNEAL_BATCH random reversals of at least two stops
+void random_reversals(const AnnealRoute &anneal, int *first, int *last);
+
+// Change in route time from reversing stops[first[i]] to stops[last[i]] for ANNEAL_BATCH reversals
+void score_reversals(const AnnealRoute &anneal, const int *first, const int *last, float *change) __attribute__ ((hot));
+
+// Returns false if reversing the stops from first to last would drop off an item
+// before picking it up, go over the capacity or miss a time window
+bool reversal_is_legal(const AnnealRoute &anneal,
+                       int first,
+                       int last,
+                       const std::vector<DeliveryInfo>& deliveries,
+                       const float truck_capacity);
+
+// Reverses the stops from first to last and updates the sums
+void apply_reversal(AnnealRoute &anneal, int first, int last, const std::vector<DeliveryInfo>& deliveries);
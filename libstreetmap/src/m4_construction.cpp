@@ -0,0 +1,736 @@
+/*
+ * Contains the heuristics used to construct the initial courier route. All
+ * of them cost routes with the flat travel time matrix
+ */
+
+#include "m4_construction.h"
+#include "m4_courier.h"
+#include "m4_windows.h"
+#include "map_db.h"
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+
+// Regret given to a delivery that has fewer than REGRET_K places it can go
+#define MISSING_REGRET 1e9
+
+// Time added by placing the stop with the given matrix index in a gap of the route,
+// the ends of the route are free since the depots are only added after optimizing
+float gap_insertion_cost(const std::vector<RouteStop> &route, unsigned gap, unsigned stop_index);
+
+// Checks the windows of a dropoff put in a gap after the stop with matrix index previous, which
+// the truck leaves at departure, and of the stop after the gap
+bool drop_off_meets_windows(const std::vector<RouteStop> &route,
+                            const RouteSchedule &schedule,
+                            unsigned gap,
+                            unsigned previous,
+                            float departure,
+                            unsigned drop_off);
+
+// Finds the set (chain of merged trips) a delivery belongs to for savings_route
+unsigned find_chain(std::vector<unsigned> &chain_of, unsigned delivery_index);
+
+// Cheapest insertion of a delivery with its pickup in the gap, and its dropoff in the same gap or later.
+// drop_off_costs holds gap_insertion_cost of the dropoff for every gap. The cost is max if there is none
+InsertionResult best_insertion_from_gap(const std::vector<RouteStop> &route,
+                                        const std::vector<float> &loads,
+                                        const RouteSchedule &schedule,
+                                        const std::vector<float> &drop_off_costs,
+                                        unsigned delivery_index,
+                                        unsigned pick_up_gap,
+                                        const std::vector<DeliveryInfo>& deliveries,
+                                        const float truck_capacity);
+
+// Orders insertions by cost, then by the earliest gaps like find_best_insertion
+bool cheaper_insertion(const InsertionResult &a, const InsertionResult &b);
+
+// Finds the num_kept cheapest insertions of a delivery with different pickup gaps, cheapest first.
+// Returns false if the delivery can't be inserted anywhere
+bool find_cheapest_insertions(const std::vector<RouteStop> &route,
+                              const std::vector<float> &loads,
+                              unsigned delivery_index,
+                              const std::vector<DeliveryInfo>& deliveries,
+                              const float truck_capacity,
+                              unsigned num_kept,
+                              std::vector<InsertionResult> &cheapest);
+
+// Adds an insertion to the cheapest ones found by find_cheapest_insertions, replacing the
+// insertion with the same pickup gap if it is cheaper
+void keep_cheapest_insertion(std::vector<InsertionResult> &cheapest, const InsertionResult &insertion, unsigned num_kept);
+
+// Brings the cheapest insertions of a delivery up to date after another delivery was inserted at inserted.
+// Returns false if the delivery can't be inserted anywhere
+bool update_cheapest_insertions(const std::vector<RouteStop> &route,
+                                const std::vector<float> &loads,
+                                const RouteSchedule &schedule,
+                                const InsertionResult &inserted,
+                                unsigned delivery_index,
+                                const std::vector<DeliveryInfo>& deliveries,
+                                const float truck_capacity,
+                                unsigned num_kept,
+                                std::vector<InsertionResult> &cheapest);
+
+// How much worse the next cheapest insertions are than the cheapest one
+float insertion_regret(const std::vector<InsertionResult> &cheapest);
+
+
+bool construct_route(construction_strategy strategy,
+                     const std::vector<DeliveryInfo>& deliveries,
+                     const std::vector<unsigned>& depots,
+                     const float truck_capacity,
+                     bool randomize,
+                     std::chrono::high_resolution_clock::time_point deadline,
+                     std::vector<RouteStop> &route) {
+    bool insertion_fits = deliveries.size() <= INSERTION_MAX_DELIVERIES;
+
+    switch(strategy) {
+        case NEAREST_NEIGHBOUR:  return nearest_neighbour_route(deliveries, truck_capacity, route);
+        case CHEAPEST_INSERTION: return insertion_fits ? insertion_route(deliveries, truck_capacity, false, randomize, deadline, route)
+                                                       : nearest_neighbour_route(deliveries, truck_capacity, route);
+        case REGRET_INSERTION:   return insertion_fits ? insertion_route(deliveries, truck_capacity, true, randomize, deadline, route)
+                                                       : nearest_neighbour_route(deliveries, truck_capacity, route);
+        case SAVINGS:            return savings_route(deliveries, depots, randomize, route);
+        default:                 return nearest_neighbour_route(deliveries, truck_capacity, route);
+    }
+}
+
+
+std::chrono::high_resolution_clock::time_point construction_deadline(std::chrono::high_resolution_clock::time_point startTime,
+                                                                     double time_limit) {
+    auto currentTime = std::chrono::high_resolution_clock::now();
+    double wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime).count();
+
+    return currentTime + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+            std::chrono::duration<double>(std::max(0.0, time_limit - wallClock) * CONSTRUCTION_TIME_SHARE));
+}
+
+
+bool nearest_neighbour_route(const std::vector<DeliveryInfo>& deliveries,
+                             const float truck_capacity,
+                             std::vector<RouteStop> &route) {
+    route.clear();
+
+    // 0: waiting for pickup, 1: in the truck, 2: delivered
+    std::vector<char> state(deliveries.size(), 0);
+    float current_weight = 0;
+
+    // Start at a random pickup
+    unsigned first = pcg32_fast() % deliveries.size();
+    if (deliveries[first].itemWeight > truck_capacity) return false;
+
+    route.push_back(RouteStop(deliveries[first].pickUp, first, PICK_UP));
+    state[first] = 1;
+    current_weight += deliveries[first].itemWeight;
+    unsigned current = first * 2;
+
+    // Time the truck leaves the current stop, only stops that can still be reached in their window are visited
+    bool use_windows = has_time_windows();
+    float departure = use_windows ? window_departure(current, MAP.courier.depot_arrival[current]) : 0;
+
+    while (route.size() < deliveries.size() * 2) {
+        int closest = -1;
+        float closest_time = std::numeric_limits<float>::max();
+
+        // Go through the row of the current stop for the closest stop that can be visited
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            unsigned next;
+            if (state[i] == 0 && current_weight + deliveries[i].itemWeight <= truck_capacity) next = i * 2;
+            else if (state[i] == 1) next = i * 2 + 1;
+            else continue;
+
+            float time = flat_travel_time(current, next);
+            if (use_windows && departure + time > MAP.courier.window_latest[next]) continue;
+
+            if (time < closest_time) {
+                closest = next;
+                closest_time = time;
+            }
+        }
+
+        if (closest == -1) return false;
+
+        unsigned delivery_index = closest / 2;
+        if (closest % 2 == 0) {
+            route.push_back(RouteStop(deliveries[delivery_index].pickUp, delivery_index, PICK_UP));
+            current_weight += deliveries[delivery_index].itemWeight;
+        } else {
+            route.push_back(RouteStop(deliveries[delivery_index].dropOff, delivery_index, DROP_OFF));
+            current_weight -= deliveries[delivery_index].itemWeight;
+        }
+        state[delivery_index]++;
+        if (use_windows) departure = window_departure(closest, departure + closest_time);
+        current = closest;
+    }
+
+    return true;
+}
+
+
+bool insertion_route(const std::vector<DeliveryInfo>& deliveries,
+                     const float truck_capacity,
+                     bool use_regret,
+                     bool randomize,
+                     std::chrono::high_resolution_clock::time_point deadline,
+                     std::vector<RouteStop> &route) {
+    route.clear();
+
+    // Seed with a random delivery, or with the longest trip so the rest are built around it
+    unsigned first = 0;
+    if (randomize) {
+        first = pcg32_fast() % deliveries.size();
+    } else {
+        for (unsigned i = 1; i < deliveries.size(); ++i) {
+            if (flat_travel_time(i * 2, i * 2 + 1) > flat_travel_time(first * 2, first * 2 + 1)) first = i;
+        }
+    }
+    if (deliveries[first].itemWeight > truck_capacity) return false;
+
+    route.push_back(RouteStop(deliveries[first].pickUp, first, PICK_UP));
+    route.push_back(RouteStop(deliveries[first].dropOff, first, DROP_OFF));
+
+    std::vector<bool> is_routed(deliveries.size(), false);
+    is_routed[first] = true;
+
+    // Regret compares the cheapest REGRET_K pickup gaps, cheapest insertion only needs the cheapest
+    unsigned num_kept = use_regret ? REGRET_K : 1;
+    bool use_windows = has_time_windows();
+
+    std::vector<float> loads;
+    RouteSchedule schedule;
+    std::vector<std::vector<InsertionResult>> cheapest(deliveries.size());
+    std::vector<InsertionResult> checked;
+
+    compute_route_loads(route, deliveries, loads);
+    for (unsigned i = 0; i < deliveries.size(); ++i) {
+        if (!is_routed[i] && !find_cheapest_insertions(route, loads, i, deliveries, truck_capacity, num_kept, cheapest[i])) {
+            return false;
+        }
+    }
+
+    for (unsigned inserted = 1; inserted < deliveries.size(); ++inserted) {
+        if (std::chrono::high_resolution_clock::now() > deadline) return false;
+
+        int chosen = -1;
+        while (true) {
+            chosen = -1;
+            float chosen_regret = -1;
+
+            for (unsigned i = 0; i < deliveries.size(); ++i) {
+                if (is_routed[i]) continue;
+
+                const InsertionResult &insertion = cheapest[i].front();
+                if (use_regret) {
+                    float regret = insertion_regret(cheapest[i]);
+                    if (regret > chosen_regret || (regret == chosen_regret && insertion.cost < cheapest[chosen].front().cost)) {
+                        chosen = i;
+                        chosen_regret = regret;
+                    }
+                } else if (chosen == -1 || insertion.cost < cheapest[chosen].front().cost) {
+                    chosen = i;
+                }
+            }
+
+            if (chosen == -1) return false;
+
+            // Pushing the later stops back can make a kept insertion miss a window, so the
+            // chosen delivery is searched for again and the choice made again if it changed
+            if (!use_windows) break;
+            if (!find_cheapest_insertions(route, loads, chosen, deliveries, truck_capacity, num_kept, checked)) return false;
+
+            bool is_current = checked.size() == cheapest[chosen].size();
+            for (unsigned k = 0; is_current && k < checked.size(); ++k) {
+                is_current = checked[k].cost == cheapest[chosen][k].cost
+                        && checked[k].pick_up_gap == cheapest[chosen][k].pick_up_gap
+                        && checked[k].drop_off_gap == cheapest[chosen][k].drop_off_gap;
+            }
+            if (is_current) break;
+            cheapest[chosen] = checked;
+        }
+
+        InsertionResult chosen_insertion = cheapest[chosen].front();
+        insert_delivery(route, chosen, deliveries, chosen_insertion);
+        is_routed[chosen] = true;
+
+        compute_route_loads(route, deliveries, loads);
+        if (use_windows) compute_route_schedule(route, schedule);
+
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            if (!is_routed[i] && !update_cheapest_insertions(route, loads, schedule, chosen_insertion, i, deliveries,
+                                                             truck_capacity, num_kept, cheapest[i])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+bool savings_route(const std::vector<DeliveryInfo>& deliveries,
+                   const std::vector<unsigned>& depots,
+                   bool randomize,
+                   std::vector<RouteStop> &route) {
+    route.clear();
+
+    // The saving of driving straight from the dropoff of i to the pickup of j
+    // instead of returning to a depot in between
+    std::vector<std::pair<float, std::pair<unsigned, unsigned>>> savings;
+    savings.reserve(deliveries.size() * deliveries.size());
+
+    for (unsigned i = 0; i < deliveries.size(); ++i) {
+        float back_to_depot = closest_depot_time(i * 2 + 1, depots.size());
+
+        for (unsigned j = 0; j < deliveries.size(); ++j) {
+            if (i == j) continue;
+
+            float saving = back_to_depot + closest_depot_time(j * 2, depots.size()) - flat_travel_time(i * 2 + 1, j * 2);
+
+            // Noise of up to 10% so that threads running savings merge differently
+            if (randomize) saving *= 1.0 + (pcg32_fast() % 100) / 1000.0;
+
+            savings.push_back(std::make_pair(saving, std::make_pair(i, j)));
+        }
+    }
+
+    std::sort(savings.begin(), savings.end(),
+            [](const std::pair<float, std::pair<unsigned, unsigned>> &a,
+               const std::pair<float, std::pair<unsigned, unsigned>> &b) {
+                return a.first > b.first;
+            });
+
+    // Every delivery starts as its own trip
+    std::vector<int> next(deliveries.size(), -1);
+    std::vector<int> prev(deliveries.size(), -1);
+    std::vector<unsigned> chain_of(deliveries.size());
+    std::iota(chain_of.begin(), chain_of.end(), 0);
+
+    // Merge the end of one trip into the start of another, largest savings first
+    for (auto &saving : savings) {
+        unsigned i = saving.second.first;
+        unsigned j = saving.second.second;
+
+        if (next[i] != -1 || prev[j] != -1) continue;
+
+        unsigned chain_i = find_chain(chain_of, i);
+        unsigned chain_j = find_chain(chain_of, j);
+        if (chain_i == chain_j) continue;
+
+        next[i] = j;
+        prev[j] = i;
+        chain_of[chain_j] = chain_i;
+    }
+
+    // Only one trip is left, follow it from its start
+    int current = std::find(prev.begin(), prev.end(), -1) - prev.begin();
+    while (current != -1 && route.size() < deliveries.size() * 2) {
+        route.push_back(RouteStop(deliveries[current].pickUp, current, PICK_UP));
+        route.push_back(RouteStop(deliveries[current].dropOff, current, DROP_OFF));
+        current = next[current];
+    }
+
+    return route.size() == deliveries.size() * 2;
+}
+
+
+void compute_route_loads(const std::vector<RouteStop> &route,
+                         const std::vector<DeliveryInfo>& deliveries,
+                         std::vector<float> &loads) {
+    loads.resize(route.size());
+
+    float current_weight = 0;
+    for (unsigned i = 0; i < route.size(); ++i) {
+        if (route[i].type == PICK_UP) current_weight += deliveries[route[i].delivery_index].itemWeight;
+        else current_weight -= deliveries[route[i].delivery_index].itemWeight;
+
+        loads[i] = current_weight;
+    }
+}
+
+
+bool find_best_insertion(const std::vector<RouteStop> &route,
+                         const std::vector<float> &loads,
+                         unsigned delivery_index,
+                         const std::vector<DeliveryInfo>& deliveries,
+                         const float truck_capacity,
+                         InsertionResult &best,
+                         std::vector<InsertionResult> *k_best) {
+    unsigned pick_up = delivery_index * 2;
+    unsigned drop_off = delivery_index * 2 + 1;
+    float weight = deliveries[delivery_index].itemWeight;
+    unsigned size = route.size();
+
+    best = InsertionResult();
+    if (k_best != nullptr) k_best->clear();
+    bool found = false;
+
+    // With windows, the stops pushed later by the pickup are walked along with the dropoff gap for every pickup gap
+    RouteSchedule schedule;
+    if (has_time_windows()) compute_route_schedule(route, schedule);
+
+    // The cost of the dropoff on its own is the same for every pickup gap before it
+    std::vector<float> drop_off_costs(size + 1);
+    for (unsigned gap = 0; gap <= size; ++gap) {
+        drop_off_costs[gap] = gap_insertion_cost(route, gap, drop_off);
+    }
+
+    // Without windows, the gaps the item can be carried to from each pickup gap only move forward, so the
+    // cheapest dropoff gap after each pickup gap is the front of a queue of gaps with rising costs
+    std::vector<unsigned> drop_off_queue(size + 1);
+    unsigned queue_front = 0;
+    unsigned queue_back = 0;
+    unsigned last_gap = 0;
+
+    for (unsigned pick_up_gap = 0; pick_up_gap <= size; ++pick_up_gap) {
+        InsertionResult insertion;
+        if (has_time_windows()) {
+            insertion = best_insertion_from_gap(route, loads, schedule, drop_off_costs, delivery_index,
+                                                pick_up_gap, deliveries, truck_capacity);
+        } else {
+            // Dropoff gaps up to last_gap can be reached without going over the capacity
+            last_gap = std::max(last_gap, pick_up_gap);
+            while (last_gap < size && loads[last_gap] + weight <= truck_capacity) {
+                ++last_gap;
+                while (queue_back > queue_front && drop_off_costs[drop_off_queue[queue_back - 1]] > drop_off_costs[last_gap]) --queue_back;
+                drop_off_queue[queue_back++] = last_gap;
+            }
+            while (queue_back > queue_front && drop_off_queue[queue_front] <= pick_up_gap) ++queue_front;
+
+            float load_before = pick_up_gap > 0 ? loads[pick_up_gap - 1] : 0;
+            if (load_before + weight > truck_capacity) continue;
+
+            // Dropoff straight after the pickup, or at the cheapest gap later in the route
+            insertion.cost = flat_travel_time(pick_up, drop_off);
+            if (pick_up_gap > 0) insertion.cost += flat_travel_time(stop_matrix_index(route[pick_up_gap - 1]), pick_up);
+            if (pick_up_gap < size) insertion.cost += flat_travel_time(drop_off, stop_matrix_index(route[pick_up_gap]));
+            if (pick_up_gap > 0 && pick_up_gap < size) {
+                insertion.cost -= flat_travel_time(stop_matrix_index(route[pick_up_gap - 1]), stop_matrix_index(route[pick_up_gap]));
+            }
+            insertion.pick_up_gap = pick_up_gap;
+            insertion.drop_off_gap = pick_up_gap;
+
+            if (queue_back > queue_front) {
+                float cost = gap_insertion_cost(route, pick_up_gap, pick_up) + drop_off_costs[drop_off_queue[queue_front]];
+                if (cost < insertion.cost) {
+                    insertion.cost = cost;
+                    insertion.drop_off_gap = drop_off_queue[queue_front];
+                }
+            }
+        }
+
+        if (insertion.cost == std::numeric_limits<float>::max()) continue;
+        if (k_best != nullptr) k_best->push_back(insertion);
+
+        if (insertion.cost < best.cost) {
+            best = insertion;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+
+InsertionResult best_insertion_from_gap(const std::vector<RouteStop> &route,
+                                        const std::vector<float> &loads,
+                                        const RouteSchedule &schedule,
+                                        const std::vector<float> &drop_off_costs,
+                                        unsigned delivery_index,
+                                        unsigned pick_up_gap,
+                                        const std::vector<DeliveryInfo>& deliveries,
+                                        const float truck_capacity) {
+    unsigned pick_up = delivery_index * 2;
+    unsigned drop_off = delivery_index * 2 + 1;
+    float weight = deliveries[delivery_index].itemWeight;
+    unsigned size = route.size();
+    bool use_windows = has_time_windows();
+
+    InsertionResult best;
+    best.pick_up_gap = pick_up_gap;
+
+    float load_before = pick_up_gap > 0 ? loads[pick_up_gap - 1] : 0;
+    if (load_before + weight > truck_capacity) return best;
+
+    // Time the truck leaves the pickup, and the stop it was last at
+    float departure = 0;
+    unsigned previous = pick_up;
+    if (use_windows) {
+        float arrival = pick_up_gap > 0
+                ? schedule.departure[pick_up_gap - 1] + flat_travel_time(stop_matrix_index(route[pick_up_gap - 1]), pick_up)
+                : MAP.courier.depot_arrival[pick_up];
+        if (arrival > MAP.courier.window_latest[pick_up]) return best;
+
+        departure = window_departure(pick_up, arrival);
+    }
+
+    // Dropoff straight after the pickup
+    float gap_best = flat_travel_time(pick_up, drop_off);
+    if (pick_up_gap > 0) gap_best += flat_travel_time(stop_matrix_index(route[pick_up_gap - 1]), pick_up);
+    if (pick_up_gap < size) gap_best += flat_travel_time(drop_off, stop_matrix_index(route[pick_up_gap]));
+    if (pick_up_gap > 0 && pick_up_gap < size) {
+        gap_best -= flat_travel_time(stop_matrix_index(route[pick_up_gap - 1]), stop_matrix_index(route[pick_up_gap]));
+    }
+    unsigned gap_best_drop_off = pick_up_gap;
+
+    if (use_windows && !drop_off_meets_windows(route, schedule, pick_up_gap, previous, departure, drop_off)) {
+        gap_best = std::numeric_limits<float>::max();
+    }
+
+    // Dropoff later in the route, the item is carried through every stop in between
+    float pick_up_cost = gap_insertion_cost(route, pick_up_gap, pick_up);
+    for (unsigned drop_off_gap = pick_up_gap + 1; drop_off_gap <= size; ++drop_off_gap) {
+        if (loads[drop_off_gap - 1] + weight > truck_capacity) break;
+
+        if (use_windows) {
+            // The stop before the gap is now reached later, if that misses its window so does every later gap
+            unsigned stop = stop_matrix_index(route[drop_off_gap - 1]);
+            float arrival = departure + flat_travel_time(previous, stop);
+            if (arrival > MAP.courier.window_latest[stop]) break;
+
+            departure = window_departure(stop, arrival);
+            previous = stop;
+        }
+
+        float cost = pick_up_cost + drop_off_costs[drop_off_gap];
+        if (cost < gap_best && (!use_windows
+                || drop_off_meets_windows(route, schedule, drop_off_gap, previous, departure, drop_off))) {
+            gap_best = cost;
+            gap_best_drop_off = drop_off_gap;
+        }
+    }
+
+    best.cost = gap_best;
+    best.drop_off_gap = gap_best_drop_off;
+    return best;
+}
+
+
+bool cheaper_insertion(const InsertionResult &a, const InsertionResult &b) {
+    if (a.cost != b.cost) return a.cost < b.cost;
+    if (a.pick_up_gap != b.pick_up_gap) return a.pick_up_gap < b.pick_up_gap;
+    return a.drop_off_gap < b.drop_off_gap;
+}
+
+
+bool find_cheapest_insertions(const std::vector<RouteStop> &route,
+                              const std::vector<float> &loads,
+                              unsigned delivery_index,
+                              const std::vector<DeliveryInfo>& deliveries,
+                              const float truck_capacity,
+                              unsigned num_kept,
+                              std::vector<InsertionResult> &cheapest) {
+    InsertionResult best;
+    if (!find_best_insertion(route, loads, delivery_index, deliveries, truck_capacity, best, &cheapest)) return false;
+
+    unsigned num_sorted = std::min((unsigned)cheapest.size(), num_kept);
+    std::partial_sort(cheapest.begin(), cheapest.begin() + num_sorted, cheapest.end(), cheaper_insertion);
+    cheapest.resize(num_sorted);
+    return true;
+}
+
+
+void keep_cheapest_insertion(std::vector<InsertionResult> &cheapest, const InsertionResult &insertion, unsigned num_kept) {
+    if (insertion.cost == std::numeric_limits<float>::max()) return;
+
+    // Most insertions are more expensive than every kept one, including any with the same pickup gap
+    if (cheapest.size() == num_kept && !cheaper_insertion(insertion, cheapest.back())) return;
+
+    std::vector<InsertionResult>::iterator same_gap = std::find_if(cheapest.begin(), cheapest.end(),
+            [&](const InsertionResult &kept) {
+                return kept.pick_up_gap == insertion.pick_up_gap;
+            });
+
+    if (same_gap != cheapest.end()) {
+        if (!cheaper_insertion(insertion, *same_gap)) return;
+        *same_gap = insertion;
+    } else {
+        cheapest.push_back(insertion);
+    }
+
+    std::sort(cheapest.begin(), cheapest.end(), cheaper_insertion);
+    if (cheapest.size() > num_kept) cheapest.resize(num_kept);
+}
+
+
+// The route only changed at the two gaps the other delivery went into, every other gap still joins
+// the same stops. A kept insertion using neither gap costs the same as before, and the others are
+// found again from scratch. Every new insertion uses one of the gaps next to the stops just inserted
+// for its pickup or dropoff, so only those are searched, in O(route) instead of O(route^2).
+// The cheapest insertions of the pickup gaps that weren't kept can't become cheaper any other way
+bool update_cheapest_insertions(const std::vector<RouteStop> &route,
+                                const std::vector<float> &loads,
+                                const RouteSchedule &schedule,
+                                const InsertionResult &inserted,
+                                unsigned delivery_index,
+                                const std::vector<DeliveryInfo>& deliveries,
+                                const float truck_capacity,
+                                unsigned num_kept,
+                                std::vector<InsertionResult> &cheapest) {
+    unsigned pick_up = delivery_index * 2;
+    unsigned drop_off = delivery_index * 2 + 1;
+    float weight = deliveries[delivery_index].itemWeight;
+    unsigned old_pick_up_gap = inserted.pick_up_gap;
+    unsigned old_drop_off_gap = inserted.drop_off_gap;
+    bool use_windows = has_time_windows();
+
+    bool is_broken = false;
+    for (InsertionResult &kept : cheapest) {
+        if (kept.pick_up_gap == old_pick_up_gap || kept.pick_up_gap == old_drop_off_gap
+                || kept.drop_off_gap == old_pick_up_gap || kept.drop_off_gap == old_drop_off_gap) {
+            is_broken = true;
+            break;
+        }
+
+        // Gaps after the inserted pickup moved back one stop, and after the inserted dropoff two
+        kept.pick_up_gap += (kept.pick_up_gap > old_pick_up_gap) + (kept.pick_up_gap > old_drop_off_gap);
+        kept.drop_off_gap += (kept.drop_off_gap > old_pick_up_gap) + (kept.drop_off_gap > old_drop_off_gap);
+
+        // The other item may not leave room in the truck any more
+        float load_before = kept.pick_up_gap > 0 ? loads[kept.pick_up_gap - 1] : 0;
+        is_broken = load_before + weight > truck_capacity;
+        for (unsigned stop = kept.pick_up_gap; !is_broken && stop < kept.drop_off_gap; ++stop) {
+            is_broken = loads[stop] + weight > truck_capacity;
+        }
+        if (is_broken) break;
+    }
+
+    if (is_broken) return find_cheapest_insertions(route, loads, delivery_index, deliveries, truck_capacity, num_kept, cheapest);
+
+    // The gaps before and after the inserted pickup and dropoff, in order
+    const unsigned num_new_gaps = 4;
+    unsigned new_gaps[num_new_gaps] = {old_pick_up_gap, old_pick_up_gap + 1, old_drop_off_gap + 1, old_drop_off_gap + 2};
+
+    // Only the gaps from the first new gap on can take the dropoff
+    std::vector<float> drop_off_costs(route.size() + 1);
+    for (unsigned gap = new_gaps[0]; gap <= route.size(); ++gap) {
+        drop_off_costs[gap] = gap_insertion_cost(route, gap, drop_off);
+    }
+
+    // Pickup in a new gap, with the dropoff anywhere after it
+    for (unsigned gap : new_gaps) {
+        keep_cheapest_insertion(cheapest, best_insertion_from_gap(route, loads, schedule, drop_off_costs, delivery_index,
+                                                                  gap, deliveries, truck_capacity), num_kept);
+    }
+
+    // Dropoff in a new gap, with the pickup in any earlier gap. The windows are only checked at the two
+    // stops, the insertion is checked fully if it is chosen
+    bool drop_off_fits[num_new_gaps];
+    float max_loads[num_new_gaps]; // Heaviest load carried from the pickup gap to each new gap
+    for (unsigned k = 0; k < num_new_gaps; ++k) {
+        unsigned gap = new_gaps[k];
+        drop_off_fits[k] = !use_windows || gap == 0 || drop_off_meets_windows(route, schedule, gap, stop_matrix_index(route[gap - 1]),
+                                                                              schedule.departure[gap - 1], drop_off);
+        max_loads[k] = 0;
+    }
+
+    for (int pick_up_gap = (int)new_gaps[num_new_gaps - 1] - 1; pick_up_gap >= 0; --pick_up_gap) {
+        for (unsigned k = 0; k < num_new_gaps; ++k) {
+            if ((unsigned)pick_up_gap < new_gaps[k]) max_loads[k] = std::max(max_loads[k], loads[pick_up_gap]);
+        }
+
+        // The new gaps are in order, so the item can't be carried to any of them
+        if (max_loads[0] + weight > truck_capacity) break;
+
+        float load_before = pick_up_gap > 0 ? loads[pick_up_gap - 1] : 0;
+        if (load_before + weight > truck_capacity) continue;
+
+        if (use_windows) {
+            float arrival = pick_up_gap > 0
+                    ? schedule.departure[pick_up_gap - 1] + flat_travel_time(stop_matrix_index(route[pick_up_gap - 1]), pick_up)
+                    : MAP.courier.depot_arrival[pick_up];
+            if (arrival > MAP.courier.window_latest[pick_up]) continue;
+        }
+
+        InsertionResult insertion;
+        insertion.pick_up_gap = pick_up_gap;
+        float pick_up_cost = gap_insertion_cost(route, pick_up_gap, pick_up);
+
+        for (unsigned k = 0; k < num_new_gaps; ++k) {
+            if ((unsigned)pick_up_gap >= new_gaps[k] || !drop_off_fits[k] || max_loads[k] + weight > truck_capacity) continue;
+
+            insertion.cost = pick_up_cost + drop_off_costs[new_gaps[k]];
+            insertion.drop_off_gap = new_gaps[k];
+            keep_cheapest_insertion(cheapest, insertion, num_kept);
+        }
+    }
+
+    return !cheapest.empty();
+}
+
+
+float insertion_regret(const std::vector<InsertionResult> &cheapest) {
+    float regret = 0;
+    for (unsigned k = 1; k < REGRET_K; ++k) {
+        regret += k < cheapest.size() ? cheapest[k].cost - cheapest[0].cost : MISSING_REGRET;
+    }
+
+    return regret;
+}
+
+
+void insert_delivery(std::vector<RouteStop> &route,
+                     unsigned delivery_index,
+                     const std::vector<DeliveryInfo>& deliveries,
+                     const InsertionResult &insertion) {
+    // Dropoff first so the pickup gap is still correct, when the gaps are equal the pickup ends up first
+    route.insert(route.begin() + insertion.drop_off_gap, RouteStop(deliveries[delivery_index].dropOff, delivery_index, DROP_OFF));
+    route.insert(route.begin() + insertion.pick_up_gap, RouteStop(deliveries[delivery_index].pickUp, delivery_index, PICK_UP));
+}
+
+
+bool drop_off_meets_windows(const std::vector<RouteStop> &route,
+                            const RouteSchedule &schedule,
+                            unsigned gap,
+                            unsigned previous,
+                            float departure,
+                            unsigned drop_off) {
+    float arrival = departure + flat_travel_time(previous, drop_off);
+    if (arrival > MAP.courier.window_latest[drop_off]) return false;
+    if (gap == route.size()) return true;
+
+    float next_arrival = window_departure(drop_off, arrival) + flat_travel_time(drop_off, stop_matrix_index(route[gap]));
+    return next_arrival <= schedule.latest_arrival[gap];
+}
+
+
+void remove_delivery(std::vector<RouteStop> &route, int delivery_index) {
+    route.erase(std::remove_if(route.begin(), route.end(),
+            [delivery_index](const RouteStop &stop) {
+                return stop.delivery_index == delivery_index;
+            }), route.end());
+}
+
+
+float gap_insertion_cost(const std::vector<RouteStop> &route, unsigned gap, unsigned stop_index) {
+    float cost = 0;
+
+    if (gap > 0) cost += flat_travel_time(stop_matrix_index(route[gap - 1]), stop_index);
+    if (gap < route.size()) cost += flat_travel_time(stop_index, stop_matrix_index(route[gap]));
+    if (gap > 0 && gap < route.size()) {
+        cost -= flat_travel_time(stop_matrix_index(route[gap - 1]), stop_matrix_index(route[gap]));
+    }
+
+    return cost;
+}
+
+
+float closest_depot_time(unsigned stop_index, unsigned num_depots) {
+    float closest = std::numeric_limits<float>::max();
+
+    // The depot rows are after the rows of the pickups and dropoffs
+    for (unsigned i = 0; i < num_depots; ++i) {
+        closest = std::min(closest, flat_travel_time(MAP.courier.num_columns + i, stop_index));
+    }
+
+    return closest;
+}
+
+
+unsigned find_chain(std::vector<unsigned> &chain_of, unsigned delivery_index) {
+    while (chain_of[delivery_index] != delivery_index) {
+        chain_of[delivery_index] = chain_of[chain_of[delivery_index]];
+        delivery_index = chain_of[delivery_index];
+    }
+
+    return delivery_index;
+}
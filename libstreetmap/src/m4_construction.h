@@ -0,0 +1,104 @@
+/*
+ * Contains the heuristics used to construct the initial courier route before
+ * it is optimized. Every thread runs one strategy and the best feasible routes
+ * found are used to seed the annealing
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+#include <chrono>
+
+// Number of costs compared for regret insertion
+#define REGRET_K 3
+
+// Insertion strategies take O(N^3), past this many deliveries nearest neighbour is used instead.
+// Only instances with time windows are this large, the others are solved sparsely
+#define INSERTION_MAX_DELIVERIES 400
+
+// Share of the time left the insertion strategies may take before giving up
+#define CONSTRUCTION_TIME_SHARE 0.2
+
+// Number of the best constructed routes that are used to seed annealing
+#define CONSTRUCTION_SEED_ROUTES 4
+
+enum construction_strategy {
+    NEAREST_NEIGHBOUR,
+    CHEAPEST_INSERTION,
+    REGRET_INSERTION,
+    SAVINGS,
+    NUM_CONSTRUCTION_STRATEGIES
+};
+
+// Where a delivery can be inserted into a route and what it costs. A gap is
+// the position before the stop with the same index (gap route.size() is the end)
+struct InsertionResult {
+    float cost = std::numeric_limits<float>::max();
+    unsigned pick_up_gap = 0;
+    unsigned drop_off_gap = 0;
+};
+
+// Builds a route (without depots) using the given strategy, the randomize flag
+// lets multiple threads running the same strategy produce different routes.
+// Returns false if no route could be built, or the insertion strategies ran past the deadline
+bool construct_route(construction_strategy strategy,
+                     const std::vector<DeliveryInfo>& deliveries,
+                     const std::vector<unsigned>& depots,
+                     const float truck_capacity,
+                     bool randomize,
+                     std::chrono::high_resolution_clock::time_point deadline,
+                     std::vector<RouteStop> &route);
+
+// Deadline of construct_route starting now, for a call that started at startTime and may take time_limit seconds
+std::chrono::high_resolution_clock::time_point construction_deadline(std::chrono::high_resolution_clock::time_point startTime,
+                                                                     double time_limit);
+
+// Repeatedly travels to the closest pickup that fits in the truck or closest
+// dropoff of an item in the truck, starting from a random pickup
+bool nearest_neighbour_route(const std::vector<DeliveryInfo>& deliveries,
+                             const float truck_capacity,
+                             std::vector<RouteStop> &route);
+
+// Inserts deliveries one at a time where they add the least time. With use_regret,
+// the delivery that would lose the most by waiting (compared over REGRET_K positions) goes first.
+// The cheapest insertions of every delivery are kept between steps, and only searched for again
+// around the stops just inserted, so building the route takes O(N^3) without time windows
+bool insertion_route(const std::vector<DeliveryInfo>& deliveries,
+                     const float truck_capacity,
+                     bool use_regret,
+                     bool randomize,
+                     std::chrono::high_resolution_clock::time_point deadline,
+                     std::vector<RouteStop> &route);
+
+// Starts with every delivery as its own pickup->dropoff trip from a depot and merges
+// the trips with the largest savings until one route is left
+bool savings_route(const std::vector<DeliveryInfo>& deliveries,
+                   const std::vector<unsigned>& depots,
+                   bool randomize,
+                   std::vector<RouteStop> &route);
+
+// Fills loads with the weight in the truck after each stop of the route
+void compute_route_loads(const std::vector<RouteStop> &route,
+                         const std::vector<DeliveryInfo>& deliveries,
+                         std::vector<float> &loads);
+
+// Finds the cheapest position to insert a delivery that respects the capacity. If k_best
+// is not null, it is filled with the cheapest insertion for each pickup position (unsorted)
+// Returns false if the delivery can't be inserted anywhere
+bool find_best_insertion(const std::vector<RouteStop> &route,
+                         const std::vector<float> &loads,
+                         unsigned delivery_index,
+                         const std::vector<DeliveryInfo>& deliveries,
+                         const float truck_capacity,
+                         InsertionResult &best,
+                         std::vector<InsertionResult> *k_best);
+
+// Inserts the pickup and dropoff of a delivery at the gaps found by find_best_insertion
+void insert_delivery(std::vector<RouteStop> &route,
+                     unsigned delivery_index,
+                     const std::vector<DeliveryInfo>& deliveries,
+                     const InsertionResult &insertion);
+
+// Removes both stops of a delivery from the route
+void remove_delivery(std::vector<RouteStop> &route, int delivery_index);
@@ -0,0 +1,160 @@
+/*
+ * Contains the definitions shared between the files solving the travelling
+ * courier problem (m4), such as the stops that make up a route and access to
+ * the travel time matrix
+ */
+
+#pragma once
+
+#include "m4.h"
+#include "map_db.h"
+#include <vector>
+#include <unordered_map>
+#include <limits>
+#include <stdint.h>
+#include <chrono>
+
+#define NO_ROUTE std::numeric_limits<unsigned>::max()
+
+enum stop_type {PICK_UP, DROP_OFF};
+
+struct RouteStop {
+    //used for the route to accelerate mutations
+
+    RouteStop()
+        : intersection_id(0),
+          delivery_index(0),
+          type(PICK_UP) {};
+
+    RouteStop(unsigned _intersection_id, int _delivery_index, stop_type _type)
+        : intersection_id(_intersection_id),
+          delivery_index(_delivery_index),
+          type(_type){};
+
+    //the intersection id
+    unsigned intersection_id;
+
+    //the index of the stop in the deliveries vector
+    int delivery_index;
+
+    //whether this stop is a pickUp
+    stop_type type;
+};
+
+// How the route is optimized once it is constructed
+enum courier_mode {ANNEAL_MODE, MEMETIC_MODE};
+
+// Earliest and latest time (seconds after leaving the depot) the truck can arrive at a stop,
+// arriving early means waiting until the window opens
+struct TimeWindow {
+    float earliest = 0;
+    float latest = std::numeric_limits<float>::max();
+};
+
+struct DeliveryWindows {
+    TimeWindow pick_up;
+    TimeWindow drop_off;
+};
+
+// Choices made for a single call of traveling_courier
+struct CourierOptions {
+    courier_mode mode = ANNEAL_MODE;
+    std::vector<DeliveryWindows> windows; // One for each delivery, or empty if there are no windows. No route is found if the sizes differ
+    double time_limit = 0; // Seconds the call may take, 0 uses the default limit
+};
+
+// Solves the instance like traveling_courier, with the choices given in options
+std::vector<CourierSubpath> traveling_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const float truck_capacity,
+        const CourierOptions &options);
+
+// The row/column of a stop in the travel time matrix
+// To access certain pickup: index * 2
+// To access certain dropoff: index * 2 + 1
+inline unsigned stop_matrix_index(const RouteStop &stop) {
+    return stop.type == PICK_UP ? stop.delivery_index*2 : stop.delivery_index*2+1;
+}
+
+// Travel time between two matrix indexes, read from the flat copy of the matrix
+inline float flat_travel_time(unsigned from_index, unsigned to_index) {
+    return MAP.courier.flat_time_between_deliveries[from_index * MAP.courier.row_stride + to_index];
+}
+
+// Time from the closest depot to a matrix index
+float closest_depot_time(unsigned stop_index, unsigned num_depots);
+
+//fast random number generator, each thread has its own state
+uint32_t pcg32_fast() __attribute__ ((hot));
+
+//initialize fast random number generator
+void pcg32_fast_init(uint64_t seed);
+
+// Makes every thread seed its random numbers with seed plus its thread number, so runs
+// can be repeated. A negative seed goes back to seeding from rand()
+void set_courier_seed(long long seed);
+
+// The seed the calling thread initializes pcg32_fast with
+uint64_t thread_seed();
+
+//returns time of route and has legal flag, can set to false if non-reachable route
+bool validate_route(std::vector<RouteStop> &route,
+        double &time,
+        std::vector<bool> &is_in_truck,
+        const std::vector<DeliveryInfo>& deliveries,
+        const float &capacity
+) __attribute__ ((hot));
+
+//returns time of route
+double get_route_time(std::vector<RouteStop> &route);
+
+// Rebuilds the street segments between two intersections from the predecessors stored for
+// the row starting at intersect_id_start, returns false if the route can't be rebuilt
+bool backtrace_courier_leg(
+        const std::unordered_map<unsigned, int> &predecessors,
+        const unsigned intersect_id_start,
+        const unsigned intersect_id_end,
+        std::vector<unsigned> &path
+);
+
+// Rebuilds the street segments between two intersections from the successors stored for
+// a column searched backwards to intersect_id_end, returns false if the route can't be rebuilt
+bool forward_trace_courier_leg(
+        const std::unordered_map<unsigned, int> &successors,
+        const unsigned intersect_id_start,
+        const unsigned intersect_id_end,
+        std::vector<unsigned> &path
+);
+
+// Searches from an intersection to every destination, filling in the given row of
+// time_between_deliveries. If predecessors is not null, the edges leading to every destination found are kept in it
+void multi_dest_dijkistra(
+		  const unsigned intersect_id_start, 
+                  const unsigned row_index,
+                  std::vector<Node*> &intersection_nodes,
+                  const std::vector<unsigned> &dests,
+                  const float right_turn_penalty, 
+                  const float left_turn_penalty,
+                  std::unordered_map<unsigned, int> *predecessors
+); 
+
+// Copies time_between_deliveries into the flat matrix
+void build_flat_matrix();
+
+// Adds the closest depots to both ends of the route and returns the time to them
+double add_closest_depots_to_route(
+        std::vector<RouteStop> &simple_route,
+        const std::vector<unsigned>& depots
+);
+
+// Converts the route (with depots) into the legs that are returned
+void build_route(
+        std::vector<RouteStop> &simple_route,
+        std::vector<CourierSubpath> &complete_route,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty, 
+        const float left_turn_penalty 
+);
@@ -0,0 +1,135 @@
+/*
+ * Contains the exact solver used for small courier instances. A state is
+ * stored in base 3, with one digit per request (0: waiting, 1: in the truck,
+ * 2: delivered), so visiting a stop always makes the state larger and the
+ * states can be solved in increasing order
+ */
+
+#include "m4_exact.h"
+#include "m4_courier.h"
+#include "map_db.h"
+#include <vector>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+
+// Number of states solved between checks of the time limit
+#define EXACT_CLOCK_CHECK 1024
+
+// Marks a state/last stop pair that hasn't been reached
+#define UNREACHED std::numeric_limits<float>::max()
+
+
+bool solve_exact_route(const std::vector<DeliveryInfo>& deliveries,
+                       const std::vector<unsigned>& depots,
+                       const float truck_capacity,
+                       std::vector<RouteStop> &route,
+                       double &time) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    unsigned num_deliveries = deliveries.size();
+
+    if (num_deliveries == 0 || num_deliveries > EXACT_MAX_DELIVERIES) return false;
+
+    unsigned num_stops = num_deliveries * 2;
+
+    // The value of a digit in each position
+    std::vector<unsigned> power_of_3(num_deliveries + 1, 1);
+    for (unsigned i = 1; i <= num_deliveries; ++i) power_of_3[i] = power_of_3[i - 1] * 3;
+
+    unsigned num_states = power_of_3[num_deliveries];
+
+    // Fastest time to reach each state ending at a certain stop (matrix index), and the stop before it.
+    // The previous state is always the current state minus the digit of the last request
+    std::vector<float> best_time(num_states * num_stops, UNREACHED);
+    std::vector<char> previous_stop(num_states * num_stops, -1);
+
+    // Start with the pickup of any request that fits in the truck
+    for (unsigned i = 0; i < num_deliveries; ++i) {
+        float start_time = closest_depot_time(i * 2, depots.size());
+        if (deliveries[i].itemWeight > truck_capacity || start_time >= (float)NO_ROUTE) continue;
+
+        best_time[power_of_3[i] * num_stops + i * 2] = start_time;
+    }
+
+    std::vector<char> digits(num_deliveries);
+
+    for (unsigned state = 1; state < num_states; ++state) {
+        if (state % EXACT_CLOCK_CHECK == 0) {
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            auto wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime);
+
+            if (wallClock.count() > EXACT_TIME_LIMIT) return false;
+        }
+
+        // Decode the state and the weight in the truck
+        float current_weight = 0;
+        unsigned remaining = state;
+        for (unsigned i = 0; i < num_deliveries; ++i) {
+            digits[i] = remaining % 3;
+            remaining /= 3;
+            if (digits[i] == 1) current_weight += deliveries[i].itemWeight;
+        }
+
+        if (current_weight > truck_capacity) continue;
+
+        for (unsigned last = 0; last < num_stops; ++last) {
+            float time_to_now = best_time[state * num_stops + last];
+            if (time_to_now == UNREACHED) continue;
+
+            // Visit the pickup of a waiting request or the dropoff of a carried one
+            for (unsigned i = 0; i < num_deliveries; ++i) {
+                unsigned next;
+                if (digits[i] == 0 && current_weight + deliveries[i].itemWeight <= truck_capacity) next = i * 2;
+                else if (digits[i] == 1) next = i * 2 + 1;
+                else continue;
+
+                float travel_time = flat_travel_time(last, next);
+                if (travel_time >= (float)NO_ROUTE) continue;
+
+                unsigned index = (state + power_of_3[i]) * num_stops + next;
+                if (time_to_now + travel_time < best_time[index]) {
+                    best_time[index] = time_to_now + travel_time;
+                    previous_stop[index] = last;
+                }
+            }
+        }
+    }
+
+    // Every request is delivered in the last state, add the closest depot to the last dropoff.
+    // There are no depot columns, so the time back is taken as the time from the depot to the dropoff
+    unsigned final_state = num_states - 1;
+    int best_last = -1;
+    float best_total = UNREACHED;
+    for (unsigned i = 0; i < num_deliveries; ++i) {
+        float time_to_now = best_time[final_state * num_stops + i * 2 + 1];
+        float end_time = closest_depot_time(i * 2 + 1, depots.size());
+        if (time_to_now == UNREACHED || end_time >= (float)NO_ROUTE) continue;
+
+        if (time_to_now + end_time < best_total) {
+            best_total = time_to_now + end_time;
+            best_last = i * 2 + 1;
+        }
+    }
+
+    if (best_last == -1) return false;
+
+    // Walk back through the states to get the route
+    route.clear();
+    unsigned state = final_state;
+    int stop = best_last;
+    while (stop != -1) {
+        unsigned delivery_index = stop / 2;
+        stop_type type = stop % 2 == 0 ? PICK_UP : DROP_OFF;
+        unsigned intersection = type == PICK_UP ? deliveries[delivery_index].pickUp : deliveries[delivery_index].dropOff;
+        route.push_back(RouteStop(intersection, delivery_index, type));
+
+        int previous = previous_stop[state * num_stops + stop];
+        state -= power_of_3[delivery_index];
+        stop = previous;
+    }
+
+    std::reverse(route.begin(), route.end());
+    time = best_total;
+
+    return route.size() == num_stops;
+}
@@ -0,0 +1,25 @@
+/*
+ * Contains the exact solver used for small courier instances. Every request
+ * is either waiting, in the truck or delivered, so the orders that visit the
+ * same set of stops are merged with dynamic programming over those states
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+
+// Largest number of deliveries solved exactly (3^10 states for each last stop)
+#define EXACT_MAX_DELIVERIES 10
+
+// Seconds the exact solver may run before giving up and leaving it to the heuristic
+#define EXACT_TIME_LIMIT 2.0
+
+// Finds the fastest legal route (without depots) through every pickup and dropoff,
+// counting the depots the same way add_closest_depots_to_route does.
+// Returns false if there are too many deliveries, no legal route, or it runs out of time
+bool solve_exact_route(const std::vector<DeliveryInfo>& deliveries,
+                       const std::vector<unsigned>& depots,
+                       const float truck_capacity,
+                       std::vector<RouteStop> &route,
+                       double &time);
@@ -0,0 +1,483 @@
+/*
+ * Contains the fleet courier mode. Every truck starts and ends at one depot,
+ * the time back to it is taken from the depot row like for a single truck
+ */
+
+#include "m4_fleet.h"
+#include "m4_courier.h"
+#include "m4_anneal.h"
+#include "m4_construction.h"
+#include "m4_windows.h"
+#include "m4_stats.h"
+#include "m3.h"
+#include "map_db.h"
+#include "constants.hpp"
+#include <vector>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include <omp.h>
+
+// A delivery moved to another route, or swapped with a delivery of it if other isn't -1
+struct FleetMove {
+    double gain = 0;
+    unsigned from = 0;
+    unsigned to = 0;
+    int delivery = -1;
+    int other = -1;
+};
+
+// Searches the time from every pickup, dropoff and depot to every pickup and dropoff
+void build_fleet_matrix(const std::vector<DeliveryInfo>& deliveries,
+                        const std::vector<unsigned>& depots,
+                        const float right_turn_penalty,
+                        const float left_turn_penalty);
+
+// Average time between the stops of two deliveries, in both directions
+float delivery_distance(unsigned first, unsigned second);
+
+// Time of a route that starts and ends at the depot with the given matrix row
+double fleet_route_time(const std::vector<RouteStop> &route, unsigned depot_row);
+
+// Time of the route after taking out one delivery and putting another where it adds the least
+// time (either can be -1), the new route is left in result. Returns the largest double if the item
+// doesn't fit, callers check for it before adding times together
+double changed_route_time(const std::vector<RouteStop> &route,
+                          int removed,
+                          int added,
+                          const std::vector<DeliveryInfo>& deliveries,
+                          const float truck_capacity,
+                          unsigned depot_row,
+                          std::vector<RouteStop> &result);
+
+// Finds the best move or swap of every delivery into the neighbouring routes of its truck,
+// then applies the best ones that don't share a route. Returns false if nothing was improved
+bool improve_between_routes(std::vector<std::vector<RouteStop>> &routes,
+                            std::vector<double> &route_times,
+                            std::vector<int> &route_of,
+                            const std::vector<DeliveryInfo>& deliveries,
+                            const std::vector<FleetVehicle>& vehicles,
+                            const std::vector<unsigned> &depot_rows,
+                            const std::vector<std::vector<unsigned>> &neighbours);
+
+
+std::vector<std::vector<CourierSubpath>> fleet_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const std::vector<FleetVehicle>& vehicles,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const double time_limit) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto phaseStart = startTime;
+    reset_courier_stats(ANNEAL_MODE);
+    MAP.courier.stats.mode = "fleet";
+    MAP.courier.stats.num_threads = omp_get_max_threads();
+
+    const double fleet_time_limit = time_limit > 0 ? time_limit : FLEET_TIME_LIMIT;
+    std::vector<std::vector<CourierSubpath>> paths(vehicles.size());
+    if (deliveries.empty() || vehicles.empty() || depots.empty()) return paths;
+
+    // The depot of a truck is a row of the matrix, so it must be one of the depots given
+    for (const FleetVehicle &vehicle : vehicles) {
+        if (vehicle.depot != ANY_DEPOT && (vehicle.depot < 0 || (unsigned)vehicle.depot >= depots.size())) {
+            return std::vector<std::vector<CourierSubpath>>();
+        }
+    }
+
+    build_fleet_matrix(deliveries, depots, right_turn_penalty, left_turn_penalty);
+    pcg32_fast_init(thread_seed());
+    MAP.courier.stats.matrix_time = lap_seconds(phaseStart);
+
+    std::vector<int> route_of, medoids;
+    cluster_deliveries(deliveries, vehicles, route_of, medoids);
+    for (int vehicle : route_of) {
+        if (vehicle == -1) return std::vector<std::vector<CourierSubpath>>();
+    }
+
+    // Trucks that can use any depot take the one closest to the pickup of their medoid
+    std::vector<unsigned> depot_rows(vehicles.size());
+    for (unsigned v = 0; v < vehicles.size(); ++v) {
+        unsigned depot = vehicles[v].depot == ANY_DEPOT ? 0 : vehicles[v].depot;
+
+        if (vehicles[v].depot == ANY_DEPOT && medoids[v] != -1) {
+            for (unsigned i = 1; i < depots.size(); ++i) {
+                if (flat_travel_time(MAP.courier.num_columns + i, medoids[v] * 2)
+                        < flat_travel_time(MAP.courier.num_columns + depot, medoids[v] * 2)) depot = i;
+            }
+        }
+        depot_rows[v] = MAP.courier.num_columns + depot;
+    }
+
+    // Deliveries can be moved to the routes with the closest medoids
+    std::vector<std::vector<unsigned>> neighbours(vehicles.size());
+    for (unsigned v = 0; v < vehicles.size(); ++v) {
+        if (medoids[v] == -1) continue;
+
+        for (unsigned other = 0; other < vehicles.size(); ++other) {
+            if (other != v && medoids[other] != -1) neighbours[v].push_back(other);
+        }
+        std::sort(neighbours[v].begin(), neighbours[v].end(), [&](unsigned a, unsigned b) {
+            return delivery_distance(medoids[v], medoids[a]) < delivery_distance(medoids[v], medoids[b]);
+        });
+        if (neighbours[v].size() > FLEET_NEIGHBOUR_ROUTES) neighbours[v].resize(FLEET_NEIGHBOUR_ROUTES);
+    }
+
+    std::vector<std::vector<RouteStop>> routes(vehicles.size());
+    std::vector<double> route_times(vehicles.size(), 0);
+
+    #pragma omp parallel
+    {
+        pcg32_fast_init(thread_seed());
+        std::vector<RouteStop> inserted;
+
+        // Every truck inserts its deliveries in a random order where they add the least time
+        #pragma omp for schedule(dynamic)
+        for (unsigned v = 0; v < vehicles.size(); ++v) {
+            std::vector<unsigned> members;
+            for (unsigned i = 0; i < deliveries.size(); ++i) {
+                if (route_of[i] == (int)v) members.push_back(i);
+            }
+
+            for (unsigned i = members.size(); i > 1; --i) std::swap(members[i - 1], members[pcg32_fast() % i]);
+            for (unsigned delivery_index : members) {
+                changed_route_time(routes[v], -1, delivery_index, deliveries, vehicles[v].capacity, depot_rows[v], inserted);
+                routes[v].swap(inserted);
+            }
+            route_times[v] = fleet_route_time(routes[v], depot_rows[v]);
+        }
+    }
+    MAP.courier.stats.construction_time = lap_seconds(phaseStart);
+
+    // Rounds go on until the time is up, or a round where neither the annealing nor the moves improve anything
+    bool is_improved = true;
+    while (is_improved) {
+        auto currentTime = std::chrono::high_resolution_clock::now();
+        double wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime).count();
+        double round_time = std::min(FLEET_ROUND_SHARE * fleet_time_limit, fleet_time_limit - wallClock);
+        if (round_time <= 0) break;
+        is_improved = false;
+
+        // The trace is the time of every truck together at the start of each round
+        double total_time = 0;
+        for (double route_time : route_times) total_time += route_time;
+        MAP.courier.stats.best_trace.push_back(std::make_pair(wallClock, total_time));
+
+        // Each truck gets an equal share of the threads for the round
+        unsigned num_routes = 0;
+        for (const std::vector<RouteStop> &route : routes) num_routes += !route.empty();
+        round_time *= std::min(1.0, (double)omp_get_max_threads() / std::max(1u, num_routes));
+
+        // The annealing leaves out the depots, so its route is only kept if it is still faster with them
+        #pragma omp parallel for schedule(dynamic) reduction(||:is_improved)
+        for (unsigned v = 0; v < vehicles.size(); ++v) {
+            if (routes[v].size() < 2) continue;
+
+            std::vector<RouteStop> annealed = routes[v];
+            std::vector<bool> is_in_truck(deliveries.size(), false);
+            double annealed_time = 0;
+            validate_route(annealed, annealed_time, is_in_truck, deliveries, vehicles[v].capacity);
+            anneal_route(annealed, annealed_time, deliveries, vehicles[v].capacity, round_time,
+                    std::chrono::high_resolution_clock::now(), nullptr);
+
+            double new_time = fleet_route_time(annealed, depot_rows[v]);
+            if (new_time < route_times[v]) {
+                routes[v].swap(annealed);
+                route_times[v] = new_time;
+                is_improved = true;
+            }
+        }
+
+        if (improve_between_routes(routes, route_times, route_of, deliveries, vehicles, depot_rows, neighbours)) {
+            is_improved = true;
+        }
+    }
+    MAP.courier.stats.optimization_time = lap_seconds(phaseStart);
+
+    for (unsigned v = 0; v < vehicles.size(); ++v) {
+        if (routes[v].empty()) continue;
+
+        unsigned depot = depots[depot_rows[v] - MAP.courier.num_columns];
+        routes[v].insert(routes[v].begin(), RouteStop(depot, -1, DROP_OFF));
+        routes[v].push_back(RouteStop(depot, -1, DROP_OFF));
+        build_route(routes[v], paths[v], depots, right_turn_penalty, left_turn_penalty);
+    }
+
+    MAP.courier.stats.build_route_time = lap_seconds(phaseStart);
+    MAP.courier.stats.total_time = lap_seconds(startTime);
+
+    return paths;
+}
+
+
+void cluster_deliveries(const std::vector<DeliveryInfo>& deliveries,
+                        const std::vector<FleetVehicle>& vehicles,
+                        std::vector<int> &cluster,
+                        std::vector<int> &medoids) {
+    cluster.assign(deliveries.size(), -1);
+    medoids.assign(vehicles.size(), -1);
+
+    // Spread the medoids out, each one is the delivery fitting in its truck farthest from those picked
+    // so far. Trucks that nothing is left for (when there are more trucks than deliveries) get none
+    std::vector<float> closest(deliveries.size(), std::numeric_limits<float>::max());
+    std::vector<bool> is_medoid(deliveries.size(), false);
+    for (unsigned c = 0; c < vehicles.size(); ++c) {
+        std::vector<unsigned> candidates;
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            if (!is_medoid[i] && deliveries[i].itemWeight <= vehicles[c].capacity) candidates.push_back(i);
+        }
+        if (candidates.empty()) continue;
+
+        unsigned next = candidates[pcg32_fast() % candidates.size()];
+        for (unsigned i : candidates) {
+            if (closest[i] != std::numeric_limits<float>::max() && closest[i] > closest[next]) next = i;
+        }
+        medoids[c] = next;
+        is_medoid[next] = true;
+
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            closest[i] = std::min(closest[i], delivery_distance(i, medoids[c]));
+        }
+    }
+
+    bool is_changed = true;
+    for (int iteration = 0; iteration < FLEET_CLUSTER_ITERATIONS && is_changed; ++iteration) {
+        is_changed = false;
+
+        // Every delivery joins the closest medoid with a truck it fits in
+        #pragma omp parallel for
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            float best = std::numeric_limits<float>::max();
+            cluster[i] = -1;
+
+            for (unsigned c = 0; c < vehicles.size(); ++c) {
+                if (medoids[c] == -1 || vehicles[c].capacity < deliveries[i].itemWeight) continue;
+
+                float distance = delivery_distance(i, medoids[c]);
+                if (cluster[i] == -1 || distance < best) {
+                    best = distance;
+                    cluster[i] = c;
+                }
+            }
+        }
+
+        // A delivery that only fits trucks without a medoid becomes the medoid of one of them
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            if (cluster[i] != -1) continue;
+
+            for (unsigned c = 0; c < vehicles.size(); ++c) {
+                if (medoids[c] == -1 && vehicles[c].capacity >= deliveries[i].itemWeight) {
+                    medoids[c] = i;
+                    cluster[i] = c;
+                    is_changed = true;
+                    break;
+                }
+            }
+        }
+
+        std::vector<std::vector<unsigned>> members(vehicles.size());
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            if (cluster[i] != -1) members[cluster[i]].push_back(i);
+        }
+
+        // The new medoid is the member with the least time to the rest of its cluster. Every member
+        // fits in the truck, and a truck left without members keeps its medoid for the next assignment
+        #pragma omp parallel for schedule(dynamic) reduction(||:is_changed)
+        for (unsigned c = 0; c < vehicles.size(); ++c) {
+            float best = std::numeric_limits<float>::max();
+            int best_member = medoids[c];
+
+            for (unsigned member : members[c]) {
+                float total = 0;
+                for (unsigned other : members[c]) total += delivery_distance(member, other);
+
+                if (total < best) {
+                    best = total;
+                    best_member = member;
+                }
+            }
+
+            if (best_member != medoids[c]) {
+                medoids[c] = best_member;
+                is_changed = true;
+            }
+        }
+    }
+}
+
+
+bool improve_between_routes(std::vector<std::vector<RouteStop>> &routes,
+                            std::vector<double> &route_times,
+                            std::vector<int> &route_of,
+                            const std::vector<DeliveryInfo>& deliveries,
+                            const std::vector<FleetVehicle>& vehicles,
+                            const std::vector<unsigned> &depot_rows,
+                            const std::vector<std::vector<unsigned>> &neighbours) {
+    std::vector<FleetMove> best_moves(deliveries.size());
+
+    // The routes don't change while the moves are found, so the deliveries are split between threads
+    #pragma omp parallel
+    {
+        std::vector<RouteStop> changed;
+
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = 0; i < deliveries.size(); ++i) {
+            unsigned from = route_of[i];
+            FleetMove &best = best_moves[i];
+            double removed_time = changed_route_time(routes[from], i, -1, deliveries, vehicles[from].capacity, depot_rows[from], changed);
+
+            for (unsigned to : neighbours[from]) {
+                double old_time = route_times[from] + route_times[to];
+
+                double added_time = changed_route_time(routes[to], -1, i, deliveries,
+                        vehicles[to].capacity, depot_rows[to], changed);
+                double moved_time = removed_time + added_time;
+                if (added_time != std::numeric_limits<double>::max() && old_time - moved_time > best.gain) {
+                    best.gain = old_time - moved_time;
+                    best.from = from;
+                    best.to = to;
+                    best.delivery = i;
+                    best.other = -1;
+                }
+
+                for (int k = 0; k < FLEET_SWAP_CANDIDATES && !routes[to].empty(); ++k) {
+                    int other = routes[to][pcg32_fast() % routes[to].size()].delivery_index;
+
+                    double from_time = changed_route_time(routes[from], i, other, deliveries, vehicles[from].capacity, depot_rows[from], changed);
+                    double to_time = changed_route_time(routes[to], other, i, deliveries, vehicles[to].capacity, depot_rows[to], changed);
+                    if (from_time == std::numeric_limits<double>::max() || to_time == std::numeric_limits<double>::max()) continue;
+
+                    double swapped_time = from_time + to_time;
+                    if (old_time - swapped_time > best.gain) {
+                        best.gain = old_time - swapped_time;
+                        best.from = from;
+                        best.to = to;
+                        best.delivery = i;
+                        best.other = other;
+                    }
+                }
+            }
+        }
+    }
+
+    std::sort(best_moves.begin(), best_moves.end(), [](const FleetMove &a, const FleetMove &b) {
+        return a.gain > b.gain;
+    });
+
+    // A move is only still correct if neither of its routes has changed
+    std::vector<bool> is_changed(routes.size(), false);
+    bool is_improved = false;
+    for (const FleetMove &move : best_moves) {
+        if (move.delivery == -1) break;
+        if (is_changed[move.from] || is_changed[move.to]) continue;
+
+        std::vector<RouteStop> from_route, to_route;
+        route_times[move.from] = changed_route_time(routes[move.from], move.delivery, move.other, deliveries,
+                vehicles[move.from].capacity, depot_rows[move.from], from_route);
+        route_times[move.to] = changed_route_time(routes[move.to], move.other, move.delivery, deliveries,
+                vehicles[move.to].capacity, depot_rows[move.to], to_route);
+        routes[move.from].swap(from_route);
+        routes[move.to].swap(to_route);
+
+        route_of[move.delivery] = move.to;
+        if (move.other != -1) route_of[move.other] = move.from;
+        is_changed[move.from] = is_changed[move.to] = true;
+        is_improved = true;
+    }
+
+    return is_improved;
+}
+
+
+double changed_route_time(const std::vector<RouteStop> &route,
+                          int removed,
+                          int added,
+                          const std::vector<DeliveryInfo>& deliveries,
+                          const float truck_capacity,
+                          unsigned depot_row,
+                          std::vector<RouteStop> &result) {
+    result = route;
+    if (removed != -1) remove_delivery(result, removed);
+
+    if (added != -1) {
+        if (deliveries[added].itemWeight > truck_capacity) return std::numeric_limits<double>::max();
+
+        std::vector<float> loads;
+        compute_route_loads(result, deliveries, loads);
+
+        InsertionResult insertion;
+        if (!find_best_insertion(result, loads, added, deliveries, truck_capacity, insertion, nullptr)) {
+            // The truck is empty at the end of the route, so it can always go there
+            insertion.pick_up_gap = result.size();
+            insertion.drop_off_gap = result.size();
+        }
+
+        insert_delivery(result, added, deliveries, insertion);
+    }
+
+    return fleet_route_time(result, depot_row);
+}
+
+
+double fleet_route_time(const std::vector<RouteStop> &route, unsigned depot_row) {
+    if (route.empty()) return 0;
+
+    double time = flat_travel_time(depot_row, stop_matrix_index(route.front()))
+            + flat_travel_time(depot_row, stop_matrix_index(route.back()));
+    for (unsigned i = 0; i + 1 < route.size(); ++i) {
+        time += flat_travel_time(stop_matrix_index(route[i]), stop_matrix_index(route[i + 1]));
+    }
+
+    return time;
+}
+
+
+float delivery_distance(unsigned first, unsigned second) {
+    return (flat_travel_time(first * 2, second * 2) + flat_travel_time(second * 2, first * 2)
+            + flat_travel_time(first * 2 + 1, second * 2 + 1) + flat_travel_time(second * 2 + 1, first * 2 + 1)) / 4;
+}
+
+
+void build_fleet_matrix(const std::vector<DeliveryInfo>& deliveries,
+                        const std::vector<unsigned>& depots,
+                        const float right_turn_penalty,
+                        const float left_turn_penalty) {
+    MAP.courier.time_between_deliveries.clear();
+    MAP.courier.time_between_deliveries.assign(deliveries.size() * 2 + depots.size(),
+            std::vector<unsigned>(deliveries.size() * 2, NO_ROUTE));
+    MAP.courier.predecessor_edges.clear();
+    MAP.courier.predecessor_edges.resize(deliveries.size() * 2 + depots.size());
+    MAP.courier.successor_edges.clear();
+    MAP.courier.successor_rows.clear();
+    MAP.courier.route_stops.clear();
+
+    std::vector<unsigned> destinations;
+    for (auto it = deliveries.begin(); it != deliveries.end(); ++it) {
+        destinations.push_back(it->pickUp);
+        destinations.push_back(it->dropOff);
+    }
+
+    #pragma omp parallel
+    {
+        //initiallize a node vector for each thread
+        std::vector<Node*> intersection_nodes;
+        intersection_nodes.resize(getNumIntersections());
+        for(int i = 0; i < getNumIntersections(); i++) {
+            intersection_nodes[i] = (new Node(i, NO_EDGE, 0));
+        }
+
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = 0; i < destinations.size() + depots.size(); ++i) {
+            unsigned source = i < destinations.size() ? destinations[i] : depots[i - destinations.size()];
+            multi_dest_dijkistra(source, i, intersection_nodes, destinations,
+                    right_turn_penalty, left_turn_penalty, &MAP.courier.predecessor_edges[i]);
+        }
+
+        for(int i = 0; i < getNumIntersections(); i++) {
+            delete intersection_nodes[i];
+        }
+    }
+
+    build_flat_matrix();
+    set_time_windows(std::vector<DeliveryWindows>(), depots.size());
+}
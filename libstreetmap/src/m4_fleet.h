@@ -0,0 +1,53 @@
+/*
+ * Contains the fleet courier mode. Deliveries are clustered by travel time
+ * around one medoid delivery per truck, the routes of the trucks are annealed
+ * in parallel, and deliveries are moved or swapped between nearby routes
+ * between rounds of annealing
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+
+// Seconds fleet_courier takes when no time limit is given
+#define FLEET_TIME_LIMIT 40
+
+// Iterations of k-medoids when clustering the deliveries
+#define FLEET_CLUSTER_ITERATIONS 10
+
+// Share of the time limit each round of annealing and moves between routes takes
+#define FLEET_ROUND_SHARE 0.1
+
+// Routes (with the closest medoids) a delivery may move to, and deliveries of each it may be swapped with
+#define FLEET_NEIGHBOUR_ROUTES 3
+#define FLEET_SWAP_CANDIDATES 4
+
+// Depot index of a truck that can use any depot, the one closest to its deliveries is picked
+#define ANY_DEPOT -1
+
+struct FleetVehicle {
+    float capacity = 0;
+    int depot = ANY_DEPOT; // Index in depots the truck starts and ends at
+};
+
+// Plans a route for every truck so each delivery is done by one truck, trucks without
+// deliveries get an empty route. Takes time_limit seconds (FLEET_TIME_LIMIT if it is 0), or less
+// once the routes stop improving. Returns no routes if an item doesn't fit in any truck, or a truck
+// has a depot index that isn't in depots
+std::vector<std::vector<CourierSubpath>> fleet_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const std::vector<FleetVehicle>& vehicles,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const double time_limit);
+
+// Splits the deliveries between the trucks with k-medoids, using the average time between their stops.
+// A delivery only goes to a truck it fits in, and every medoid fits in its truck. Fills the cluster of
+// every delivery (-1 if it is heavier than every truck's capacity) and the medoid of every truck
+// (-1 if no delivery fits in the truck or was left for it)
+void cluster_deliveries(const std::vector<DeliveryInfo>& deliveries,
+                        const std::vector<FleetVehicle>& vehicles,
+                        std::vector<int> &cluster,
+                        std::vector<int> &medoids);
@@ -0,0 +1,279 @@
+/*
+ * Contains the memetic courier mode. Crossover works on whole deliveries, so a
+ * child only needs its capacity repaired, and every child is polished with the
+ * same constant time reversals that are used by the annealing
+ */
+
+#include "m4_memetic.h"
+#include "m4_anneal.h"
+#include "m4_construction.h"
+#include "m4_stats.h"
+#include "m4_windows.h"
+#include "map_db.h"
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+
+typedef std::pair<double, std::vector<RouteStop>> Individual;
+
+// Picks the faster of two random routes in the population
+const Individual &select_parent(const std::vector<Individual> &population);
+
+
+void memetic_route(const std::vector<std::pair<double, std::vector<RouteStop>>> &seed_routes,
+                   const std::vector<DeliveryInfo>& deliveries,
+                   const std::vector<unsigned>& depots,
+                   const float truck_capacity,
+                   const double time_limit,
+                   std::chrono::high_resolution_clock::time_point startTime,
+                   std::vector<RouteStop> &route,
+                   double &route_time) {
+    std::vector<Individual> population(MEMETIC_POPULATION);
+    std::vector<Individual> children(MEMETIC_CHILDREN);
+    bool timeOut = false;
+    double next_sample = 0;
+
+    #pragma omp parallel
+    {
+        pcg32_fast_init(thread_seed());
+        std::vector<bool> is_in_truck(deliveries.size(), false);
+
+        // Start from the seeds, the rest of the population is built with the cheap strategies randomized.
+        // Once the time is up the seeds are copied instead, and nothing more is polished
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = 0; i < MEMETIC_POPULATION; ++i) {
+            std::vector<RouteStop> &individual = population[i].second;
+            double &individual_time = population[i].first;
+
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            bool is_late = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime).count() > time_limit;
+
+            if (i < seed_routes.size()) {
+                individual = seed_routes[i].second;
+            } else {
+                // Savings ignores the windows, so only nearest neighbour is used with them. Neither has a deadline
+                construction_strategy strategy = (has_time_windows() || pcg32_fast() % 2 == 0) ? NEAREST_NEIGHBOUR : SAVINGS;
+                bool is_built = !is_late && construct_route(strategy, deliveries, depots, truck_capacity, true, currentTime, individual);
+
+                // Savings ignores the capacity, which the repair fixes
+                if (is_built) repair_route(individual, deliveries, truck_capacity);
+
+                // Once the time is up, or when time windows make every strategy fail, a seed is used again.
+                // Without seeds nearest neighbour gets a few more tries, and the individual is dropped if they all fail
+                if (!is_built || !validate_route(individual, individual_time, is_in_truck, deliveries, truck_capacity)) {
+                    if (!seed_routes.empty()) {
+                        individual = seed_routes[i % seed_routes.size()].second;
+                    } else {
+                        bool is_valid = false;
+                        for (unsigned tries = 0; tries < MEMETIC_CONSTRUCTION_TRIES && !is_valid; ++tries) {
+                            is_valid = nearest_neighbour_route(deliveries, truck_capacity, individual)
+                                    && validate_route(individual, individual_time, is_in_truck, deliveries, truck_capacity);
+                        }
+                        if (!is_valid) individual.clear();
+                    }
+                }
+            }
+            if (individual.empty()) continue;
+
+            validate_route(individual, individual_time, is_in_truck, deliveries, truck_capacity);
+            if (!is_late) polish_route(individual, individual_time, deliveries, truck_capacity);
+        }
+
+        #pragma omp single
+        {
+            population.erase(std::remove_if(population.begin(), population.end(),
+                    [](const Individual &individual) {
+                        return individual.second.empty();
+                    }), population.end());
+            timeOut = population.empty();
+        }
+
+        while (!timeOut) {
+            #pragma omp for schedule(dynamic)
+            for (unsigned i = 0; i < MEMETIC_CHILDREN; ++i) {
+                const Individual &first_parent = select_parent(population);
+                const Individual &second_parent = select_parent(population);
+
+                crossover_routes(first_parent.second, second_parent.second, children[i].second);
+                repair_route(children[i].second, deliveries, truck_capacity);
+
+                // Only the capacity is repaired, children that miss a time window are dropped
+                if (!validate_route(children[i].second, children[i].first, is_in_truck, deliveries, truck_capacity)) {
+                    children[i].first = std::numeric_limits<double>::max();
+                    continue;
+                }
+                polish_route(children[i].second, children[i].first, deliveries, truck_capacity);
+            }
+
+            // The fastest distinct routes of the parents and children survive
+            #pragma omp single
+            {
+                population.insert(population.end(), children.begin(), children.end());
+                std::sort(population.begin(), population.end(),
+                        [](const Individual &a, const Individual &b) {
+                            return a.first < b.first;
+                        });
+
+                population.erase(std::unique(population.begin(), population.end(),
+                        [](const Individual &a, const Individual &b) {
+                            return std::abs(a.first - b.first) < 1e-3;
+                        }), population.end());
+                if (population.size() > MEMETIC_POPULATION) population.resize(MEMETIC_POPULATION);
+                if (population.size() > 1 && population.back().first == std::numeric_limits<double>::max()) population.pop_back();
+
+                auto currentTime = std::chrono::high_resolution_clock::now();
+                double wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime).count();
+                timeOut = wallClock > time_limit;
+
+                if (wallClock >= next_sample) {
+                    MAP.courier.stats.best_trace.push_back(std::make_pair(wallClock, population[0].first));
+                    next_sample = wallClock + STATS_TRACE_INTERVAL;
+                }
+            }
+        }
+    }
+
+    if (population.empty()) {
+        route.clear();
+        route_time = std::numeric_limits<double>::max();
+        return;
+    }
+
+    route = population[0].second;
+    route_time = population[0].first;
+}
+
+
+const Individual &select_parent(const std::vector<Individual> &population) {
+    const Individual &first = population[pcg32_fast() % population.size()];
+    const Individual &second = population[pcg32_fast() % population.size()];
+
+    return first.first < second.first ? first : second;
+}
+
+
+void crossover_routes(const std::vector<RouteStop> &first_parent,
+                      const std::vector<RouteStop> &second_parent,
+                      std::vector<RouteStop> &child) {
+    unsigned num_stops = first_parent.size();
+    unsigned first = pcg32_fast() % num_stops;
+    unsigned last = first + pcg32_fast() % (num_stops - first);
+
+    // Deliveries with both stops in the part are kept from the first parent
+    std::vector<char> stops_in_part(num_stops / 2, 0);
+    for (unsigned i = first; i <= last; ++i) stops_in_part[first_parent[i].delivery_index]++;
+
+    child.clear();
+    for (const RouteStop &stop : second_parent) {
+        if (stops_in_part[stop.delivery_index] != 2) child.push_back(stop);
+    }
+
+    // The kept stops go back at the same position, or at the end if the route before it got shorter
+    std::vector<RouteStop> part;
+    for (unsigned i = first; i <= last; ++i) {
+        if (stops_in_part[first_parent[i].delivery_index] == 2) part.push_back(first_parent[i]);
+    }
+
+    child.insert(child.begin() + std::min((unsigned)child.size(), first), part.begin(), part.end());
+}
+
+
+void repair_route(std::vector<RouteStop> &route,
+                  const std::vector<DeliveryInfo>& deliveries,
+                  const float truck_capacity) {
+    std::vector<float> loads;
+    std::vector<int> removed;
+
+    // The first stop over the capacity is always a pickup, taking that delivery out
+    // only lowers the loads after it
+    bool is_over = true;
+    while (is_over) {
+        is_over = false;
+        compute_route_loads(route, deliveries, loads);
+
+        for (unsigned i = 0; i < route.size(); ++i) {
+            if (loads[i] > truck_capacity) {
+                removed.push_back(route[i].delivery_index);
+                remove_delivery(route, route[i].delivery_index);
+                is_over = true;
+                break;
+            }
+        }
+    }
+
+    for (int delivery_index : removed) {
+        compute_route_loads(route, deliveries, loads);
+
+        InsertionResult insertion;
+        if (!find_best_insertion(route, loads, delivery_index, deliveries, truck_capacity, insertion, nullptr)) {
+            // The truck is empty at the end of the route, so it can always go there
+            insertion.pick_up_gap = route.size();
+            insertion.drop_off_gap = route.size();
+        }
+
+        insert_delivery(route, delivery_index, deliveries, insertion);
+    }
+}
+
+
+void polish_route(std::vector<RouteStop> &route,
+                  double &route_time,
+                  const std::vector<DeliveryInfo>& deliveries,
+                  const float truck_capacity) {
+    std::vector<bool> is_in_truck(deliveries.size(), false);
+    if (route.size() < 2) return;
+
+    AnnealRoute anneal;
+    set_anneal_route(anneal, route, deliveries);
+
+    int first[ANNEAL_BATCH], last[ANNEAL_BATCH];
+    float change[ANNEAL_BATCH];
+
+    // Take the cheapest legal reversal of each batch if it makes the route faster
+    for (int i = 0; i < MEMETIC_POLISH_BATCHES; ++i) {
+        random_reversals(anneal, first, last);
+        score_reversals(anneal, first, last, change);
+
+        for (int tries = 0; tries < ANNEAL_BATCH; ++tries) {
+            int cheapest = 0;
+            for (int k = 1; k < ANNEAL_BATCH; ++k) {
+                if (change[k] < change[cheapest]) cheapest = k;
+            }
+            if (change[cheapest] >= 0) break;
+
+            if (reversal_is_legal(anneal, first[cheapest], last[cheapest], deliveries, truck_capacity)) {
+                apply_reversal(anneal, first[cheapest], last[cheapest], deliveries);
+                break;
+            }
+            change[cheapest] = std::numeric_limits<float>::max();
+        }
+    }
+
+    get_anneal_route(anneal, route, deliveries);
+    validate_route(route, route_time, is_in_truck, deliveries, truck_capacity);
+
+    // Move random deliveries to wherever they add the least time
+    std::vector<RouteStop> moved;
+    std::vector<float> loads;
+    for (int i = 0; i < MEMETIC_RELOCATIONS; ++i) {
+        int delivery_index = route[pcg32_fast() % route.size()].delivery_index;
+
+        moved = route;
+        remove_delivery(moved, delivery_index);
+        compute_route_loads(moved, deliveries, loads);
+
+        InsertionResult insertion;
+        if (!find_best_insertion(moved, loads, delivery_index, deliveries, truck_capacity, insertion, nullptr)) continue;
+        insert_delivery(moved, delivery_index, deliveries, insertion);
+
+        double moved_time = 0;
+        if (validate_route(moved, moved_time, is_in_truck, deliveries, truck_capacity) && moved_time < route_time) {
+            route.swap(moved);
+            route_time = moved_time;
+        }
+    }
+}
+
@@ -0,0 +1,55 @@
+/*
+ * Contains the memetic courier mode. A population of routes is kept, children
+ * are made by crossing over two parents so every delivery keeps its pickup
+ * before its dropoff, repaired if the truck would be overloaded, then polished
+ * with a short local search before they compete for a place in the population
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+#include <chrono>
+
+// Routes kept between generations, and children made in each generation
+#define MEMETIC_POPULATION 24
+#define MEMETIC_CHILDREN 24
+
+// Times nearest neighbour is tried for an individual when there are no seeds to copy
+#define MEMETIC_CONSTRUCTION_TRIES 10
+
+// Batches of reversals tried, and deliveries moved, when polishing each child
+#define MEMETIC_POLISH_BATCHES 1000
+#define MEMETIC_RELOCATIONS 20
+
+// Evolves a population seeded with seed_routes (and constructed routes if there are too few)
+// until time_limit seconds after startTime, leaving the best route found in route and its time
+// in route_time (empty if no route could be built). Must be called outside of a parallel region,
+// the children are made in parallel
+void memetic_route(const std::vector<std::pair<double, std::vector<RouteStop>>> &seed_routes,
+                   const std::vector<DeliveryInfo>& deliveries,
+                   const std::vector<unsigned>& depots,
+                   const float truck_capacity,
+                   const double time_limit,
+                   std::chrono::high_resolution_clock::time_point startTime,
+                   std::vector<RouteStop> &route,
+                   double &route_time);
+
+// Keeps the stops of the deliveries that are entirely within a random part of first_parent in
+// place, and fills in the other stops in the order of second_parent
+void crossover_routes(const std::vector<RouteStop> &first_parent,
+                      const std::vector<RouteStop> &second_parent,
+                      std::vector<RouteStop> &child);
+
+// Takes out the deliveries picked up where the truck goes over the capacity, then inserts
+// them again where they add the least time
+void repair_route(std::vector<RouteStop> &route,
+                  const std::vector<DeliveryInfo>& deliveries,
+                  const float truck_capacity);
+
+// Takes improving reversals, then moves random deliveries to their best place if it is faster.
+// Route time is updated to the time of the polished route
+void polish_route(std::vector<RouteStop> &route,
+                  double &route_time,
+                  const std::vector<DeliveryInfo>& deliveries,
+                  const float truck_capacity);
@@ -0,0 +1,357 @@
+/*
+ * Contains the incremental courier API. Rows and columns of the deliveries
+ * that are kept are copied from the old matrix, the new rows are searched for
+ * forwards and the new columns backwards, so each new stop takes two searches.
+ * The backward searches keep the edges they take, so the legs into the new
+ * stops are rebuilt from them like the others are from the forward searches
+ */
+
+#include "m4_replan.h"
+#include "m4_courier.h"
+#include "m4_construction.h"
+#include "m4_anneal.h"
+#include "m4_windows.h"
+#include "m4_stats.h"
+#include "m3.h"
+#include "map_db.h"
+#include "constants.hpp"
+#include <vector>
+#include <queue>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include <omp.h>
+
+// Searches backwards from a destination until every intersection in rows_at is reached, filling
+// the column of the destination in time_between_deliveries for those rows. The edges on the way
+// from them are kept in successor_edges, and the rows found are marked in successor_rows
+void reverse_multi_source_dijkstra(
+        const unsigned intersect_id_end,
+        const unsigned column_index,
+        const std::unordered_map<unsigned, std::vector<unsigned>> &rows_at,
+        const float right_turn_penalty,
+        const float left_turn_penalty);
+
+
+std::vector<CourierSubpath> traveling_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const float truck_capacity,
+        CourierPlan &plan) {
+    std::vector<CourierSubpath> route = traveling_courier(deliveries, depots, right_turn_penalty, left_turn_penalty, truck_capacity);
+
+    plan.deliveries = deliveries;
+    plan.depots = depots;
+    plan.right_turn_penalty = right_turn_penalty;
+    plan.left_turn_penalty = left_turn_penalty;
+    plan.truck_capacity = truck_capacity;
+    plan.time_between_deliveries = MAP.courier.time_between_deliveries;
+    plan.predecessor_edges = MAP.courier.predecessor_edges;
+    plan.successor_edges = MAP.courier.successor_edges;
+    plan.successor_rows = MAP.courier.successor_rows;
+    plan.route_stops = MAP.courier.route_stops;
+
+    return route;
+}
+
+
+std::vector<CourierSubpath> replan_courier(
+        CourierPlan &plan,
+        const std::vector<DeliveryInfo>& added,
+        const std::vector<unsigned>& cancelled,
+        const double time_limit) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto phaseStart = startTime;
+    reset_courier_stats(ANNEAL_MODE);
+    MAP.courier.stats.mode = "replan";
+
+    // Where every old delivery ends up, or -1 if it was cancelled
+    std::vector<int> new_index(plan.deliveries.size(), 0);
+    for (unsigned i : cancelled) {
+        if (i < new_index.size()) new_index[i] = -1;
+    }
+
+    std::vector<DeliveryInfo> deliveries;
+    for (unsigned i = 0; i < plan.deliveries.size(); ++i) {
+        if (new_index[i] == -1) continue;
+
+        new_index[i] = deliveries.size();
+        deliveries.push_back(plan.deliveries[i]);
+    }
+    unsigned num_kept = deliveries.size();
+    deliveries.insert(deliveries.end(), added.begin(), added.end());
+
+    if (deliveries.empty()) {
+        plan.deliveries.clear();
+        plan.route_stops.clear();
+        MAP.courier.stats.total_time = lap_seconds(startTime);
+        return std::vector<CourierSubpath>();
+    }
+
+    // Without the old matrix there is nothing to reuse, so solve it again
+    if (plan.time_between_deliveries.empty()) {
+        return traveling_courier(deliveries, plan.depots, plan.right_turn_penalty, plan.left_turn_penalty,
+                plan.truck_capacity, plan);
+    }
+
+    unsigned old_columns = plan.deliveries.size() * 2;
+    unsigned num_columns = deliveries.size() * 2;
+    unsigned num_depots = plan.depots.size();
+
+    // Where every old row ends up, or -1 if it was cancelled. Depots are after the deliveries
+    std::vector<int> new_row(old_columns + num_depots, -1);
+    for (unsigned old_row = 0; old_row < old_columns + num_depots; ++old_row) {
+        if (old_row >= old_columns) new_row[old_row] = old_row - old_columns + num_columns;
+        else if (new_index[old_row / 2] != -1) new_row[old_row] = new_index[old_row / 2] * 2 + old_row % 2;
+    }
+
+    // Copy the rows and columns of the deliveries kept
+    MAP.courier.time_between_deliveries.clear();
+    MAP.courier.time_between_deliveries.assign(num_columns + num_depots, std::vector<unsigned>(num_columns, NO_ROUTE));
+    MAP.courier.predecessor_edges.clear();
+    MAP.courier.predecessor_edges.resize(num_columns + num_depots);
+    MAP.courier.successor_edges.clear();
+    MAP.courier.successor_edges.resize(num_columns);
+    MAP.courier.successor_rows.clear();
+    MAP.courier.successor_rows.resize(num_columns);
+
+    for (unsigned old_row = 0; old_row < old_columns + num_depots; ++old_row) {
+        if (new_row[old_row] == -1) continue;
+
+        for (unsigned old_column = 0; old_column < old_columns; ++old_column) {
+            if (new_row[old_column] == -1) continue;
+
+            MAP.courier.time_between_deliveries[new_row[old_row]][new_row[old_column]] =
+                    plan.time_between_deliveries[old_row][old_column];
+        }
+
+        MAP.courier.predecessor_edges[new_row[old_row]] = std::move(plan.predecessor_edges[old_row]);
+    }
+
+    // Columns searched backwards by an earlier replan keep their edges, for the rows that are left
+    for (unsigned old_column = 0; old_column < old_columns && old_column < plan.successor_rows.size(); ++old_column) {
+        if (new_row[old_column] == -1 || plan.successor_rows[old_column].empty()) continue;
+
+        std::vector<bool> &rows = MAP.courier.successor_rows[new_row[old_column]];
+        rows.assign(num_columns + num_depots, false);
+        for (unsigned old_row = 0; old_row < plan.successor_rows[old_column].size(); ++old_row) {
+            if (new_row[old_row] != -1) rows[new_row[old_row]] = plan.successor_rows[old_column][old_row];
+        }
+        MAP.courier.successor_edges[new_row[old_column]] = std::move(plan.successor_edges[old_column]);
+    }
+
+    std::vector<unsigned> destinations;
+    for (auto it = deliveries.begin(); it != deliveries.end(); ++it) {
+        destinations.push_back(it->pickUp);
+        destinations.push_back(it->dropOff);
+    }
+
+    // The old rows that need a time to each new column
+    std::unordered_map<unsigned, std::vector<unsigned>> rows_at;
+    for (unsigned row = 0; row < num_kept * 2; ++row) rows_at[destinations[row]].push_back(row);
+    for (unsigned i = 0; i < num_depots; ++i) rows_at[plan.depots[i]].push_back(num_columns + i);
+
+    #pragma omp parallel
+    {
+        //initiallize a node vector for each thread
+        std::vector<Node*> intersection_nodes;
+        intersection_nodes.resize(getNumIntersections());
+        for(int i = 0; i < getNumIntersections(); i++) {
+            intersection_nodes[i] = (new Node(i, NO_EDGE, 0));
+        }
+
+        // New rows to every destination
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = num_kept * 2; i < num_columns; ++i) {
+            multi_dest_dijkistra(destinations[i], i, intersection_nodes, destinations,
+                    plan.right_turn_penalty, plan.left_turn_penalty, &MAP.courier.predecessor_edges[i]);
+        }
+
+        // Old rows to the new columns, each column is a different element of the rows
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = num_kept * 2; i < num_columns; ++i) {
+            reverse_multi_source_dijkstra(destinations[i], i, rows_at, plan.right_turn_penalty, plan.left_turn_penalty);
+        }
+
+        for(int i = 0; i < getNumIntersections(); i++) {
+            delete intersection_nodes[i];
+        }
+    }
+
+    build_flat_matrix();
+    MAP.courier.stats.matrix_time = lap_seconds(phaseStart);
+
+    // The plan doesn't keep time windows
+    set_time_windows(std::vector<DeliveryWindows>(), num_depots);
+
+    // Keep the old order of the deliveries left
+    std::vector<RouteStop> route;
+    for (unsigned stop : plan.route_stops) {
+        int delivery_index = new_index[stop / 2];
+        if (delivery_index == -1) continue;
+
+        stop_type type = stop % 2 == 0 ? PICK_UP : DROP_OFF;
+        route.push_back(RouteStop(type == PICK_UP ? deliveries[delivery_index].pickUp : deliveries[delivery_index].dropOff,
+                delivery_index, type));
+    }
+
+    // Put the new deliveries where they add the least time
+    std::vector<float> loads;
+    for (unsigned i = num_kept; i < deliveries.size(); ++i) {
+        compute_route_loads(route, deliveries, loads);
+
+        InsertionResult insertion;
+        if (!find_best_insertion(route, loads, i, deliveries, plan.truck_capacity, insertion, nullptr)) {
+            // The truck is empty at the end of the route, so it can always go there
+            insertion.pick_up_gap = route.size();
+            insertion.drop_off_gap = route.size();
+        }
+
+        insert_delivery(route, i, deliveries, insertion);
+    }
+
+    std::vector<RouteStop> best_route;
+    double best_time = std::numeric_limits<double>::max();
+
+    // A stop that can't be reached from the old route, or an item too heavy for the truck,
+    // leaves nothing to repair, so the instance is solved again
+    std::vector<bool> is_in_truck(deliveries.size(), false);
+    double route_time = 0;
+    if (!validate_route(route, route_time, is_in_truck, deliveries, plan.truck_capacity)) {
+        return traveling_courier(deliveries, plan.depots, plan.right_turn_penalty, plan.left_turn_penalty,
+                plan.truck_capacity, plan);
+    }
+
+    const double anneal_time_limit = time_limit > 0 ? time_limit : REPLAN_TIME_LIMIT;
+    MAP.courier.stats.construction_time = lap_seconds(phaseStart);
+
+    // A short anneal from the repaired route on each thread
+    #pragma omp parallel
+    {
+        pcg32_fast_init(thread_seed());
+
+        #pragma omp single
+        {
+            MAP.courier.stats.num_threads = omp_get_num_threads();
+            MAP.courier.anneal_stats.assign(omp_get_num_threads(), AnnealStats());
+        }
+
+        std::vector<RouteStop> thread_route = route;
+        double thread_time = route_time;
+        anneal_route(thread_route, thread_time, deliveries, plan.truck_capacity, anneal_time_limit, startTime,
+                &MAP.courier.anneal_stats[omp_get_thread_num()]);
+
+        #pragma omp critical
+        {
+            auto depotStart = std::chrono::high_resolution_clock::now();
+            thread_time += add_closest_depots_to_route(thread_route, plan.depots);
+            MAP.courier.stats.depot_time += lap_seconds(depotStart);
+            if (thread_time < best_time) {
+                best_route = thread_route;
+                best_time = thread_time;
+            }
+        }
+    }
+
+    plan.deliveries = deliveries;
+    plan.route_stops.clear();
+    for (unsigned i = 1; i + 1 < best_route.size(); ++i) {
+        plan.route_stops.push_back(stop_matrix_index(best_route[i]));
+    }
+    MAP.courier.route_stops = plan.route_stops;
+
+    MAP.courier.stats.optimization_time = lap_seconds(phaseStart);
+
+    std::vector<CourierSubpath> route_complete;
+    build_route(best_route, route_complete, plan.depots, plan.right_turn_penalty, plan.left_turn_penalty);
+    MAP.courier.stats.build_route_time = lap_seconds(phaseStart);
+    MAP.courier.stats.total_time = lap_seconds(startTime);
+    merge_best_traces();
+
+    plan.time_between_deliveries = MAP.courier.time_between_deliveries;
+    plan.predecessor_edges = MAP.courier.predecessor_edges;
+    plan.successor_edges = MAP.courier.successor_edges;
+    plan.successor_rows = MAP.courier.successor_rows;
+
+    return route_complete;
+}
+
+
+void reverse_multi_source_dijkstra(
+        const unsigned intersect_id_end,
+        const unsigned column_index,
+        const std::unordered_map<unsigned, std::vector<unsigned>> &rows_at,
+        const float right_turn_penalty,
+        const float left_turn_penalty) {
+    typedef std::pair<double, unsigned> QueueElem;
+    std::priority_queue<QueueElem, std::vector<QueueElem>, std::greater<QueueElem>> wavefront;
+
+    // The time from every intersection to the end, and the edge taken out of it to get there
+    std::vector<double> best_time(getNumIntersections(), std::numeric_limits<double>::max());
+    std::vector<int> edge_out(getNumIntersections(), NO_EDGE);
+    std::vector<bool> is_found(getNumIntersections(), false);
+    std::vector<unsigned> found_at;
+
+    best_time[intersect_id_end] = 0;
+    wavefront.push(std::make_pair(0, intersect_id_end));
+
+    while (!wavefront.empty() && found_at.size() < rows_at.size()) {
+        QueueElem current = wavefront.top();
+        wavefront.pop();
+        unsigned current_id = current.second;
+
+        // Already settled with a faster time
+        if (current.first > best_time[current_id] || is_found[current_id]) continue;
+
+        is_found[current_id] = true;
+        auto rows = rows_at.find(current_id);
+        if (rows != rows_at.end()) {
+            for (unsigned row : rows->second) {
+                MAP.courier.time_between_deliveries[row][column_index] = current.first;
+            }
+            found_at.push_back(current_id);
+        }
+
+        // Check every edge that can be taken into the current intersection
+        for (unsigned edge : MAP.intersection_db[current_id].connected_street_segments) {
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(edge);
+
+            if ((int)edge == edge_out[current_id] || (edgeInfo.oneWay && current_id == (unsigned)edgeInfo.from)) continue;
+
+            unsigned previous_id = ((unsigned)edgeInfo.from == current_id) ? edgeInfo.to : edgeInfo.from;
+
+            // The turn is from this edge onto the edge already taken out of the current intersection
+            double turn_penalty = 0;
+            if (edge_out[current_id] != NO_EDGE) {
+                TurnType turn = find_turn_type(edge, edge_out[current_id]);
+                if (turn == TurnType::LEFT) turn_penalty = left_turn_penalty;
+                else if (turn == TurnType::RIGHT) turn_penalty = right_turn_penalty;
+            }
+
+            double previous_time = current.first + MAP.LocalStreetSegments[edge].travel_time + turn_penalty;
+            if (previous_time < best_time[previous_id]) {
+                best_time[previous_id] = previous_time;
+                edge_out[previous_id] = edge;
+                wavefront.push(std::make_pair(previous_time, previous_id));
+            }
+        }
+    }
+
+    // Keep only the edges on the way from the rows found, the rest of the search isn't needed
+    std::unordered_map<unsigned, int> &successors = MAP.courier.successor_edges[column_index];
+    std::vector<bool> &is_successor_row = MAP.courier.successor_rows[column_index];
+    is_successor_row.assign(MAP.courier.time_between_deliveries.size(), false);
+
+    for (unsigned start_id : found_at) {
+        for (unsigned row : rows_at.at(start_id)) is_successor_row[row] = true;
+
+        unsigned current_id = start_id;
+        while (current_id != intersect_id_end && successors.find(current_id) == successors.end()) {
+            successors[current_id] = edge_out[current_id];
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(edge_out[current_id]);
+            current_id = ((unsigned)edgeInfo.from == current_id) ? edgeInfo.to : edgeInfo.from;
+        }
+    }
+}
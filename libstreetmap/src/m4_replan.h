@@ -0,0 +1,48 @@
+/*
+ * Contains the incremental courier API. A plan keeps the deliveries, the travel
+ * time matrix and the route of a solved instance, so when a few deliveries are
+ * added or cancelled only their rows and columns are searched for, and the old
+ * route is repaired instead of being built again
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+#include <unordered_map>
+
+// Seconds a replan spends annealing the repaired route when no time limit is given
+#define REPLAN_TIME_LIMIT 1.0
+
+struct CourierPlan {
+    std::vector<DeliveryInfo> deliveries;
+    std::vector<unsigned> depots;
+    float right_turn_penalty = 0;
+    float left_turn_penalty = 0;
+    float truck_capacity = 0;
+
+    // Same layout as MAP.courier, empty if the instance was too large for the full matrix
+    std::vector<std::vector<unsigned>> time_between_deliveries;
+    std::vector<std::unordered_map<unsigned, int>> predecessor_edges;
+    std::vector<std::unordered_map<unsigned, int>> successor_edges;
+    std::vector<std::vector<bool>> successor_rows;
+    std::vector<unsigned> route_stops;
+};
+
+// Solves the instance like traveling_courier, keeping what is needed to plan it again in plan
+std::vector<CourierSubpath> traveling_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const float truck_capacity,
+        CourierPlan &plan);
+
+// Removes the cancelled deliveries (indexes in plan.deliveries) and adds the new ones, then
+// anneals the route for time_limit seconds (REPLAN_TIME_LIMIT if it is 0). The deliveries left
+// keep their order in plan.deliveries and the new ones go at the end
+std::vector<CourierSubpath> replan_courier(
+        CourierPlan &plan,
+        const std::vector<DeliveryInfo>& added,
+        const std::vector<unsigned>& cancelled,
+        const double time_limit);
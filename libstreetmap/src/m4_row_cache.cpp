@@ -0,0 +1,152 @@
+/*
+ * Contains the cache of courier searches kept between calls. The rows are
+ * shared pointers, so a search can be read after it was removed from the cache
+ */
+
+#include "m4_row_cache.h"
+#include "m4_courier.h"
+#include "StreetsDatabaseAPI.h"
+#include "map_db.h"
+#include "constants.hpp"
+#include <vector>
+#include <algorithm>
+
+RowCache courier_row_cache(ROW_CACHE_MEMORY_CAP);
+
+
+const SettledIntersection *CachedRow::find(unsigned intersection_id) const {
+    auto it = std::lower_bound(settled.begin(), settled.end(), intersection_id,
+            [](const SettledIntersection &a, unsigned id) {
+                return a.intersection_id < id;
+            });
+
+    if (it == settled.end() || it->intersection_id != intersection_id) return nullptr;
+    return &*it;
+}
+
+
+std::shared_ptr<const CachedRow> RowCache::get(unsigned intersect_id_start, float right_turn_penalty, float left_turn_penalty) {
+    Key key = std::make_tuple(intersect_id_start, right_turn_penalty, left_turn_penalty);
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = entry_of_key.find(key);
+    if (it == entry_of_key.end()) return nullptr;
+
+    // Move to the front, since it was just used
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->second;
+}
+
+
+void RowCache::put(unsigned intersect_id_start, float right_turn_penalty, float left_turn_penalty,
+                   std::shared_ptr<const CachedRow> row) {
+    Key key = std::make_tuple(intersect_id_start, right_turn_penalty, left_turn_penalty);
+    std::lock_guard<std::mutex> guard(lock);
+
+    // A search reaching more intersections replaces the old one
+    auto it = entry_of_key.find(key);
+    if (it != entry_of_key.end()) {
+        memory_used -= it->second->second->memory();
+        entries.erase(it->second);
+        entry_of_key.erase(it);
+    }
+
+    entries.push_front(std::make_pair(key, row));
+    entry_of_key[key] = entries.begin();
+    memory_used += row->memory();
+
+    // Remove the least recently used searches, keeping at least the new one
+    while (memory_used > memory_cap && entries.size() > 1) {
+        memory_used -= entries.back().second->memory();
+        entry_of_key.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+
+void RowCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    entry_of_key.clear();
+    memory_used = 0;
+}
+
+
+void cache_search(unsigned intersect_id_start,
+                  float right_turn_penalty,
+                  float left_turn_penalty,
+                  const std::vector<unsigned> &dests,
+                  std::vector<SettledIntersection> &settled) {
+    std::stable_sort(settled.begin(), settled.end(), [](const SettledIntersection &a, const SettledIntersection &b) {
+        return a.intersection_id < b.intersection_id;
+    });
+
+    CachedRow reached;
+    reached.settled.reserve(settled.size());
+    for (const SettledIntersection &intersection : settled) {
+        // The search can take an intersection off the queue again with a faster time, the last one is kept
+        if (reached.settled.empty() || reached.settled.back().intersection_id != intersection.intersection_id) {
+            reached.settled.push_back(intersection);
+        } else {
+            reached.settled.back() = intersection;
+        }
+    }
+
+    // Walk back from every destination like fill_row_from_cache, stopping once a route already walked is joined
+    std::vector<char> is_on_route(reached.settled.size(), 0);
+    for (unsigned dest : dests) {
+        unsigned current = dest;
+        const SettledIntersection *intersection = reached.find(current);
+
+        while (intersection != nullptr && !is_on_route[intersection - reached.settled.data()]) {
+            is_on_route[intersection - reached.settled.data()] = 1;
+            if (current == intersect_id_start || intersection->edge_in == NO_EDGE) break;
+
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(intersection->edge_in);
+            current = ((unsigned)edgeInfo.from == current) ? edgeInfo.to : edgeInfo.from;
+            intersection = reached.find(current);
+        }
+    }
+
+    std::shared_ptr<CachedRow> row = std::make_shared<CachedRow>();
+    for (unsigned i = 0; i < reached.settled.size(); ++i) {
+        if (is_on_route[i]) row->settled.push_back(reached.settled[i]);
+    }
+    row->settled.shrink_to_fit();
+
+    courier_row_cache.put(intersect_id_start, right_turn_penalty, left_turn_penalty, row);
+}
+
+
+bool fill_row_from_cache(const CachedRow &row,
+                         const unsigned intersect_id_start,
+                         const unsigned row_index,
+                         const std::vector<unsigned> &dests,
+                         std::unordered_map<unsigned, int> *predecessors) {
+    for (unsigned dest : dests) {
+        if (dest != intersect_id_start && row.find(dest) == nullptr) return false;
+    }
+
+    for (unsigned i = 0; i < dests.size(); ++i) {
+        if (dests[i] == intersect_id_start) {
+            MAP.courier.time_between_deliveries[row_index][i] = 0;
+            continue;
+        }
+        MAP.courier.time_between_deliveries[row_index][i] = row.find(dests[i])->time;
+
+        if (predecessors == nullptr) continue;
+
+        // Walk back to the start like store_predecessors, stopping once a stored route is joined
+        unsigned current = dests[i];
+        while (current != intersect_id_start && predecessors->find(current) == predecessors->end()) {
+            const SettledIntersection *settled = row.find(current);
+            if (settled == nullptr || settled->edge_in == NO_EDGE) break;
+
+            (*predecessors)[current] = settled->edge_in;
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(settled->edge_in);
+            current = ((unsigned)edgeInfo.from == current) ? edgeInfo.to : edgeInfo.from;
+        }
+    }
+
+    return true;
+}
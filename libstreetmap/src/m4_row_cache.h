@@ -0,0 +1,86 @@
+/*
+ * Contains the cache of courier searches kept between calls. A search from an
+ * intersection keeps the time and the edge in of every intersection on its
+ * routes to the destinations, so a later call from the same intersection with
+ * the same turn penalties can fill its row without searching if every
+ * destination is in it
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+#include <list>
+#include <map>
+#include <tuple>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+
+// Most bytes of searches kept in the cache at once
+#define ROW_CACHE_MEMORY_CAP (256u * 1024 * 1024)
+
+// An intersection reached by a search, the time and edge are from when it was last taken off the queue
+struct SettledIntersection {
+    unsigned intersection_id;
+    double time;
+    int edge_in;
+};
+
+// The intersections on the routes a search found to its destinations, sorted by id. Keeping every
+// intersection the search reached would take megabytes for a search across a city
+struct CachedRow {
+    std::vector<SettledIntersection> settled;
+
+    // Returns nullptr if the search didn't reach the intersection
+    const SettledIntersection *find(unsigned intersection_id) const;
+
+    std::size_t memory() const {
+        return sizeof(CachedRow) + settled.capacity() * sizeof(SettledIntersection);
+    }
+};
+
+// Searches by start intersection and turn penalties, the least recently used search is removed
+// once the memory cap is reached. Safe to use from multiple threads
+class RowCache {
+public:
+    RowCache(std::size_t _memory_cap) : memory_cap(_memory_cap), memory_used(0) {};
+
+    // Returns nullptr if there is no search from the intersection with these penalties
+    std::shared_ptr<const CachedRow> get(unsigned intersect_id_start, float right_turn_penalty, float left_turn_penalty);
+
+    // Stores a search, replacing the one from the same intersection with the same penalties
+    void put(unsigned intersect_id_start, float right_turn_penalty, float left_turn_penalty,
+             std::shared_ptr<const CachedRow> row);
+
+    void clear();
+
+private:
+    typedef std::tuple<unsigned, float, float> Key;
+    typedef std::pair<Key, std::shared_ptr<const CachedRow>> Entry;
+
+    std::size_t memory_cap;
+    std::size_t memory_used;
+    std::list<Entry> entries; // Most recently used at the front
+    std::map<Key, std::list<Entry>::iterator> entry_of_key;
+    std::mutex lock;
+};
+
+// Kept between calls, cleared when the map is closed
+extern RowCache courier_row_cache;
+
+// Sorts the intersections taken off the queue by a search (keeping the last time each was
+// taken off) and stores the ones on the routes to the destinations in the cache
+void cache_search(unsigned intersect_id_start,
+                  float right_turn_penalty,
+                  float left_turn_penalty,
+                  const std::vector<unsigned> &dests,
+                  std::vector<SettledIntersection> &settled);
+
+// Fills a row of time_between_deliveries and the edges leading to each destination from a
+// cached search. Returns false without changing anything if a destination wasn't reached by it
+bool fill_row_from_cache(const CachedRow &row,
+                         const unsigned intersect_id_start,
+                         const unsigned row_index,
+                         const std::vector<unsigned> &dests,
+                         std::unordered_map<unsigned, int> *predecessors);
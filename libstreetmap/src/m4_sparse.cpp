@@ -0,0 +1,711 @@
+/*
+ * Contains the courier mode used for large instances. Stops use the same
+ * indexes as the matrix (pickup: index * 2, dropoff: index * 2 + 1), but only
+ * the times to their closest stops are searched for up front
+ */
+
+#include "m4_sparse.h"
+#include "m4_courier.h"
+#include "m4_stats.h"
+#include "m1.h"
+#include "m3.h"
+#include "map_db.h"
+#include "constants.hpp"
+#include <vector>
+#include <queue>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+// Marks an intersection that hasn't been reached by a search
+#define UNREACHED std::numeric_limits<float>::max()
+
+// Number of moves tried between checks of the time limit
+#define SPARSE_CLOCK_CHECK 256
+
+// Starting annealing temperature as a fraction of the average time between stops of the first route
+#define SPARSE_START_TEMP 0.05
+
+// Annealing stops early enough to leave this many times the time taken to search for the legs
+// of the first route, for the legs of the final route that weren't in it
+#define SPARSE_LEG_RESERVE 0.3
+
+// Everything the threads share while solving a large instance
+struct SparseInstance {
+    const std::vector<DeliveryInfo>& deliveries;
+    float truck_capacity;
+    std::vector<unsigned> stop_intersection; // Intersection of each stop
+    std::unordered_map<unsigned, std::vector<unsigned>> stops_at; // Stops at each intersection
+    std::vector<std::vector<std::pair<unsigned, float>>> neighbours; // Closest stops to each stop, and the time to them
+    SparseTimeCache cache;
+
+    SparseInstance(const std::vector<DeliveryInfo>& _deliveries, float _truck_capacity)
+        : deliveries(_deliveries),
+          truck_capacity(_truck_capacity),
+          cache(SPARSE_CACHE_SIZE) {};
+};
+
+// Looks for a stop in the neighbour list of another, returns false if it isn't there
+bool sparse_neighbour_time(SparseInstance &instance, unsigned from_stop, unsigned to_stop, float &time);
+
+// Time from one stop to another, from the neighbour list, the cache or a new search
+float sparse_stop_time(SparseInstance &instance, SparseSearch &search, unsigned from_stop, unsigned to_stop);
+
+// Repeatedly travels to the closest stop in the neighbour list that can be visited. If
+// none of them can, travels to the closest stop that can in a straight line
+bool sparse_nearest_neighbour_route(SparseInstance &instance, std::vector<unsigned> &route);
+
+// Anneals the route by moving a stop before or after one of its neighbours until the time
+// runs out. leg_times holds the time from every stop of the route to the next one, and
+// route_time their sum. Leaves the best route found in route and its time in route_time,
+// and fills stats if it isn't null
+void sparse_anneal(SparseInstance &instance,
+                   SparseSearch &search,
+                   std::vector<unsigned> &route,
+                   std::vector<float> &leg_times,
+                   double &route_time,
+                   double time_limit,
+                   std::chrono::high_resolution_clock::time_point startTime,
+                   AnnealStats *stats);
+
+
+bool SparseTimeCache::get(unsigned from, unsigned to, float &time) {
+    uint64_t key = ((uint64_t)from << 32) | to;
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = entry_of_key.find(key);
+    if (it == entry_of_key.end()) return false;
+
+    // Move to the front, since it was just used
+    entries.splice(entries.begin(), entries, it->second);
+    time = it->second->second;
+    return true;
+}
+
+
+void SparseTimeCache::put(unsigned from, unsigned to, float time) {
+    uint64_t key = ((uint64_t)from << 32) | to;
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (entry_of_key.find(key) != entry_of_key.end()) return;
+
+    entries.push_front(std::make_pair(key, time));
+    entry_of_key[key] = entries.begin();
+
+    // Remove the least recently used time
+    if (entries.size() > capacity) {
+        entry_of_key.erase(entries.back().first);
+        entries.pop_back();
+    }
+}
+
+
+void SparseTimeCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    entry_of_key.clear();
+}
+
+
+SparseSearch::SparseSearch(float _right_turn_penalty, float _left_turn_penalty)
+    : right_turn_penalty(_right_turn_penalty),
+      left_turn_penalty(_left_turn_penalty),
+      max_speed(1),
+      best_time(getNumIntersections(), UNREACHED),
+      edge_in(getNumIntersections(), NO_EDGE) {
+
+    for (auto &segment : MAP.LocalStreetSegments) {
+        max_speed = std::max(max_speed, (float)(segment.street_segment_speed_limit / 3.6));
+    }
+}
+
+
+float SparseSearch::edge_cost(unsigned intersection_id, int edge_id) const {
+    float turn_penalty = 0;
+
+    if (edge_in[intersection_id] != NO_EDGE) {
+        TurnType turn = find_turn_type(edge_in[intersection_id], edge_id);
+        if (turn == TurnType::LEFT) turn_penalty = left_turn_penalty;
+        else if (turn == TurnType::RIGHT) turn_penalty = right_turn_penalty;
+    }
+
+    return MAP.LocalStreetSegments[edge_id].travel_time + turn_penalty;
+}
+
+
+void SparseSearch::reset() {
+    for (unsigned id : reached) {
+        best_time[id] = UNREACHED;
+        edge_in[id] = NO_EDGE;
+    }
+    reached.clear();
+}
+
+
+void SparseSearch::closest_stops(unsigned intersect_id_start,
+                                 const std::unordered_map<unsigned, std::vector<unsigned>> &stops_at,
+                                 unsigned max_found,
+                                 std::vector<std::pair<unsigned, float>> &found,
+                                 std::unordered_map<unsigned, int> *predecessors) {
+    typedef std::pair<float, unsigned> QueueElem;
+    std::priority_queue<QueueElem, std::vector<QueueElem>, std::greater<QueueElem>> wavefront;
+
+    found.clear();
+    best_time[intersect_id_start] = 0;
+    reached.push_back(intersect_id_start);
+    wavefront.push(std::make_pair(0, intersect_id_start));
+
+    while (!wavefront.empty() && found.size() < max_found) {
+        QueueElem current = wavefront.top();
+        wavefront.pop();
+        unsigned current_id = current.second;
+
+        // Already settled with a faster time
+        if (current.first > best_time[current_id]) continue;
+
+        auto stops = stops_at.find(current_id);
+        if (stops != stops_at.end()) {
+            for (unsigned stop : stops->second) found.push_back(std::make_pair(stop, current.first));
+
+            // Keep the route to the stops while the edges are still set
+            unsigned id = current_id;
+            unsigned steps = 0;
+            while (predecessors != nullptr && id != intersect_id_start && steps < reached.size()) {
+                if (!predecessors->insert(std::make_pair(id, edge_in[id])).second) break;
+
+                InfoStreetSegment edgeInfo = getInfoStreetSegment(edge_in[id]);
+                id = ((unsigned)edgeInfo.from == id) ? edgeInfo.to : edgeInfo.from;
+                steps++;
+            }
+        }
+
+        for (unsigned edge : MAP.intersection_db[current_id].connected_street_segments) {
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(edge);
+
+            // Can't turn back onto the same edge or go the wrong way on a one way street
+            if ((int)edge == edge_in[current_id] || (edgeInfo.oneWay && current_id == (unsigned)edgeInfo.to)) continue;
+
+            unsigned next_id = ((unsigned)edgeInfo.from == current_id) ? edgeInfo.to : edgeInfo.from;
+            float next_time = current.first + edge_cost(current_id, edge);
+
+            if (next_time < best_time[next_id]) {
+                if (best_time[next_id] == UNREACHED) reached.push_back(next_id);
+                best_time[next_id] = next_time;
+                edge_in[next_id] = edge;
+                wavefront.push(std::make_pair(next_time, next_id));
+            }
+        }
+    }
+
+    reset();
+}
+
+
+float SparseSearch::travel_time(unsigned intersect_id_start,
+                                unsigned intersect_id_end,
+                                std::vector<unsigned> *path) {
+    typedef std::pair<float, unsigned> QueueElem;
+    std::priority_queue<QueueElem, std::vector<QueueElem>, std::greater<QueueElem>> wavefront;
+
+    if (path != nullptr) path->clear();
+    if (intersect_id_start == intersect_id_end) return 0;
+
+    LatLon end_position = getIntersectionPosition(intersect_id_end);
+    float time = NO_ROUTE;
+
+    best_time[intersect_id_start] = 0;
+    reached.push_back(intersect_id_start);
+    wavefront.push(std::make_pair(0, intersect_id_start));
+
+    while (!wavefront.empty()) {
+        unsigned current_id = wavefront.top().second;
+        wavefront.pop();
+
+        if (current_id == intersect_id_end) {
+            time = best_time[current_id];
+            break;
+        }
+
+        for (unsigned edge : MAP.intersection_db[current_id].connected_street_segments) {
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(edge);
+
+            // Can't turn back onto the same edge or go the wrong way on a one way street
+            if ((int)edge == edge_in[current_id] || (edgeInfo.oneWay && current_id == (unsigned)edgeInfo.to)) continue;
+
+            unsigned next_id = ((unsigned)edgeInfo.from == current_id) ? edgeInfo.to : edgeInfo.from;
+            float next_time = best_time[current_id] + edge_cost(current_id, edge);
+
+            if (next_time < best_time[next_id]) {
+                if (best_time[next_id] == UNREACHED) reached.push_back(next_id);
+                best_time[next_id] = next_time;
+                edge_in[next_id] = edge;
+
+                // Estimate the rest of the way at the fastest speed on the map
+                float estimate = find_distance_between_two_points(getIntersectionPosition(next_id), end_position) / max_speed;
+                wavefront.push(std::make_pair(next_time + estimate, next_id));
+            }
+        }
+    }
+
+    // Walk back from the end to get the street segments
+    if (path != nullptr && time != NO_ROUTE) {
+        unsigned id = intersect_id_end;
+        while (id != intersect_id_start && path->size() < reached.size()) {
+            path->push_back(edge_in[id]);
+            InfoStreetSegment edgeInfo = getInfoStreetSegment(edge_in[id]);
+            id = ((unsigned)edgeInfo.from == id) ? edgeInfo.to : edgeInfo.from;
+        }
+        std::reverse(path->begin(), path->end());
+    }
+
+    reset();
+    return time;
+}
+
+
+std::vector<CourierSubpath> sparse_traveling_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const float truck_capacity,
+        const double time_limit) {
+    auto startTime = std::chrono::high_resolution_clock::now();
+    auto phaseStart = startTime;
+    unsigned num_stops = deliveries.size() * 2;
+
+    // The full matrix isn't used, only the search trees to the neighbours are kept
+    MAP.courier.time_between_deliveries.clear();
+    MAP.courier.flat_time_between_deliveries.clear();
+    MAP.courier.num_columns = num_stops;
+    MAP.courier.predecessor_edges.clear();
+    MAP.courier.predecessor_edges.resize(num_stops);
+    MAP.courier.successor_edges.clear();
+    MAP.courier.successor_rows.clear();
+
+    SparseInstance instance(deliveries, truck_capacity);
+    instance.stop_intersection.resize(num_stops);
+    instance.neighbours.resize(num_stops);
+    for (unsigned i = 0; i < deliveries.size(); ++i) {
+        instance.stop_intersection[i * 2] = deliveries[i].pickUp;
+        instance.stop_intersection[i * 2 + 1] = deliveries[i].dropOff;
+        instance.stops_at[deliveries[i].pickUp].push_back(i * 2);
+        instance.stops_at[deliveries[i].dropOff].push_back(i * 2 + 1);
+    }
+
+    std::vector<unsigned> best_route;
+    double best_time = std::numeric_limits<double>::max();
+
+    std::vector<unsigned> first_route;
+    std::vector<float> first_leg_times;
+    std::vector<std::vector<unsigned>> first_leg_paths;
+    std::chrono::high_resolution_clock::time_point leg_start;
+    double anneal_limit = time_limit;
+
+    #pragma omp parallel
+    {
+        pcg32_fast_init(thread_seed());
+        SparseSearch search(right_turn_penalty, left_turn_penalty);
+        std::vector<std::pair<unsigned, float>> found;
+
+        // One search per stop, each only goes as far as the closest stops
+        #pragma omp for schedule(dynamic, 16)
+        for (unsigned i = 0; i < num_stops; ++i) {
+            search.closest_stops(instance.stop_intersection[i], instance.stops_at, SPARSE_NEIGHBOURS + 1,
+                    found, &MAP.courier.predecessor_edges[i]);
+
+            for (auto &stop : found) {
+                if (stop.first != i && instance.neighbours[i].size() < SPARSE_NEIGHBOURS) {
+                    instance.neighbours[i].push_back(stop);
+                }
+            }
+        }
+
+        // One route is built, then the time of its legs are searched for by all threads
+        #pragma omp single
+        {
+            MAP.courier.stats.matrix_time = lap_seconds(phaseStart);
+            MAP.courier.stats.num_threads = omp_get_num_threads();
+            MAP.courier.anneal_stats.assign(omp_get_num_threads(), AnnealStats());
+
+            if (sparse_nearest_neighbour_route(instance, first_route)) {
+                first_leg_times.resize(first_route.size() - 1);
+                first_leg_paths.resize(first_route.size() - 1);
+            } else {
+                first_route.clear();
+            }
+            leg_start = std::chrono::high_resolution_clock::now();
+        }
+
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = 0; i < first_leg_times.size(); ++i) {
+            // The legs that aren't to a neighbour keep their path, most of them are still in the final route
+            if (!sparse_neighbour_time(instance, first_route[i], first_route[i + 1], first_leg_times[i])) {
+                unsigned from = instance.stop_intersection[first_route[i]];
+                unsigned to = instance.stop_intersection[first_route[i + 1]];
+                first_leg_times[i] = search.travel_time(from, to, &first_leg_paths[i]);
+                instance.cache.put(from, to, first_leg_times[i]);
+            }
+        }
+
+        #pragma omp single
+        {
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            double leg_time = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - leg_start).count();
+            double wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime).count();
+            anneal_limit = std::max(wallClock, time_limit - SPARSE_LEG_RESERVE * leg_time);
+            MAP.courier.stats.construction_time = lap_seconds(phaseStart);
+        }
+
+        // Every thread anneals its own copy of the route
+        if (!first_route.empty()) {
+            std::vector<unsigned> route = first_route;
+            std::vector<float> leg_times = first_leg_times;
+            double route_time = 0;
+            for (float time : leg_times) route_time += time;
+
+            sparse_anneal(instance, search, route, leg_times, route_time, anneal_limit, startTime,
+                    &MAP.courier.anneal_stats[omp_get_thread_num()]);
+
+            #pragma omp critical
+            {
+                if (route_time < best_time) {
+                    best_route = route;
+                    best_time = route_time;
+                }
+            }
+        }
+    }
+
+    MAP.courier.route_stops = best_route;
+    MAP.courier.stats.optimization_time = lap_seconds(phaseStart);
+
+    std::vector<CourierSubpath> route_complete;
+    if (best_route.empty()) return route_complete;
+
+    // Pick the depots closest to the ends of the route
+    SparseSearch search(right_turn_penalty, left_turn_penalty);
+    unsigned start_depot = depots[0];
+    unsigned end_depot = depots[0];
+    float start_min = UNREACHED;
+    float end_min = UNREACHED;
+    for (unsigned depot : depots) {
+        float start_time = search.travel_time(depot, instance.stop_intersection[best_route.front()], nullptr);
+        float end_time = search.travel_time(instance.stop_intersection[best_route.back()], depot, nullptr);
+
+        if (start_time < start_min) {
+            start_min = start_time;
+            start_depot = depot;
+        }
+        if (end_time < end_min) {
+            end_min = end_time;
+            end_depot = depot;
+        }
+    }
+
+    MAP.courier.stats.depot_time = lap_seconds(phaseStart);
+
+    // The legs are the depot to the first stop, between every stop, and the last stop to a depot
+    route_complete.resize(best_route.size() + 1);
+    for (unsigned i = 0; i < route_complete.size(); ++i) {
+        CourierSubpath &path = route_complete[i];
+        path.start_intersection = i == 0 ? start_depot : instance.stop_intersection[best_route[i - 1]];
+        path.end_intersection = i == best_route.size() ? end_depot : instance.stop_intersection[best_route[i]];
+        if (i > 0 && best_route[i - 1] % 2 == 0) path.pickUp_indices.push_back(best_route[i - 1] / 2);
+    }
+
+    // Legs of the first route that were searched for, by their stops
+    std::unordered_map<uint64_t, unsigned> first_leg_of;
+    for (unsigned i = 0; i < first_leg_paths.size(); ++i) {
+        if (!first_leg_paths[i].empty()) first_leg_of[((uint64_t)first_route[i] << 32) | first_route[i + 1]] = i;
+    }
+
+    #pragma omp parallel
+    {
+        SparseSearch leg_search(right_turn_penalty, left_turn_penalty);
+
+        #pragma omp for schedule(dynamic)
+        for (unsigned i = 0; i < route_complete.size(); ++i) {
+            CourierSubpath &path = route_complete[i];
+
+            // Legs to a neighbour are already in the search tree of the stop
+            bool is_rebuilt = i > 0 && i < best_route.size()
+                    && backtrace_courier_leg(MAP.courier.predecessor_edges[best_route[i - 1]],
+                            path.start_intersection, path.end_intersection, path.subpath);
+
+            if (!is_rebuilt && i > 0 && i < best_route.size()) {
+                auto first_leg = first_leg_of.find(((uint64_t)best_route[i - 1] << 32) | best_route[i]);
+                if (first_leg != first_leg_of.end()) {
+                    path.subpath = first_leg_paths[first_leg->second];
+                    is_rebuilt = true;
+                }
+            }
+
+            if (!is_rebuilt) leg_search.travel_time(path.start_intersection, path.end_intersection, &path.subpath);
+        }
+    }
+
+    MAP.courier.stats.build_route_time = lap_seconds(phaseStart);
+    merge_best_traces();
+
+    return route_complete;
+}
+
+
+bool sparse_neighbour_time(SparseInstance &instance, unsigned from_stop, unsigned to_stop, float &time) {
+    for (auto &neighbour : instance.neighbours[from_stop]) {
+        if (neighbour.first == to_stop) {
+            time = neighbour.second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+float sparse_stop_time(SparseInstance &instance, SparseSearch &search, unsigned from_stop, unsigned to_stop) {
+    float time;
+    if (sparse_neighbour_time(instance, from_stop, to_stop, time)) return time;
+
+    unsigned from = instance.stop_intersection[from_stop];
+    unsigned to = instance.stop_intersection[to_stop];
+    if (from == to) return 0;
+
+    if (!instance.cache.get(from, to, time)) {
+        time = search.travel_time(from, to, nullptr);
+        instance.cache.put(from, to, time);
+    }
+
+    return time;
+}
+
+
+bool sparse_nearest_neighbour_route(SparseInstance &instance, std::vector<unsigned> &route) {
+    const std::vector<DeliveryInfo>& deliveries = instance.deliveries;
+    route.clear();
+
+    // 0: waiting for pickup, 1: in the truck, 2: delivered
+    std::vector<char> state(deliveries.size(), 0);
+    float current_weight = 0;
+
+    // Deliveries that aren't delivered yet, for when no neighbour can be visited
+    std::vector<unsigned> remaining(deliveries.size());
+    std::vector<unsigned> remaining_index(deliveries.size());
+    for (unsigned i = 0; i < deliveries.size(); ++i) remaining[i] = remaining_index[i] = i;
+
+    unsigned current = (pcg32_fast() % deliveries.size()) * 2;
+    if (deliveries[current / 2].itemWeight > instance.truck_capacity) return false;
+
+    while (true) {
+        unsigned delivery_index = current / 2;
+        route.push_back(current);
+
+        if (current % 2 == 0) {
+            state[delivery_index] = 1;
+            current_weight += deliveries[delivery_index].itemWeight;
+        } else {
+            state[delivery_index] = 2;
+            current_weight -= deliveries[delivery_index].itemWeight;
+
+            // Swap it with the last remaining delivery to remove it
+            unsigned last = remaining.back();
+            remaining[remaining_index[delivery_index]] = last;
+            remaining_index[last] = remaining_index[delivery_index];
+            remaining.pop_back();
+        }
+
+        if (remaining.empty()) return true;
+
+        int closest = -1;
+        float closest_time = UNREACHED;
+
+        for (auto &neighbour : instance.neighbours[current]) {
+            unsigned next_delivery = neighbour.first / 2;
+            bool can_visit = neighbour.first % 2 == 0
+                    ? state[next_delivery] == 0 && current_weight + deliveries[next_delivery].itemWeight <= instance.truck_capacity
+                    : state[next_delivery] == 1;
+
+            if (can_visit && neighbour.second < closest_time) {
+                closest = neighbour.first;
+                closest_time = neighbour.second;
+            }
+        }
+
+        // None of the neighbours can be visited, go to the closest stop that can
+        if (closest == -1) {
+            LatLon position = getIntersectionPosition(instance.stop_intersection[current]);
+            double closest_distance = std::numeric_limits<double>::max();
+
+            for (unsigned i : remaining) {
+                unsigned next;
+                if (state[i] == 0 && current_weight + deliveries[i].itemWeight <= instance.truck_capacity) next = i * 2;
+                else if (state[i] == 1) next = i * 2 + 1;
+                else continue;
+
+                double distance = find_distance_between_two_points(position, getIntersectionPosition(instance.stop_intersection[next]));
+                if (distance < closest_distance) {
+                    closest = next;
+                    closest_distance = distance;
+                }
+            }
+        }
+
+        if (closest == -1) return false;
+        current = closest;
+    }
+}
+
+
+void sparse_anneal(SparseInstance &instance,
+                   SparseSearch &search,
+                   std::vector<unsigned> &route,
+                   std::vector<float> &leg_times,
+                   double &route_time,
+                   double time_limit,
+                   std::chrono::high_resolution_clock::time_point startTime,
+                   AnnealStats *stats) {
+    const std::vector<DeliveryInfo>& deliveries = instance.deliveries;
+    unsigned num_stops = route.size();
+
+    auto annealStart = std::chrono::high_resolution_clock::now();
+    double start_clock = std::chrono::duration_cast<std::chrono::duration<double>> (annealStart - startTime).count();
+    double next_sample = start_clock + STATS_TRACE_INTERVAL;
+
+    AnnealStats thread_stats;
+    thread_stats.initial_time = route_time;
+    thread_stats.trace.push_back(std::make_pair(start_clock, route_time));
+
+    // Position of every stop in the route and the weight in the truck after it
+    std::vector<unsigned> position(num_stops);
+    std::vector<float> load(num_stops);
+    float current_weight = 0;
+    for (unsigned i = 0; i < num_stops; ++i) {
+        position[route[i]] = i;
+        current_weight += route[i] % 2 == 0 ? deliveries[route[i] / 2].itemWeight : -deliveries[route[i] / 2].itemWeight;
+        load[i] = current_weight;
+    }
+
+    double best_time = route_time;
+    std::vector<unsigned> best_route = route;
+
+    float start_temp = SPARSE_START_TEMP * route_time / std::max(1u, num_stops - 1);
+    float temp = start_temp;
+    unsigned long moves = 0;
+    unsigned long last_copy = 0;
+    thread_stats.start_temp = start_temp;
+
+    while (true) {
+        // Check if the time ran out and cool down with the time left
+        if (++moves % SPARSE_CLOCK_CHECK == 0) {
+            auto currentTime = std::chrono::high_resolution_clock::now();
+            double wallClock = std::chrono::duration_cast<std::chrono::duration<double>> (currentTime - startTime).count();
+
+            if (wallClock >= next_sample) {
+                thread_stats.trace.push_back(std::make_pair(wallClock, best_time));
+                next_sample = wallClock + STATS_TRACE_INTERVAL;
+            }
+
+            if (wallClock >= time_limit) break;
+            temp = start_temp * (time_limit - wallClock) / time_limit;
+        }
+
+        // Move a random stop before or after one of its neighbours
+        unsigned from = pcg32_fast() % num_stops;
+        unsigned stop = route[from];
+        if (instance.neighbours[stop].empty()) continue;
+
+        unsigned neighbour = instance.neighbours[stop][pcg32_fast() % instance.neighbours[stop].size()].first;
+        unsigned to = position[neighbour] + (pcg32_fast() & 1); // The stop goes before the stop at this position
+        if (to == from || to == from + 1) continue;
+
+        bool is_pick_up = stop % 2 == 0;
+        unsigned other = position[stop ^ 1]; // Position of the other stop of the delivery
+        float weight = deliveries[stop / 2].itemWeight;
+
+        // The pickup must stay before the dropoff
+        if (to > from && is_pick_up && other < to) continue;
+        if (to < from && !is_pick_up && other >= to) continue;
+
+        // Moving a dropoff later or a pickup earlier carries the item past more stops
+        bool is_legal = true;
+        if (to > from && !is_pick_up) {
+            for (unsigned i = from + 1; i < to && is_legal; ++i) is_legal = load[i] + weight <= instance.truck_capacity;
+        } else if (to < from && is_pick_up) {
+            for (unsigned i = to > 0 ? to - 1 : 0; i < from && is_legal; ++i) is_legal = load[i] + weight <= instance.truck_capacity;
+        }
+        if (!is_legal) continue;
+        thread_stats.legal_swaps++;
+
+        // Only the three new legs need to be looked up, the legs removed are already known
+        bool has_before = from > 0, has_after = from + 1 < num_stops;
+        bool has_new_before = to > 0, has_new_after = to < num_stops;
+        float time_closed = has_before && has_after ? sparse_stop_time(instance, search, route[from - 1], route[from + 1]) : 0;
+        float time_into = has_new_before ? sparse_stop_time(instance, search, route[to - 1], stop) : 0;
+        float time_out_of = has_new_after ? sparse_stop_time(instance, search, stop, route[to]) : 0;
+
+        float removed = (has_before ? leg_times[from - 1] : 0) + (has_after ? leg_times[from] : 0) - time_closed;
+        float added = time_into + time_out_of - (has_new_before && has_new_after ? leg_times[to - 1] : 0);
+
+        float change = added - removed;
+        if (change >= 0 && (temp <= 0 || pcg32_fast() / 4294967296.0 >= exp(-change / temp))) continue;
+        thread_stats.accepted_swaps++;
+        if (change > 0) thread_stats.uphill_swaps++;
+
+        // Move the stop and the legs in between, then set the new legs
+        unsigned first, last;
+        if (to > from) {
+            std::rotate(route.begin() + from, route.begin() + from + 1, route.begin() + to);
+            std::rotate(leg_times.begin() + from, leg_times.begin() + from + 1, leg_times.begin() + to - 1);
+            if (has_before) leg_times[from - 1] = time_closed;
+            leg_times[to - 2] = time_into;
+            if (has_new_after) leg_times[to - 1] = time_out_of;
+            first = from;
+            last = to - 1;
+        } else {
+            std::rotate(route.begin() + to, route.begin() + from, route.begin() + from + 1);
+            std::rotate(leg_times.begin() + to, leg_times.begin() + from - 1, leg_times.begin() + from);
+            if (has_new_before) leg_times[to - 1] = time_into;
+            leg_times[to] = time_out_of;
+            if (has_after) leg_times[from] = time_closed;
+            first = to;
+            last = from;
+        }
+
+        // Update the positions and loads that changed
+        current_weight = first > 0 ? load[first - 1] : 0;
+        for (unsigned i = first; i <= last; ++i) {
+            position[route[i]] = i;
+            current_weight += route[i] % 2 == 0 ? deliveries[route[i] / 2].itemWeight : -deliveries[route[i] / 2].itemWeight;
+            load[i] = current_weight;
+        }
+
+        route_time += change;
+
+        // Copying the route is linear, so only copy it once enough moves were made
+        if (route_time < best_time && moves - last_copy > num_stops) {
+            thread_stats.improvements++;
+            best_time = route_time;
+            best_route = route;
+            last_copy = moves;
+        }
+    }
+
+    // The last route is usually the best once cooled
+    if (best_time < route_time) {
+        route = best_route;
+        route_time = best_time;
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    thread_stats.swaps = moves;
+    thread_stats.final_temp = temp;
+    thread_stats.run_time = std::chrono::duration_cast<std::chrono::duration<double>> (endTime - annealStart).count();
+    thread_stats.best_time = route_time;
+    thread_stats.trace.push_back(std::make_pair(start_clock + thread_stats.run_time, route_time));
+    if (thread_stats.legal_swaps > 0) thread_stats.accept_ratio = (double)thread_stats.accepted_swaps / thread_stats.legal_swaps;
+    if (thread_stats.run_time > 0) thread_stats.improvement_rate = (thread_stats.initial_time - route_time) / thread_stats.run_time;
+    if (stats != nullptr) *stats = thread_stats;
+}
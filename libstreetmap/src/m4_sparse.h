@@ -0,0 +1,91 @@
+/*
+ * Contains the courier mode used for large instances. Instead of the full
+ * travel time matrix, every stop only keeps the stops closest to it (by travel
+ * time), other times are searched for when needed and kept in a bounded cache,
+ * and the optimization only moves a stop next to one of its neighbours
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <vector>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <stdint.h>
+
+// Smallest number of deliveries solved with neighbour lists instead of the full matrix
+#define SPARSE_MIN_DELIVERIES 400
+
+// Number of closest stops kept for each stop
+#define SPARSE_NEIGHBOURS 16
+
+// Most travel times kept in the cache at once
+#define SPARSE_CACHE_SIZE 2000000
+
+// Travel times between intersections that aren't in the neighbour lists, the least
+// recently used time is removed once the cache is full. Safe to use from multiple threads
+class SparseTimeCache {
+public:
+    SparseTimeCache(unsigned _capacity) : capacity(_capacity) {};
+
+    // Returns false if the time from one intersection to the other isn't stored
+    bool get(unsigned from, unsigned to, float &time);
+
+    void put(unsigned from, unsigned to, float time);
+
+    void clear();
+
+private:
+    typedef std::pair<uint64_t, float> Entry;
+
+    unsigned capacity;
+    std::list<Entry> entries; // Most recently used at the front
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> entry_of_key;
+    std::mutex lock;
+};
+
+// Searches that only touch part of the map, each thread needs its own. Only the
+// intersections reached are reset afterwards, so small searches stay cheap on large maps
+class SparseSearch {
+public:
+    SparseSearch(float _right_turn_penalty, float _left_turn_penalty);
+
+    // Finds the closest stops to an intersection until max_found stops are reached. stops_at gives
+    // the stops (matrix indexes) at an intersection. If predecessors is not null, the edges
+    // leading to the stops found are stored in it
+    void closest_stops(unsigned intersect_id_start,
+                       const std::unordered_map<unsigned, std::vector<unsigned>> &stops_at,
+                       unsigned max_found,
+                       std::vector<std::pair<unsigned, float>> &found,
+                       std::unordered_map<unsigned, int> *predecessors);
+
+    // A* search between two intersections, returns NO_ROUTE if there is no route.
+    // The street segments are stored in path if it is not null
+    float travel_time(unsigned intersect_id_start,
+                      unsigned intersect_id_end,
+                      std::vector<unsigned> *path);
+
+private:
+    // Adds the turn penalty and travel time of taking an edge out of an intersection
+    float edge_cost(unsigned intersection_id, int edge_id) const;
+
+    void reset();
+
+    float right_turn_penalty;
+    float left_turn_penalty;
+    float max_speed; // Fastest speed limit on the map in m/s, keeps the A* estimate below the real time
+    std::vector<float> best_time;
+    std::vector<int> edge_in;
+    std::vector<unsigned> reached;
+};
+
+// Solves the courier problem with neighbour lists, taking at most time_limit seconds. Fills the
+// phase timings and the counters of every annealing thread in MAP.courier, but not total_time
+std::vector<CourierSubpath> sparse_traveling_courier(
+        const std::vector<DeliveryInfo>& deliveries,
+        const std::vector<unsigned>& depots,
+        const float right_turn_penalty,
+        const float left_turn_penalty,
+        const float truck_capacity,
+        const double time_limit);
@@ -0,0 +1,108 @@
+/*
+ * Contains the statistics kept about each call of traveling_courier
+ */
+
+#include "m4_stats.h"
+#include "map_db.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+
+// Writes a trace as a JSON array of [seconds, route time] pairs
+void write_trace_json(std::ostringstream &json, const std::vector<std::pair<float, float>> &trace);
+
+
+void reset_courier_stats(courier_mode mode) {
+    MAP.courier.stats = CourierStats();
+    MAP.courier.stats.mode = mode == MEMETIC_MODE ? "memetic" : "anneal";
+    MAP.courier.anneal_stats.clear();
+}
+
+
+double lap_seconds(std::chrono::high_resolution_clock::time_point &phase_start) {
+    auto now = std::chrono::high_resolution_clock::now();
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>> (now - phase_start).count();
+    phase_start = now;
+    return seconds;
+}
+
+
+void merge_best_traces() {
+    std::vector<std::pair<float, float>> &best_trace = MAP.courier.stats.best_trace;
+    for (const AnnealStats &thread_stats : MAP.courier.anneal_stats) {
+        best_trace.insert(best_trace.end(), thread_stats.trace.begin(), thread_stats.trace.end());
+    }
+    std::sort(best_trace.begin(), best_trace.end());
+
+    // Keep the samples where the best of all threads got faster
+    std::vector<std::pair<float, float>> merged;
+    for (const std::pair<float, float> &sample : best_trace) {
+        if (merged.empty() || sample.second < merged.back().second) merged.push_back(sample);
+    }
+    best_trace.swap(merged);
+}
+
+
+std::string courier_stats_json() {
+    const CourierStats &stats = MAP.courier.stats;
+    std::ostringstream json;
+
+    json << "{\"mode\": \"" << stats.mode << "\""
+         << ", \"num_threads\": " << stats.num_threads
+         << ", \"cached_rows\": " << stats.cached_rows
+         << ", \"phases\": {\"matrix\": " << stats.matrix_time
+         << ", \"construction\": " << stats.construction_time
+         << ", \"optimization\": " << stats.optimization_time
+         << ", \"depots\": " << stats.depot_time
+         << ", \"build_route\": " << stats.build_route_time
+         << ", \"total\": " << stats.total_time << "}"
+         << ", \"best_trace\": ";
+    write_trace_json(json, stats.best_trace);
+
+    json << ", \"threads\": [";
+    for (unsigned i = 0; i < MAP.courier.anneal_stats.size(); ++i) {
+        const AnnealStats &thread_stats = MAP.courier.anneal_stats[i];
+        if (i > 0) json << ", ";
+
+        json << "{\"swaps\": " << thread_stats.swaps
+             << ", \"legal_swaps\": " << thread_stats.legal_swaps
+             << ", \"accepted_swaps\": " << thread_stats.accepted_swaps
+             << ", \"uphill_swaps\": " << thread_stats.uphill_swaps
+             << ", \"improvements\": " << thread_stats.improvements
+             << ", \"reheats\": " << thread_stats.reheats
+             << ", \"start_temp\": " << thread_stats.start_temp
+             << ", \"final_temp\": " << thread_stats.final_temp
+             << ", \"initial_time\": " << thread_stats.initial_time
+             << ", \"best_time\": " << thread_stats.best_time
+             << ", \"run_time\": " << thread_stats.run_time
+             << ", \"accept_ratio\": " << thread_stats.accept_ratio
+             << ", \"improvement_rate\": " << thread_stats.improvement_rate
+             << ", \"trace\": ";
+        write_trace_json(json, thread_stats.trace);
+        json << "}";
+    }
+    json << "]}";
+
+    return json.str();
+}
+
+
+bool save_courier_stats(const std::string &file_name) {
+    std::ofstream file(file_name);
+    if (!file) return false;
+
+    file << courier_stats_json() << std::endl;
+    return (bool)file;
+}
+
+
+void write_trace_json(std::ostringstream &json, const std::vector<std::pair<float, float>> &trace) {
+    json << "[";
+    for (unsigned i = 0; i < trace.size(); ++i) {
+        if (i > 0) json << ", ";
+        json << "[" << trace[i].first << ", " << trace[i].second << "]";
+    }
+    json << "]";
+}
@@ -0,0 +1,31 @@
+/*
+ * Contains the statistics kept about each call of traveling_courier, and of
+ * fleet_courier and replan_courier. The timing of every phase is in
+ * MAP.courier.stats and the counters of every annealing thread in
+ * MAP.courier.anneal_stats, both can be saved as JSON so the solver can be
+ * tuned from real runs
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include <string>
+#include <chrono>
+
+// Seconds between samples of the best route time
+#define STATS_TRACE_INTERVAL 0.05
+
+// Clears the statistics of the last call
+void reset_courier_stats(courier_mode mode);
+
+// Returns the seconds since phase_start and moves phase_start to now
+double lap_seconds(std::chrono::high_resolution_clock::time_point &phase_start);
+
+// Merges the traces of the threads into the best route time of any thread over time
+void merge_best_traces();
+
+// The statistics of the last call as a JSON object
+std::string courier_stats_json();
+
+// Writes courier_stats_json to a file, returns false if the file can't be written
+bool save_courier_stats(const std::string &file_name);
@@ -0,0 +1,71 @@
+/*
+ * Contains the time windows of the courier problem. The truck leaves the depot
+ * at time 0 and may wait at a stop for its window, which doesn't add to the
+ * time of the route
+ */
+
+#include "m4_windows.h"
+#include "m4_courier.h"
+#include "map_db.h"
+#include <vector>
+
+
+void set_time_windows(const std::vector<DeliveryWindows> &windows, unsigned num_depots) {
+    MAP.courier.window_earliest.clear();
+    MAP.courier.window_latest.clear();
+    MAP.courier.depot_arrival.clear();
+    if (windows.empty()) return;
+
+    for (const DeliveryWindows &delivery : windows) {
+        MAP.courier.window_earliest.push_back(delivery.pick_up.earliest);
+        MAP.courier.window_latest.push_back(delivery.pick_up.latest);
+        MAP.courier.window_earliest.push_back(delivery.drop_off.earliest);
+        MAP.courier.window_latest.push_back(delivery.drop_off.latest);
+    }
+
+    for (unsigned i = 0; i < MAP.courier.num_columns; ++i) {
+        MAP.courier.depot_arrival.push_back(closest_depot_time(i, num_depots));
+    }
+}
+
+
+void compute_route_schedule(const std::vector<RouteStop> &route, RouteSchedule &schedule) {
+    schedule.departure.resize(route.size());
+    schedule.latest_arrival.resize(route.size());
+    if (route.empty()) return;
+
+    unsigned previous = stop_matrix_index(route[0]);
+    schedule.departure[0] = window_departure(previous, MAP.courier.depot_arrival[previous]);
+    for (unsigned i = 1; i < route.size(); ++i) {
+        unsigned stop = stop_matrix_index(route[i]);
+        schedule.departure[i] = window_departure(stop, schedule.departure[i - 1] + flat_travel_time(previous, stop));
+        previous = stop;
+    }
+
+    // The last stop only has its own window, every other stop also has to leave in time for the next
+    unsigned next = stop_matrix_index(route.back());
+    schedule.latest_arrival.back() = MAP.courier.window_latest[next];
+    for (int i = route.size() - 2; i >= 0; --i) {
+        unsigned stop = stop_matrix_index(route[i]);
+        schedule.latest_arrival[i] = window_latest_arrival(stop, next, schedule.latest_arrival[i + 1]);
+        next = stop;
+    }
+}
+
+
+bool route_meets_windows(const std::vector<RouteStop> &route) {
+    if (route.empty()) return true;
+
+    unsigned previous = stop_matrix_index(route[0]);
+    float arrival = MAP.courier.depot_arrival[previous];
+
+    for (unsigned i = 0; i < route.size(); ++i) {
+        unsigned stop = stop_matrix_index(route[i]);
+        if (i > 0) arrival = window_departure(previous, arrival) + flat_travel_time(previous, stop);
+        if (arrival > MAP.courier.window_latest[stop]) return false;
+
+        previous = stop;
+    }
+
+    return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * Contains the time windows of the courier problem. Besides the time it leaves
+ * each stop, a route keeps the latest time it can arrive at each stop so the
+ * rest of it still meets its windows, so a stop put in a gap only needs the
+ * stops on both sides of it to be checked
+ */
+
+#pragma once
+
+#include "m4_courier.h"
+#include "map_db.h"
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+// Latest arrival at a stop that can't be reached in time whenever the truck gets there
+#define NO_LATEST_ARRIVAL (-std::numeric_limits<float>::max())
+
+// When each stop of a route is left and the latest it can be arrived at
+struct RouteSchedule {
+    std::vector<float> departure;
+    std::vector<float> latest_arrival;
+};
+
+// Whether the current instance has time windows
+inline bool has_time_windows() {
+    return !MAP.courier.window_latest.empty();
+}
+
+// Time the truck leaves a stop it arrives at, after waiting for the window to open
+inline float window_departure(unsigned stop_index, float arrival) {
+    return std::max(arrival, MAP.courier.window_earliest[stop_index]);
+}
+
+// Latest arrival at a stop that is followed by a stop with the given latest arrival
+inline float window_latest_arrival(unsigned stop_index, unsigned next_index, float next_latest) {
+    float travel_time = flat_travel_time(stop_index, next_index);
+    if (MAP.courier.window_earliest[stop_index] + travel_time > next_latest) return NO_LATEST_ARRIVAL;
+
+    return std::min(MAP.courier.window_latest[stop_index], next_latest - travel_time);
+}
+
+// Stores the windows by matrix index along with the time from the closest depot to each stop.
+// Needs the flat matrix and one entry of windows per delivery in it, and clears the windows if there are none
+void set_time_windows(const std::vector<DeliveryWindows> &windows, unsigned num_depots);
+
+// Fills the schedule of a route (without depots) that starts at the depot closest to its first stop
+void compute_route_schedule(const std::vector<RouteStop> &route, RouteSchedule &schedule);
+
+// Returns false if the route arrives at a stop after its window closes
+bool route_meets_windows(const std::vector<RouteStop> &route);
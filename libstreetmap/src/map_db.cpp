@@ -6,12 +6,16 @@
 
 #include "map_db.h"
 #include "constants.hpp"
-#include "KD2Tree.h"
+#include "KDTree.h"
 #include "StreetsDatabaseAPI.h"
 #include "OSMDatabaseAPI.h"
 #include <map>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 #include <boost/algorithm/string.hpp>
 #include "helper_functions.h"
+#include "m4_row_cache.h"
 
 //define the global MAP object
 MapInfo MAP;
@@ -25,10 +29,8 @@ void load_street_segments () {
     // Resize for tiny performance benefit
     MAP.street_db.resize(getNumStreets());
     
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> street_segs_zoom_m1;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> street_segs_zoom_0;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> street_segs_zoom_1;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> street_segs_zoom_2;
+    // Bounding box of each segment, for the zoom level it is drawn from
+    std::vector<std::vector<std::pair<RTreeBox, unsigned int>>> street_seg_boxes(NUM_DRAW_ZOOM_LEVELS);
     
     //Iterating through all street segments
     //Loads up street_db with all segments of a street, and calculate lengths
@@ -49,39 +51,38 @@ void load_street_segments () {
         MAP.street_db[segment.streetID].average_speed = (MAP.street_db[segment.streetID].average_speed*MAP.street_db[segment.streetID].segments.size() +
                                                            + MAP.LocalStreetSegments[i].street_segment_speed_limit)/(MAP.street_db[segment.streetID].segments.size() + 1);
 
-        // Add to/from positions to street segs vector for appropriate zoom level in KD2Tree
-        std::pair<double, double> f_point = std::make_pair(x_from_lon(MAP.intersection_db[segment.from].position.lon()), y_from_lat(MAP.intersection_db[segment.from].position.lat()));
-        std::pair<std::pair<double, double>, unsigned int> from_pt = std::make_pair(f_point, i);
-        
-        std::pair<double, double> t_point = std::make_pair(x_from_lon(MAP.intersection_db[segment.to].position.lon()), y_from_lat(MAP.intersection_db[segment.to].position.lat()));
-        std::pair<std::pair<double, double>, unsigned int> to_pt = std::make_pair(t_point, i);
-        
+        // Box around the to/from positions and curve points of the segment
+        double f_x = x_from_lon(MAP.intersection_db[segment.from].position.lon());
+        double f_y = y_from_lat(MAP.intersection_db[segment.from].position.lat());
+        double t_x = x_from_lon(MAP.intersection_db[segment.to].position.lon());
+        double t_y = y_from_lat(MAP.intersection_db[segment.to].position.lat());
+        RTreeBox box = {std::min(f_x, t_x), std::min(f_y, t_y), std::max(f_x, t_x), std::max(f_y, t_y)};
+        for(int j = 0; j < segment.curvePointCount; j++) {
+            LatLon curve_point = getStreetSegmentCurvePoint(j, i);
+            box.min_x = std::min(box.min_x, x_from_lon(curve_point.lon()));
+            box.min_y = std::min(box.min_y, y_from_lat(curve_point.lat()));
+            box.max_x = std::max(box.max_x, x_from_lon(curve_point.lon()));
+            box.max_y = std::max(box.max_y, y_from_lat(curve_point.lat()));
+        }
         
+        int zoom_level;
         if(MAP.LocalStreetSegments[i].importance_level < 0) {
-            street_segs_zoom_m1.push_back(from_pt);
-            street_segs_zoom_m1.push_back(to_pt);
+            zoom_level = -1;
         } else if(MAP.LocalStreetSegments[i].importance_level <= 2) {
-            street_segs_zoom_0.push_back(from_pt);
-            street_segs_zoom_0.push_back(to_pt);
+            zoom_level = 0;
         } else if(MAP.LocalStreetSegments[i].importance_level <=3 && MAP.street_db[segment.streetID].length > 200 && MAP.street_db[segment.streetID].length < 1000000) {
-            street_segs_zoom_1.push_back(from_pt);
-            street_segs_zoom_1.push_back(to_pt);
+            zoom_level = 1;
         } else {
-            street_segs_zoom_2.push_back(from_pt);
-            street_segs_zoom_2.push_back(to_pt);
+            zoom_level = 2;
         }
+        street_seg_boxes[zoom_level - MIN_DRAW_ZOOM_LEVEL].push_back(std::make_pair(box, i));
     }
     
-    // Load both zoom levels to tree
-    MAP.street_seg_k2tree.root = MAP.street_seg_k2tree.make_tree(street_segs_zoom_m1.begin(), street_segs_zoom_m1.end(), 0, street_segs_zoom_m1.size(), -1);
-    MAP.street_seg_k2tree.insert_bulk(street_segs_zoom_0.begin(), street_segs_zoom_0.end(), MAP.street_seg_k2tree.root, 0, street_segs_zoom_0.size(), 0);
-    MAP.street_seg_k2tree.insert_bulk(street_segs_zoom_1.begin(), street_segs_zoom_1.end(), MAP.street_seg_k2tree.root, 0, street_segs_zoom_1.size(), 1);
-    MAP.street_seg_k2tree.insert_bulk(street_segs_zoom_2.begin(), street_segs_zoom_2.end(), MAP.street_seg_k2tree.root, 0, street_segs_zoom_2.size(), 2);
-         
-    street_segs_zoom_m1.clear();
-    street_segs_zoom_0.clear();
-    street_segs_zoom_1.clear();
-    street_segs_zoom_2.clear();
+    // One tree for each zoom level
+    MAP.street_seg_rtrees.resize(NUM_DRAW_ZOOM_LEVELS);
+    for(int z = 0; z < NUM_DRAW_ZOOM_LEVELS; z++) {
+        MAP.street_seg_rtrees[z].make_tree(street_seg_boxes[z]);
+    }
 }
 
 
@@ -114,6 +115,15 @@ void load_intersections () {
         MAP.world_values.min_lon = std::min(MAP.world_values.min_lon, MAP.intersection_db[i].position.lon());
     }
     
+    // The positions depend on the world values, so the tree is built once they are all known
+    std::vector<KD2Tree::Item> intersection_points;
+    intersection_points.reserve(MAP.intersection_db.size());
+    for(unsigned i = 0; i < MAP.intersection_db.size(); i++) {
+        KD2Tree::Point point = {{float(x_from_lon(MAP.intersection_db[i].position.lon())), float(y_from_lat(MAP.intersection_db[i].position.lat()))}};
+        intersection_points.push_back(std::make_pair(point, i));
+    }
+    MAP.intersection_k2tree.make_tree(intersection_points, -1);
+    
     //initialize out of bounds
     MAP.state.last_selected_intersection = MAP.intersection_db.size() + 1;
     MAP.route_data.start_intersection = MAP.intersection_db.size() + 1;
@@ -142,36 +152,173 @@ void load_streets () {
         // insert pair into multimap - multimap allows for duplicate keys
         MAP.street_name_id_map.insert(std::pair <std::string, int> (street_name, i));
     }
+    
+    load_street_pairs();
+}
+
+
+// Finds the intersections shared by every pair of different streets from the streets of the
+// segments at each intersection. They are sorted by pair and then intersection id, so the
+// intersections of each pair are in the same order as the intersections of its streets
+void load_street_pairs () {
+    std::vector<std::pair<uint64_t, unsigned>> pairs;
+    std::vector<unsigned> streets;
+    
+    for(int i = 0; i < getNumIntersections(); i++) {
+        streets.clear();
+        for(int j = 0; j < getIntersectionStreetSegmentCount(i); j++) {
+            streets.push_back(getInfoStreetSegment(getIntersectionStreetSegment(j, i)).streetID);
+        }
+        removeDuplicates(streets);
+        
+        for(unsigned a = 0; a < streets.size(); a++) {
+            for(unsigned b = a + 1; b < streets.size(); b++) {
+                pairs.push_back(std::make_pair(street_pair_key(streets[a], streets[b]), i));
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    
+    MAP.street_pair_intersections.resize(pairs.size());
+    MAP.street_pair_ranges.reserve(pairs.size());
+    for(unsigned begin = 0; begin < pairs.size(); ) {
+        unsigned end = begin;
+        while(end < pairs.size() && pairs[end].first == pairs[begin].first) {
+            MAP.street_pair_intersections[end] = pairs[end].second;
+            end++;
+        }
+        MAP.street_pair_ranges[pairs[begin].first] = std::make_pair(begin, end);
+        begin = end;
+    }
+}
+
+
+uint64_t street_pair_key (unsigned street_id1, unsigned street_id2) {
+    return (uint64_t(std::min(street_id1, street_id2)) << 32) | std::max(street_id1, street_id2);
 }
 
 
 void load_points_of_interest () {
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> poi_zoom_0;
+    std::vector<KD2Tree::Item> poi_zoom_0;
     
     for (unsigned int i = 0; i < unsigned(getNumPointsOfInterest()); i++) {
         
-        double x = x_from_lon(getPointOfInterestPosition(i).lon());
-        double y = y_from_lat(getPointOfInterestPosition(i).lat());
+        float x = x_from_lon(getPointOfInterestPosition(i).lon());
+        float y = y_from_lat(getPointOfInterestPosition(i).lat());
         
-        std::pair<std::pair<double, double>, unsigned int> point = std::make_pair(std::make_pair(x, y), i);
+        KD2Tree::Item point = std::make_pair(KD2Tree::Point{{x, y}}, i);
         
         poi_zoom_0.push_back(point);
     }
     
-    MAP.poi_k2tree.root = MAP.poi_k2tree.make_tree(poi_zoom_0.begin(), poi_zoom_0.end(), 0, poi_zoom_0.size(), -1);
+    MAP.poi_k2tree.make_tree(poi_zoom_0, -1);
     
     poi_zoom_0.clear();
+    
+    cluster_points_of_interest();
+}
+
+
+// Groups the POIs into the cells of a grid for each zoom level, starting from the finest.
+// The cells of each level are made of whole cells of the level below, so each cluster is
+// made of the clusters below it, and its representative is one of theirs. The grid is fixed
+// to the map, so the clusters don't change as the view is panned
+void cluster_points_of_interest () {
+    // Cells of each zoom level from MIN_DRAW_ZOOM_LEVEL, in finest cells, each divides the one before it
+    const long cells_per_level[NUM_POI_CLUSTER_LEVELS] = {192, 64, 32, 8, 2, 1};
+    
+    // Screen coordinates are in radians, so a meter is 1 / EARTH_RADIUS_IN_METERS of them
+    double finest_cell = POI_CLUSTER_FINEST_CELL / EARTH_RADIUS_IN_METERS;
+    
+    // Rounds down instead of toward zero for negative coordinates
+    auto floor_divide = [](long a, long b) { return a >= 0 ? a / b : -((-a + b - 1) / b); };
+    
+    // Every POI starts as its own cluster, in its finest cell
+    std::vector<PoiCluster> clusters;
+    std::vector<std::pair<long, long>> cells;
+    for (unsigned int i = 0; i < unsigned(getNumPointsOfInterest()); i++) {
+        float x = x_from_lon(getPointOfInterestPosition(i).lon());
+        float y = y_from_lat(getPointOfInterestPosition(i).lat());
+        clusters.push_back({i, 1, KD2Tree::Point{{x, y}}});
+        cells.push_back(std::make_pair(long(floor(x / finest_cell)), long(floor(y / finest_cell))));
+    }
+    
+    MAP.poi_clusters.assign(NUM_POI_CLUSTER_LEVELS, std::vector<PoiCluster>());
+    MAP.poi_cluster_k2trees.assign(NUM_POI_CLUSTER_LEVELS, KD2Tree());
+    
+    long previous_cells = 1;
+    for (int level = NUM_POI_CLUSTER_LEVELS - 1; level >= 0; level--) {
+        long ratio = cells_per_level[level] / previous_cells;
+        previous_cells = cells_per_level[level];
+        
+        // Sorting by the cell of this level puts the clusters merging together next to each other
+        std::vector<std::pair<std::pair<long, long>, unsigned>> order;
+        for (unsigned c = 0; c < clusters.size(); c++) {
+            std::pair<long, long> cell(floor_divide(cells[c].first, ratio), floor_divide(cells[c].second, ratio));
+            order.push_back(std::make_pair(cell, c));
+        }
+        std::sort(order.begin(), order.end());
+        
+        std::vector<PoiCluster> merged;
+        std::vector<std::pair<long, long>> merged_cells;
+        for (unsigned begin = 0; begin < order.size(); ) {
+            unsigned end = begin;
+            double sum_x = 0, sum_y = 0;
+            unsigned count = 0;
+            while (end < order.size() && order[end].first == order[begin].first) {
+                const PoiCluster &child = clusters[order[end].second];
+                sum_x += double(child.centre[0]) * child.count;
+                sum_y += double(child.centre[1]) * child.count;
+                count += child.count;
+                end++;
+            }
+            
+            KD2Tree::Point centre = {{float(sum_x / count), float(sum_y / count)}};
+            
+            // The representative of the child closest to the centre, ties go to the lowest id
+            unsigned representative = clusters[order[begin].second].representative;
+            double best_distance = std::numeric_limits<double>::max();
+            for (unsigned k = begin; k < end; k++) {
+                unsigned poi = clusters[order[k].second].representative;
+                double dx = x_from_lon(getPointOfInterestPosition(poi).lon()) - centre[0];
+                double dy = y_from_lat(getPointOfInterestPosition(poi).lat()) - centre[1];
+                double distance = dx * dx + dy * dy;
+                if (distance < best_distance || (distance == best_distance && poi < representative)) {
+                    representative = poi;
+                    best_distance = distance;
+                }
+            }
+            
+            merged.push_back({representative, count, centre});
+            merged_cells.push_back(order[begin].first);
+            begin = end;
+        }
+        
+        clusters.swap(merged);
+        cells.swap(merged_cells);
+        
+        // Looked up by where their representative is drawn
+        std::vector<KD2Tree::Item> points;
+        for (unsigned c = 0; c < clusters.size(); c++) {
+            float x = x_from_lon(getPointOfInterestPosition(clusters[c].representative).lon());
+            float y = y_from_lat(getPointOfInterestPosition(clusters[c].representative).lat());
+            points.push_back(std::make_pair(KD2Tree::Point{{x, y}}, c));
+        }
+        MAP.poi_clusters[level] = clusters;
+        MAP.poi_cluster_k2trees[level].make_tree(points, MIN_DRAW_ZOOM_LEVEL + level);
+    }
 }
 
 
 void load_features () {
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> feature_zoom_m1;
-    std::vector<std::pair<std::pair<double, double>, unsigned int>> feature_zoom_2;
+    // Bounding box of each feature, for the zoom level it is drawn from
+    std::vector<std::vector<std::pair<RTreeBox, unsigned int>>> feature_boxes(NUM_DRAW_ZOOM_LEVELS);
     
     for (unsigned int i = 0; i < unsigned(getNumFeatures()); i++) {
         // Loops through feature points, counting how many intersect with limits of map, if it's
         // 4 or more, the map may be surrounded by an ocean or other feature, so must always be drawn
         int intersect_count = 0;
+        RTreeBox box = {0, 0, 0, 0};
         for (int j = 0; j < getFeaturePointCount(i); j++) {
             double x = x_from_lon(getFeaturePoint(j, i).lon());
             double y = y_from_lat(getFeaturePoint(j, i).lat());
@@ -180,26 +327,34 @@ void load_features () {
                 || y <= y_from_lat(MAP.world_values.min_lat) || y >= y_from_lat(MAP.world_values.max_lat)) {
                 intersect_count++;
             }
-
-            std::pair<std::pair<double, double>, unsigned int> point = std::make_pair(std::make_pair(x, y), i);
             
-            // Differentiate zoom level for features
-            FeatureType feature_type = getFeatureType(i);
-            switch(feature_type) {
-                case Beach: feature_zoom_2.push_back(point); break;
-                case Building: feature_zoom_2.push_back(point); break;
-                case Stream: feature_zoom_2.push_back(point); break;
-                default: feature_zoom_m1.push_back(point); break;
+            if (j == 0) {
+                box = {x, y, x, y};
+            } else {
+                box = {std::min(box.min_x, x), std::min(box.min_y, y), std::max(box.max_x, x), std::max(box.max_y, y)};
             }
         }
-        if(intersect_count >= 4) MAP.permanent_features.push_back(i);
+        if (getFeaturePointCount(i) == 0) continue;
+        
+        // Differentiate zoom level for features
+        int zoom_level;
+        FeatureType feature_type = getFeatureType(i);
+        switch(feature_type) {
+            case Beach: zoom_level = 2; break;
+            case Building: zoom_level = 2; break;
+            case Stream: zoom_level = 2; break;
+            default: zoom_level = -1; break;
+        }
+        if(intersect_count >= 4) zoom_level = -1;
+        
+        feature_boxes[zoom_level - MIN_DRAW_ZOOM_LEVEL].push_back(std::make_pair(box, i));
     }
     
-    MAP.feature_k2tree.root = MAP.feature_k2tree.make_tree(feature_zoom_m1.begin(), feature_zoom_m1.end(), 0, feature_zoom_m1.size(), -1);
-    MAP.feature_k2tree.insert_bulk(feature_zoom_2.begin(), feature_zoom_2.end(), MAP.feature_k2tree.root, 0, feature_zoom_2.size(), 2);
-    
-    feature_zoom_2.clear();
-    feature_zoom_m1.clear();
+    // One tree for each zoom level
+    MAP.feature_rtrees.resize(NUM_DRAW_ZOOM_LEVELS);
+    for(int z = 0; z < NUM_DRAW_ZOOM_LEVELS; z++) {
+        MAP.feature_rtrees[z].make_tree(feature_boxes[z]);
+    }
 }
 
 
@@ -245,19 +400,19 @@ void clear_map_data() {
     
     MAP.street_name_id_map.clear();
     
-    MAP.permanent_features.clear();
-    
     MAP.LocalStreetSegments.clear();
     
     MAP.state.last_selected_intersection = 10000000;
     
-    //clear KD trees and set root pointers to null
-    if(MAP.street_seg_k2tree.root != nullptr) delete MAP.street_seg_k2tree.root;
-        MAP.street_seg_k2tree.root = nullptr;
-    if(MAP.poi_k2tree.root != nullptr) delete MAP.poi_k2tree.root;
-        MAP.poi_k2tree.root = nullptr;
-    if(MAP.feature_k2tree.root != nullptr) delete MAP.feature_k2tree.root;
-        MAP.feature_k2tree.root = nullptr;
+    //clear KD trees and R-trees
+    MAP.street_seg_rtrees.clear();
+    MAP.feature_rtrees.clear();
+    MAP.intersection_k2tree.clear();
+    MAP.poi_k2tree.clear();
+    MAP.street_pair_ranges.clear();
+    MAP.street_pair_intersections.clear();
+    MAP.poi_clusters.clear();
+    MAP.poi_cluster_k2trees.clear();
     
     // Clear every node intersection
     for(int i = 0; i < getNumIntersections(); i++) {
@@ -266,6 +421,7 @@ void clear_map_data() {
         MAP.intersection_node.clear();
         
     MAP.OSM_data.bike_parking.clear();
+    MAP.OSM_data.bike_parking_tree.clear();
     MAP.OSM_data.bike_routes.clear();
     MAP.OSM_data.node_by_OSMID.clear();
     MAP.OSM_data.subway_routes.clear();
@@ -274,4 +430,7 @@ void clear_map_data() {
     MAP.route_data.route_segments.clear();
     
     MAP.directions_data.clear();
+    
+    // Cached courier searches are only correct for this map
+    courier_row_cache.clear();
 }
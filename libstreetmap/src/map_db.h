@@ -9,12 +9,24 @@
 #include "StreetsDatabaseAPI.h"
 #include <map>
 #include <list>
-#include "KD2Tree.h"
+#include "KDTree.h"
+#include "DynamicKDTree.h"
+#include "PackedRTree.h"
 #include <unordered_map>
 #include <ezgl/point.hpp>
 #include "m3.h"
 #include "ezgl/application.hpp"
 
+// Street segments and features are drawn from one of these zoom levels, each has its own R-tree
+#define MIN_DRAW_ZOOM_LEVEL -1
+#define NUM_DRAW_ZOOM_LEVELS 4
+
+// Points of interest are clustered for every zoom level from MIN_DRAW_ZOOM_LEVEL to 4
+#define NUM_POI_CLUSTER_LEVELS 6
+
+// Width of the cells of the finest POI clusters in meters, coarser cells are whole numbers of these
+#define POI_CLUSTER_FINEST_CELL 125
+
 //The definition of the global MAP object
 //used as the main database
 // A node represent a single intersection of the map
@@ -85,6 +97,13 @@ struct InfoStreetSegmentsLocal {
     int importance_level;               //when to draw based off zoom-level (-1 is most important)
 };
 
+// Points of interest in one cell of the grid of a zoom level, drawn as one
+struct PoiCluster {
+    unsigned representative; // The POI drawn for the cluster, the one closest to its centre
+    unsigned count; // POIs in the cluster
+    KD2Tree::Point centre; // Mean position of the POIs
+};
+
 struct WorldValues {
     double max_lat; //maximum latitude for drawing
     double max_lon; //maximum longitude for drawing
@@ -144,10 +163,55 @@ struct OSMData {
     std::vector<SubwayRouteData> subway_routes;
     std::vector<std::vector<ezgl::point2d>> bike_routes;
     std::vector<ezgl::point2d> bike_parking;
+    DynamicKD2Tree bike_parking_tree; // Index of each point of bike_parking, parking can be added or removed at any time
+};
+
+// How an annealing run of one thread went
+struct AnnealStats {
+    unsigned long swaps = 0; // Swaps tried
+    unsigned long legal_swaps = 0; // Swaps that kept the route legal
+    unsigned long accepted_swaps = 0; // Swaps kept, including uphill ones
+    unsigned long uphill_swaps = 0; // Swaps kept that made the route slower
+    unsigned long improvements = 0; // Times the best route got faster
+    unsigned reheats = 0;
+    double start_temp = 0;
+    double final_temp = 0;
+    double initial_time = 0; // Route time before annealing
+    double best_time = 0; // Route time after annealing
+    double run_time = 0; // Seconds spent annealing
+    double accept_ratio = 0; // Share of the legal swaps that were kept
+    double improvement_rate = 0; // Seconds of route time saved per second of annealing
+    std::vector<std::pair<float, float>> trace; // Best route time at sampled seconds since the call started
+};
+
+// How the last call of traveling_courier, fleet_courier or replan_courier spent its time, in seconds
+struct CourierStats {
+    std::string mode; // "anneal", "memetic", "sparse", "exact", "fleet" or "replan"
+    unsigned num_threads = 0;
+    double matrix_time = 0; // Searches filling the travel time matrix
+    double construction_time = 0; // Exact solver and the routes the optimization starts from
+    double optimization_time = 0; // Annealing or the memetic population, including the threads adding depots
+    double depot_time = 0; // Adding the closest depots, summed over the threads
+    double build_route_time = 0; // Rebuilding the street segments of the returned legs
+    double total_time = 0;
+    unsigned cached_rows = 0; // Rows of the matrix filled from searches kept by earlier calls
+    std::vector<std::pair<float, float>> best_trace; // Best route time of any thread at sampled seconds, without depots
 };
 
 struct Courier {
     std::vector<std::vector<unsigned>> time_between_deliveries; // A two dimentional array for time between delivery locations
+    std::vector<std::unordered_map<unsigned, int>> predecessor_edges; // For every row, the edge used to reach each intersection on the way to the destinations
+    std::vector<std::unordered_map<unsigned, int>> successor_edges; // For the columns searched backwards by replan_courier, the edge taken out of each intersection on the way to the column
+    std::vector<std::vector<bool>> successor_rows; // For those columns, the rows whose time came from the backward search
+    std::vector<float> flat_time_between_deliveries; // Row major copy of time_between_deliveries used to cost routes quickly
+    unsigned num_columns = 0; // Number of columns (pickups and dropoffs) in each row of the flat matrix
+    unsigned row_stride = 0; // Floats between the starts of two rows of the flat matrix, padded past num_columns
+    std::vector<unsigned> route_stops; // Matrix index of every stop of the last route, without the depots
+    std::vector<float> window_earliest; // Time window of each matrix index, empty if there are no windows
+    std::vector<float> window_latest;
+    std::vector<float> depot_arrival; // Time from the closest depot to each matrix index, filled with the windows
+    std::vector<AnnealStats> anneal_stats; // Statistics of each thread from the last annealing
+    CourierStats stats; // Timing of the phases of the last call
 }; 
 
 // The main structure for the globally defined MAP
@@ -155,14 +219,18 @@ struct MapInfo {
     std::vector<InfoIntersections> intersection_db;     //all intersections
     std::vector<Node*> intersection_node;  // all the intersection as node
     std::vector<InfoStreets> street_db;   
-    std::vector<unsigned int> permanent_features; // features that must always be drawn
     std::multimap<std::string, int> street_name_id_map; //for street names
+    std::unordered_map<uint64_t, std::pair<unsigned, unsigned>> street_pair_ranges; // Part of street_pair_intersections of each pair of streets, by street_pair_key
+    std::vector<unsigned> street_pair_intersections; // Intersections shared by each pair of streets, in order of id
     std::vector<InfoStreetSegmentsLocal> LocalStreetSegments;        //distances/speed limits for street segments
     WorldValues world_values;                           //values about the world (e.g. max latitude))
     Map_State state;
-    KD2Tree street_seg_k2tree;
+    std::vector<PackedRTree> street_seg_rtrees; // Bounding boxes of the segments drawn from each zoom level
+    std::vector<PackedRTree> feature_rtrees; // Bounding boxes of the features drawn from each zoom level
+    KD2Tree intersection_k2tree;
     KD2Tree poi_k2tree;
-    KD2Tree feature_k2tree;
+    std::vector<std::vector<PoiCluster>> poi_clusters; // POI clusters of each zoom level from MIN_DRAW_ZOOM_LEVEL
+    std::vector<KD2Tree> poi_cluster_k2trees; // Position of the representative of each cluster, with its index
     OSMData OSM_data;
     RouteData   route_data;
     Courier courier;
@@ -186,8 +254,15 @@ void load_intersections ();
 
 void load_streets ();
 
+void load_street_pairs ();
+
+// Same key for both orders of the streets
+uint64_t street_pair_key (unsigned street_id1, unsigned street_id2);
+
 void load_points_of_interest ();
 
+void cluster_points_of_interest ();
+
 void load_features ();
 
 int get_street_segment_importance(unsigned street_db_id);